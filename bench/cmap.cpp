@@ -0,0 +1,110 @@
+/*
+	Code point to glyph id lookup of the bundled fonts: the cmap init_font() decodes, against finding the subtable
+	and searching it on every lookup (how glyph_id() used to work). Also checks that both agree on every code point.
+
+	make bench, or from the repository root:
+	g++ -std=c++20 -O3 -o cmap bench/cmap.cpp && ./cmap
+*/
+#include "../src/schrift.cpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+static const char* fonts[] = { "./fonts/OpenSans-Regular.ttf", "./fonts/OpenSans-Italic.ttf", "./fonts/OpenSans-Bold.ttf", "./fonts/OpenSans-BoldItalic.ttf" };
+
+/* Times the code points are looked up, best one is reported */
+#define ROUNDS 200
+
+/*
+	@brief Finds cmap subtable and searches it, without the decoded table
+*/
+static int search(SFT_Font* font, unsigned long charCode, SFT_Glyph* glyph)
+{
+	uint_fast32_t table;
+	int format;
+
+	*glyph = 0;
+
+	if (cmap_table(font, &table, &format) < 0)
+		return -1;
+
+	switch (format)
+	{
+		case 12:
+			return cmap_fmt12_13(font, table, charCode, glyph, 12);
+		case 4:
+			return cmap_fmt4(font, table + 6, charCode, glyph);
+		case 6:
+			return cmap_fmt6(font, table + 6, charCode, glyph);
+		default:
+			return -1;
+	}
+};
+
+/*
+	@brief Looks every code point up ROUNDS times
+	@returns Best time per lookup in nanoseconds
+*/
+template <typename Find>
+static double measure(SFT_Font* font, const std::vector<unsigned long>& charCodes, Find find)
+{
+	double best = 1e30;
+	SFT_Glyph glyph;
+	unsigned long sum = 0;
+
+	for (int round = 0; round < ROUNDS; ++round)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (unsigned long charCode : charCodes)
+		{
+			find(font, charCode, &glyph);
+			sum += glyph;
+		}
+
+		best = std::min(best, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	// keeps lookups from being optimized away
+	if (sum == 42) printf(" ");
+
+	return best / charCodes.size();
+};
+
+int main()
+{
+	std::vector<unsigned long> charCodes;
+
+	// what expressions are made of: ASCII, latin, greek, cyrillic and math symbols, and a few the fonts lack
+	for (unsigned long first : {0x20ul, 0xC0ul, 0x391ul, 0x410ul, 0x2190ul, 0x2200ul, 0x1D400ul})
+		for (unsigned long charCode = first; charCode < first + 0x60; ++charCode)
+			charCodes.push_back(charCode);
+
+	for (const char* path : fonts)
+	{
+		SFT_Font* font = sft_loadfile(path);
+		SFT_Glyph decoded, searched;
+
+		if (font == NULL)
+		{
+			printf("\e[31m[ERROR] Could not load %s, run from the repository root\e[0m\n", path);
+			return 1;
+		}
+
+		for (unsigned long charCode = 0; charCode <= 0x10FFFF; ++charCode)
+			if (glyph_id(font, charCode, &decoded) != search(font, charCode, &searched) || decoded != searched)
+			{
+				printf("\e[31m[ERROR] %s: U+%04lX maps to %u, subtable says %u\e[0m\n", path, charCode, decoded, searched);
+				return 1;
+			}
+
+		printf("%-32s cmap format %2d: search %6.1f ns, decoded %5.1f ns per lookup\n", path, font->cmapFormat,
+			measure(font, charCodes, search), measure(font, charCodes, glyph_id));
+
+		sft_freefont(font);
+	}
+
+	return 0;
+};
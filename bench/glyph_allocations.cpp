@@ -0,0 +1,132 @@
+/*
+	Counts heap allocations of glyph rendering. Once scratch arena of the thread has grown,
+	sft_char_into() shouldn't allocate at all, and it has to render the same coverage as sft_char().
+
+	make bench, or from the repository root:
+	g++ -std=c++20 -O3 -o glyph_allocations bench/glyph_allocations.cpp && ./glyph_allocations
+*/
+#include "../src/schrift.cpp"
+
+#include <cstdio>
+#include <vector>
+
+#if defined(__GLIBC__)
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* memory, size_t size);
+
+static bool s_Counting = false;
+static size_t s_Allocations = 0;
+
+extern "C" void* malloc(size_t size)
+{
+	s_Allocations += s_Counting;
+	return __libc_malloc(size);
+};
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+	s_Allocations += s_Counting;
+	return __libc_calloc(count, size);
+};
+
+extern "C" void* realloc(void* memory, size_t size)
+{
+	s_Allocations += s_Counting;
+	return __libc_realloc(memory, size);
+};
+
+#endif
+
+static const char* fonts[] = { "./fonts/OpenSans-Regular.ttf", "./fonts/OpenSans-Italic.ttf", "./fonts/OpenSans-Bold.ttf", "./fonts/OpenSans-BoldItalic.ttf" };
+
+static const double sizes[] = { 8, 12, 16, 24, 50, 100, 200 };
+
+/*
+	@brief Renders characters 33-255 of every font at every size into one reused buffer
+	@param compare Also render them with sft_char() and compare
+	@returns Number of glyphs rendered, -1 if coverage differs
+*/
+static long renderAll(std::vector<SFT_Font*>& faces, std::vector<uint8_t>& pixels, bool compare)
+{
+	SFT_Canvas canvas;
+	SFT_Char c, reference;
+	long glyphs = 0;
+	int status;
+
+	for (SFT_Font* font : faces)
+		for (double size : sizes)
+			for (unsigned long charCode = 33; charCode < 256; ++charCode)
+			{
+				SFT sft = {font, size, size, 0, 0, SFT_DOWNWARD_Y | SFT_CATCH_MISSING};
+
+				if (sft_char_metrics(&sft, charCode, &c) != 0 || c.width * c.height == 0)
+					continue;
+
+				if (pixels.size() < (size_t)c.width * c.height)
+					pixels.resize((size_t)c.width * c.height);
+
+				canvas = {pixels.data(), c.width, c.height, c.width, 1};
+
+				if ((status = sft_char_into(&sft, charCode, &c, &canvas)) != 0)
+					continue;
+
+				glyphs++;
+
+				if (!compare) continue;
+
+				status = sft_char(&sft, charCode, &reference);
+
+				if (status != 0 || reference.width != c.width || reference.height != c.height
+					|| memcmp(reference.image, c.image, (size_t)c.width * c.height) != 0)
+				{
+					printf("\e[31m[ERROR] U+%04lX at %g px differs from sft_char()\e[0m\n", charCode, size);
+					free(reference.image);
+					return -1;
+				}
+
+				free(reference.image);
+			}
+
+	return glyphs;
+};
+
+int main()
+{
+	std::vector<SFT_Font*> faces;
+	std::vector<uint8_t> pixels;
+	long glyphs;
+
+	for (const char* path : fonts)
+	{
+		SFT_Font* font = sft_loadfile(path);
+
+		if (font == NULL)
+		{
+			printf("\e[31m[ERROR] Could not load %s, run from the repository root\e[0m\n", path);
+			return 1;
+		}
+
+		faces.push_back(font);
+	}
+
+	// first pass grows the arena and the buffer, and checks coverage
+	if (renderAll(faces, pixels, true) < 0)
+		return 1;
+
+	#if defined(__GLIBC__)
+		s_Counting = true;
+		glyphs = renderAll(faces, pixels, false);
+		s_Counting = false;
+
+		printf("%ld glyphs, %zu allocations\n", glyphs, s_Allocations);
+
+		return s_Allocations == 0 ? 0 : 1;
+	#else
+		glyphs = renderAll(faces, pixels, false);
+		printf("%ld glyphs, allocations are only counted with glibc\n", glyphs);
+
+		return 0;
+	#endif
+};
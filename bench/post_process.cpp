@@ -0,0 +1,175 @@
+/*
+	Row kernels post_process() integrates coverage with: scalar, SSE2 and AVX2 (when the CPU has it), run on the
+	same buffers for characters 33-255 of OpenSans-Regular at 50, 200 and 600 px. Checks that SIMD kernels are
+	at most 1 LSB off the scalar one and the scalar one off integration in double, and reports time of each kernel
+	next to drawing the outline into the buffer. At 50 px the whole glyph (drawing and integration) gets only
+	about a quarter faster with AVX2, at 200 and 600 px about twice as fast.
+
+	make bench, or from the repository root:
+	g++ -std=c++20 -O3 -o post_process bench/post_process.cpp && ./post_process
+*/
+#include "../src/schrift.cpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static const double sizes[] = { 50, 200, 600 };
+
+/* Runs of every measured call, best one is reported */
+#define ROUNDS 7
+
+/* Biggest difference from the scalar kernel and from integration in double allowed, in 1/255 */
+#define MAX_DIFF 1
+
+struct Kernel
+{
+	const char* name;
+	RowKernel row;
+	double micros = 0;
+};
+
+/* Integration in double, to see what float planes lose */
+static void double_row(const float* area, const float* cover, uint8_t* out, int width)
+{
+	double accum = 0, value;
+
+	for (int x = 0; x < width; ++x)
+	{
+		value = std::min(fabs(accum + area[x]), 1.0);
+		out[x] = (uint8_t)(value * 255.0 + 0.5);
+		accum += cover[x];
+	}
+};
+
+/* Scalar kernel, the one non-x86 builds use */
+static void scalar_row(const float* area, const float* cover, uint8_t* out, int width)
+{
+	accumulate_from(area, cover, out, 0, width, 0.0f);
+};
+
+/*
+	@brief Runs call ROUNDS times
+	@returns Best time in microseconds
+*/
+template <typename Call>
+static double measure(Call call)
+{
+	double best = 1e30;
+
+	for (int round = 0; round < ROUNDS; ++round)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		call();
+
+		best = std::min(best, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	return best;
+};
+
+/*
+	@brief Integrates every row of the buffer with kernel, like post_process() does
+*/
+static void integrate(RowKernel row, const Buffer& buf, uint8_t* image)
+{
+	for (int y = 0; y < buf.height; ++y)
+		row(buf.area + (size_t)y * buf.width, buf.cover + (size_t)y * buf.width, image + (size_t)y * buf.width, buf.width);
+};
+
+int main()
+{
+	SFT_Font* font = sft_loadfile("./fonts/OpenSans-Regular.ttf");
+
+	if (font == NULL)
+	{
+		printf("\e[31m[ERROR] Could not load ./fonts/OpenSans-Regular.ttf, run from the repository root\e[0m\n");
+		return 1;
+	}
+
+	std::vector<Kernel> kernels = { {"scalar", scalar_row} };
+
+	#ifdef SFT_SIMD
+		kernels.push_back({"sse2", accumulate_row_sse2});
+
+		__builtin_cpu_init();
+
+		if (__builtin_cpu_supports("avx2"))
+			kernels.push_back({"avx2", accumulate_row_avx2});
+	#endif
+
+	std::vector<uint8_t> exact, reference, image;
+	int status = 0;
+
+	printf("  size    draw us/glyph");
+	for (const Kernel& kernel : kernels)
+		printf("   %6s us/glyph", kernel.name);
+	printf("   max diff (kernels, double)\n");
+
+	for (double size : sizes)
+	{
+		SFT sft = {font, size, size, 0, 0, SFT_DOWNWARD_Y};
+		double draw = 0;
+		long glyphs = 0;
+		int maxDiff = 0, maxError = 0;
+
+		for (Kernel& kernel : kernels)
+			kernel.micros = 0;
+
+		for (unsigned long charCode = 33; charCode < 256; ++charCode)
+		{
+			double transform[6];
+			uint_fast32_t offset;
+			SFT_Glyph glyph;
+			SFT_Char c;
+			Buffer buf;
+
+			if (sft_lookup(&sft, charCode, &glyph) != 0 || glyph == 0 || place_glyph(&sft, glyph, &c, transform, &offset) <= 0)
+				continue;
+
+			// outline is transformed in place, so it's drawn from the font every round
+			draw += measure([&]() { rasterize(&sft, glyph, offset, transform, c.width, c.height, &buf); });
+
+			if (rasterize(&sft, glyph, offset, transform, c.width, c.height, &buf) < 0)
+				continue;
+
+			exact.assign((size_t)buf.width * buf.height, 0);
+			reference.assign(exact.size(), 0);
+			image.assign(exact.size(), 0);
+
+			integrate(double_row, buf, exact.data());
+			integrate(scalar_row, buf, reference.data());
+
+			for (size_t i = 0; i < exact.size(); ++i)
+				maxError = std::max(maxError, std::abs((int)reference[i] - (int)exact[i]));
+
+			for (Kernel& kernel : kernels)
+			{
+				kernel.micros += measure([&]() { integrate(kernel.row, buf, image.data()); });
+
+				for (size_t i = 0; i < image.size(); ++i)
+					maxDiff = std::max(maxDiff, std::abs((int)image[i] - (int)reference[i]));
+			}
+
+			glyphs++;
+		}
+
+		printf("%6g   %14.2f", size, draw / glyphs);
+		for (const Kernel& kernel : kernels)
+			printf("   %15.2f", kernel.micros / glyphs);
+		printf("   %8d %8d\n", maxDiff, maxError);
+
+		if (maxDiff > MAX_DIFF || maxError > MAX_DIFF)
+		{
+			printf("\e[31m[ERROR] Coverage differs by %d at %g px, more than %d\e[0m\n", std::max(maxDiff, maxError), size, MAX_DIFF);
+			status = 1;
+		}
+	}
+
+	sft_freefont(font);
+
+	return status;
+};
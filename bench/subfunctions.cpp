@@ -0,0 +1,130 @@
+/*
+	Subfunction lookup at every backslash of a command heavy expression: the trie getSubFunction() walks,
+	against comparing subfunctions[] entry by entry (how lookup used to work). Also checks that the trie
+	finds the longest matching entry.
+
+	make bench, or from the repository root:
+	g++ -std=c++20 -O3 -o subfunctions bench/subfunctions.cpp && ./subfunctions
+*/
+#include "../src/Latex.hpp"
+#include "../src/Trie.hpp"
+
+#include <string_view>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <array>
+
+/* Commands in the expression */
+#define COMMANDS 20000
+
+/* Times the expression is looked through, best one is reported */
+#define ROUNDS 200
+
+/* Same trie Latex.cpp builds */
+static constexpr auto subfunctionTrie = TrieBuilder::build<TrieBuilder::countNodes(subfunctions)>(subfunctions);
+
+static constexpr size_t subfunctionCount = []()
+{
+	size_t count = 0;
+
+	while (subfunctions[count].expression != NULL)
+		count++;
+
+	return count;
+}();
+
+// expressions only, handlers are left out so none of Latex has to be linked
+static constexpr auto expressions = []()
+{
+	std::array<std::string_view, subfunctionCount> names = {};
+
+	for (size_t i = 0; i < subfunctionCount; ++i)
+		names[i] = subfunctions[i].expression;
+
+	return names;
+}();
+
+/*
+	@returns First entry that expression continues with at position, -1 if none
+*/
+static int scan(std::string_view expression, size_t at)
+{
+	for (size_t i = 0; i < subfunctionCount; ++i)
+		if (expression.compare(at, expressions[i].length(), expressions[i]) == 0)
+			return (int)i;
+
+	return -1;
+};
+
+/*
+	@returns Longest entry that expression continues with at position (first of equal ones), -1 if none
+*/
+static int longest(std::string_view expression, size_t at)
+{
+	int match = -1;
+
+	for (size_t i = 0; i < subfunctionCount; ++i)
+		if (expression.compare(at, expressions[i].length(), expressions[i]) == 0
+			&& (match < 0 || expressions[i].length() > expressions[match].length()))
+			match = (int)i;
+
+	return match;
+};
+
+/*
+	@brief Looks up subfunction at every backslash ROUNDS times
+	@returns Best time per lookup in nanoseconds
+*/
+template <typename Find>
+static double measure(const std::string& expression, const std::vector<size_t>& positions, Find find)
+{
+	double best = 1e30;
+	long sum = 0;
+
+	for (int round = 0; round < ROUNDS; ++round)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (size_t at : positions)
+			sum += find(expression, at);
+
+		best = std::min(best, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	// keeps lookups from being optimized away
+	if (sum == 42) printf(" ");
+
+	return best / positions.size();
+};
+
+int main()
+{
+	std::vector<size_t> positions;
+	std::string expression;
+
+	// every command of the table in turn, with an argument or a space after it
+	for (size_t i = 0; positions.size() < COMMANDS; i = (i + 1) % subfunctionCount)
+	{
+		if (expressions[i].empty() || expressions[i][0] != '\\') continue;
+
+		positions.push_back(expression.length());
+		expression += expressions[i];
+		expression += i % 2 == 0 ? "{x}" : " x";
+	}
+
+	for (size_t at : positions)
+		if (subfunctionTrie.find(expression, at) != longest(expression, at))
+		{
+			printf("\e[31m[ERROR] trie doesn't find the longest subfunction at %s\e[0m\n", expression.substr(at, 16).c_str());
+			return 1;
+		}
+
+	double table = measure(expression, positions, [](std::string_view text, size_t at) { return scan(text, at); });
+	double trie = measure(expression, positions, [](std::string_view text, size_t at) { return subfunctionTrie.find(text, at); });
+
+	printf("%zu subfunctions, %d lookups: table scan %.1f ns, trie %.1f ns per lookup\n", subfunctionCount, COMMANDS, table, trie);
+
+	return 0;
+};
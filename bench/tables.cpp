@@ -0,0 +1,241 @@
+/*
+	Lookups that read table offsets init_font() resolves, against the same lookups as they were before, searching
+	the table directory on every call. Bundled fonts at 24 px. Also checks that the resolved offsets are the ones
+	the directory gives.
+
+	glyph_id() reads the cmap subtable only when cmap couldn't be decoded at load, so it is run with the decoded
+	cmap taken away. sft_char() makes no lookups on these fonts either way (glyph ids, metrics and outlines come
+	from tables filled at load), sft_kerning() neither (pairs are hashed at load), so sft_char() is timed only
+	to show what the lookups are worth next to rendering a glyph.
+
+	make bench, or from the repository root:
+	g++ -std=c++20 -O3 -o tables bench/tables.cpp && ./tables
+*/
+#include "../src/schrift.cpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+static const char* fonts[] = { "./fonts/OpenSans-Regular.ttf", "./fonts/OpenSans-Italic.ttf", "./fonts/OpenSans-Bold.ttf", "./fonts/OpenSans-BoldItalic.ttf" };
+
+/* Runs of every measured loop, best one is reported */
+#define ROUNDS 7
+
+/* Calls in one run */
+#define CALLS 20000
+
+/*
+	@brief Runs call CALLS times, ROUNDS times over
+	@param call Gets index of the call
+	@returns Best time per call in nanoseconds
+*/
+template <typename Call>
+static double measure(Call call, int calls = CALLS)
+{
+	double best = 1e30;
+
+	for (int round = 0; round < ROUNDS; ++round)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (int i = 0; i < calls; ++i)
+			call(i);
+
+		best = std::min(best, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	return best / calls;
+};
+
+/* sft_lmetrics() before offsets were resolved */
+static int lmetrics_directory(const SFT* sft, SFT_LMetrics* lmetrics)
+{
+	double factor;
+	uint_fast32_t hhea;
+	memset(lmetrics, 0, sizeof *lmetrics);
+	if (gettable(sft->font, "hhea", &hhea) < 0)
+		return -1;
+	if (!is_safe_offset(sft->font, hhea, 36))
+		return -1;
+	factor = sft->yScale / sft->font->unitsPerEm;
+	lmetrics->ascender  = geti16(sft->font, hhea + 4) * factor;
+	lmetrics->descender = geti16(sft->font, hhea + 6) * factor;
+	lmetrics->lineGap   = geti16(sft->font, hhea + 8) * factor;
+	return 0;
+};
+
+/* glyph_id() before offsets were resolved, from the point it reads the subtable on */
+static int glyph_id_directory(SFT_Font* font, unsigned long charCode, SFT_Glyph* glyph)
+{
+	uint_fast32_t table;
+	int format;
+
+	*glyph = 0;
+
+	if (cmap_table(font, &table, &format) < 0)
+		return -1;
+
+	switch (format) {
+	case 12:
+		return cmap_fmt12_13(font, table, charCode, glyph, 12);
+	case 4:
+		return cmap_fmt4(font, table + 6, charCode, glyph);
+	default:
+		return cmap_fmt6(font, table + 6, charCode, glyph);
+	}
+};
+
+/* hor_metrics() before offsets were resolved */
+static int hor_metrics_directory(SFT_Font* font, SFT_Glyph glyph, int* advanceWidth, int* leftSideBearing)
+{
+	uint32_t offset, boundary;
+	uint_fast32_t hmtx;
+	if (gettable(font, "hmtx", &hmtx) < 0)
+		return -1;
+	if (glyph < font->numLongHmtx) {
+		offset = hmtx + 4 * glyph;
+		if (font->size < offset + 4)
+			return -1;
+		*advanceWidth = getu16(font, offset);
+		*leftSideBearing = geti16(font, offset + 2);
+		return 0;
+	} else {
+		boundary = hmtx + 4 * font->numLongHmtx;
+		if (boundary < 4)
+			return -1;
+		offset = boundary - 4;
+		if (font->size < offset + 4)
+			return -1;
+		*advanceWidth = getu16(font, offset);
+		offset = boundary + 2 * (glyph - font->numLongHmtx);
+		if (font->size < offset + 2)
+			return -1;
+		*leftSideBearing = geti16(font, offset);
+		return 0;
+	}
+};
+
+/* outline_offset() before offsets were resolved */
+static int outline_offset_directory(SFT_Font* font, SFT_Glyph glyph, uint_fast32_t* offset)
+{
+	uint_fast32_t loca, glyf;
+	uint_fast32_t base, thiss, next;
+
+	if (gettable(font, "loca", &loca) < 0)
+		return -1;
+	if (gettable(font, "glyf", &glyf) < 0)
+		return -1;
+
+	if (font->locaFormat == 0) {
+		base = loca + 2 * glyph;
+		if (!is_safe_offset(font, base, 4))
+			return -1;
+		thiss = 2U * (uint_fast32_t) getu16(font, base);
+		next = 2U * (uint_fast32_t) getu16(font, base + 2);
+	} else {
+		base = loca + 4 * glyph;
+		if (!is_safe_offset(font, base, 8))
+			return -1;
+		thiss = getu32(font, base);
+		next = getu32(font, base + 4);
+	}
+
+	*offset = thiss == next ? 0 : glyf + thiss;
+	return 0;
+};
+
+/*
+	@brief Prints both times of a lookup
+*/
+static void report(const char* name, double resolved, double directory, const char* unit = "ns")
+{
+	printf("  %-34s %8.1f %s %10.1f %s   %5.1fx\n", name, resolved, unit, directory, unit, directory / resolved);
+};
+
+int main()
+{
+	volatile uint_fast32_t sink = 0;
+
+	for (const char* path : fonts)
+	{
+		SFT_Font* font = sft_loadfile(path);
+		SFT sft = {font, 24, 24, 0, 0, SFT_DOWNWARD_Y};
+		SFT_LMetrics lmetrics;
+		int advance, bearing;
+		uint_fast32_t outline;
+		SFT_Glyph glyph;
+
+		if (font == NULL)
+		{
+			printf("\e[31m[ERROR] Could not load %s, run from the repository root\e[0m\n", path);
+			return 1;
+		}
+
+		if (font->hhea != table_offset(font, "hhea") || font->hmtx != table_offset(font, "hmtx") || font->loca != table_offset(font, "loca")
+			|| font->glyf != table_offset(font, "glyf") || font->kern != table_offset(font, "kern"))
+		{
+			printf("\e[31m[ERROR] %s: resolved table offsets differ from the directory\e[0m\n", path);
+			return 1;
+		}
+
+		printf("%-36s %11s %13s\n", path, "resolved", "directory");
+
+		report("sft_lmetrics",
+			measure([&](int) { sft_lmetrics(&sft, &lmetrics); sink = sink + lmetrics.lineGap; }),
+			measure([&](int) { lmetrics_directory(&sft, &lmetrics); sink = sink + lmetrics.lineGap; }));
+
+		// subtable path of glyph_id(), decoded cmap is put back afterwards
+		const uint_least16_t* decoded = font->cmap[0];
+		font->cmap[0] = NULL;
+
+		report("glyph_id (cmap not decoded)",
+			measure([&](int i) { glyph_id(font, 'A' + i % 58, &glyph); sink = sink + glyph; }),
+			measure([&](int i) { glyph_id_directory(font, 'A' + i % 58, &glyph); sink = sink + glyph; }));
+
+		font->cmap[0] = decoded;
+
+		report("hor_metrics",
+			measure([&](int i) { hor_metrics(font, i % font->numGlyphs, &advance, &bearing); sink = sink + advance; }),
+			measure([&](int i) { hor_metrics_directory(font, i % font->numGlyphs, &advance, &bearing); sink = sink + advance; }));
+
+		report("outline_offset",
+			measure([&](int i) { outline_offset(font, i % font->numGlyphs, &outline); sink = sink + outline; }),
+			measure([&](int i) { outline_offset_directory(font, i % font->numGlyphs, &outline); sink = sink + outline; }));
+
+		// init_metrics() reads both for every glyph when font is loaded
+		report("both for every glyph (at load)",
+			measure([&](int)
+			{
+				for (SFT_Glyph g = 0; g < font->numGlyphs; ++g)
+				{
+					hor_metrics(font, g, &advance, &bearing);
+					outline_offset(font, g, &outline);
+					sink = sink + advance + outline;
+				}
+			}, 20) / 1000,
+			measure([&](int)
+			{
+				for (SFT_Glyph g = 0; g < font->numGlyphs; ++g)
+				{
+					hor_metrics_directory(font, g, &advance, &bearing);
+					outline_offset_directory(font, g, &outline);
+					sink = sink + advance + outline;
+				}
+			}, 20) / 1000, "us");
+
+		double charTime = measure([&](int i)
+		{
+			SFT_Char c;
+			sft_char(&sft, 'A' + i % 58, &c);
+			free(c.image);
+		});
+
+		printf("  %-34s %8.1f ns   (no lookups)\n\n", "sft_char", charTime);
+
+		sft_freefont(font);
+	}
+
+	return 0;
+};
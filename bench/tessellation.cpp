@@ -0,0 +1,256 @@
+/*
+	Curve tessellation for characters 33-255 of the bundled fonts at 8-400 px: the midpoint subdivision
+	tesselate_curve() used to do (halving until the control point is within 0.5 px of the chord's midpoint),
+	against forward differencing at the flatness rasterize() takes from render_flatness(). Reports lines per glyph,
+	time per glyph, and how far coverage of each is from coverage of a REFERENCE_FLATNESS tessellation:
+	mean difference per inked pixel and pixels off by more than BAD_DIFF, both in 1/255.
+
+	make bench, or from the repository root:
+	g++ -std=c++20 -O3 -o tessellation bench/tessellation.cpp && ./tessellation
+*/
+#include "../src/schrift.cpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static const char* fonts[] = { "./fonts/OpenSans-Regular.ttf", "./fonts/OpenSans-Italic.ttf", "./fonts/OpenSans-Bold.ttf", "./fonts/OpenSans-BoldItalic.ttf" };
+
+static const double sizes[] = { 8, 10, 12, 14, 16, 20, 24, 32, 50, 100, 200, 400 };
+
+/* Times every glyph is tessellated, so the clock has something to measure */
+#define ROUNDS 50
+
+/* Runs of ROUNDS tessellations, best one is reported */
+#define REPEATS 5
+
+/* Lines of the reference stay this close to the curves, in pixels */
+#define REFERENCE_FLATNESS 0.01
+
+/* Coverage difference counted as a visible error */
+#define BAD_DIFF 32
+
+struct Result
+{
+	long lines = 0;
+	double micros = 0;
+	/* Sum of differences from the reference over inked pixels */
+	double diff = 0;
+	long inked = 0;
+	long bad = 0;
+};
+
+/* Transformed outline before its curves are split */
+struct Curves
+{
+	std::vector<Point> points;
+	uint_least16_t numPoints, numLines;
+};
+
+/* Flatness test of the midpoint subdivision */
+static int is_flat(Outline* outl, Curve curve, double flatness)
+{
+	Point beg = outl->points[curve.beg];
+	Point end = outl->points[curve.end];
+	Point ctrl = outl->points[curve.ctrl];
+	Point mid = midpoint(beg, end);
+	double x = ctrl.x - mid.x;
+	double y = ctrl.y - mid.y;
+	return x * x + y * y <= flatness * flatness;
+};
+
+/* tesselate_curve() before forward differencing, with its stack of 10 curves and 0.5 px flatness */
+static int tesselate_midpoint(Curve curve, Outline* outl)
+{
+#define STACK_SIZE 10
+	Curve stack[STACK_SIZE];
+	unsigned int top = 0;
+	for (;;) {
+		if (is_flat(outl, curve, 0.5) || top >= STACK_SIZE) {
+			if (outl->numLines >= outl->capLines && grow_lines(outl) < 0)
+				return -1;
+			outl->lines[outl->numLines++] = { curve.beg, curve.end };
+			if (top == 0) break;
+			curve = stack[--top];
+		} else {
+			unsigned int ctrl0 = outl->numPoints;
+			if (outl->numPoints >= outl->capPoints && grow_points(outl) < 0)
+				return -1;
+			outl->points[ctrl0] = midpoint(outl->points[curve.beg], outl->points[curve.ctrl]);
+			++outl->numPoints;
+
+			unsigned int ctrl1 = outl->numPoints;
+			if (outl->numPoints >= outl->capPoints && grow_points(outl) < 0)
+				return -1;
+			outl->points[ctrl1] = midpoint(outl->points[curve.ctrl], outl->points[curve.end]);
+			++outl->numPoints;
+
+			unsigned int pivot = outl->numPoints;
+			if (outl->numPoints >= outl->capPoints && grow_points(outl) < 0)
+				return -1;
+			outl->points[pivot] = midpoint(outl->points[ctrl0], outl->points[ctrl1]);
+			++outl->numPoints;
+
+			stack[top++] = { curve.beg, static_cast<uint_least16_t>(pivot), static_cast<uint_least16_t>(ctrl0) };
+			curve = { static_cast<uint_least16_t>(pivot), curve.end, static_cast<uint_least16_t>(ctrl1) };
+		}
+	}
+	return 0;
+#undef STACK_SIZE
+};
+
+/* tesselate_curves() before forward differencing */
+static int tesselate_midpoints(Outline* outl)
+{
+	for (unsigned int i = 0; i < outl->numCurves; ++i)
+		if (tesselate_midpoint(outl->curves[i], outl) < 0)
+			return -1;
+	return 0;
+};
+
+/*
+	@brief Puts outline back to its curves, lines of the previous tessellation are dropped
+*/
+static void restore(Outline& outl, const Curves& curves)
+{
+	outl.numPoints = curves.numPoints;
+	outl.numLines = curves.numLines;
+	memcpy(outl.points, curves.points.data(), curves.points.size() * sizeof(Point));
+};
+
+/*
+	@brief Draws lines of the outline and integrates them into coverage, like rasterize() and post_process() do
+*/
+static void cover(Outline& outl, int width, int height, std::vector<uint8_t>& image)
+{
+	Buffer buf;
+
+	image.assign((size_t)width * height, 0);
+
+	if (init_buffer(&buf, width, height) < 0)
+		return;
+
+	draw_lines(&outl, buf);
+	post_process(buf, image.data(), width, 0);
+};
+
+/*
+	@brief Tessellates outline ROUNDS times over, starting from its curves every time, then compares its coverage with reference
+*/
+template <typename Tessellate>
+static void measure(Outline& outl, const Curves& curves, int width, int height, const std::vector<uint8_t>& reference, Tessellate tessellate, Result& result)
+{
+	std::vector<uint8_t> image;
+	double best = 1e30;
+
+	for (int repeat = 0; repeat < REPEATS; ++repeat)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (int round = 0; round < ROUNDS; ++round)
+		{
+			restore(outl, curves);
+			tessellate();
+		}
+
+		best = std::min(best, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / ROUNDS);
+	}
+
+	result.micros += best;
+	result.lines += outl.numLines;
+
+	cover(outl, width, height, image);
+
+	for (size_t i = 0; i < image.size(); ++i)
+	{
+		int diff = std::abs((int)image[i] - (int)reference[i]);
+
+		if (image[i] == 0 && reference[i] == 0)
+			continue;
+
+		result.diff += diff;
+		result.inked++;
+		result.bad += diff > BAD_DIFF;
+	}
+};
+
+int main()
+{
+	std::vector<SFT_Font*> faces;
+
+	for (const char* path : fonts)
+	{
+		SFT_Font* font = sft_loadfile(path);
+
+		if (font == NULL)
+		{
+			printf("\e[31m[ERROR] Could not load %s, run from the repository root\e[0m\n", path);
+			return 1;
+		}
+
+		faces.push_back(font);
+	}
+
+	printf("  size   flatness      lines/glyph          us/glyph          mean diff/inked px    pixels off by >%d\n", BAD_DIFF);
+	printf("                    midpoint  forward    midpoint  forward    midpoint  forward      midpoint   forward\n");
+
+	for (double size : sizes)
+	{
+		SFT scale = {NULL, size, size, 0, 0, 0};
+		double flatness = render_flatness(&scale);
+		Result midpoints, forward;
+		std::vector<uint8_t> reference;
+		long glyphs = 0;
+
+		for (SFT_Font* font : faces)
+		{
+			SFT sft = {font, size, size, 0, 0, SFT_DOWNWARD_Y};
+
+			for (unsigned long charCode = 33; charCode < 256; ++charCode)
+			{
+				double transform[6];
+				uint_fast32_t offset;
+				SFT_Glyph glyph;
+				SFT_Char c;
+				Outline outl;
+
+				if (sft_lookup(&sft, charCode, &glyph) != 0 || glyph == 0 || place_glyph(&sft, glyph, &c, transform, &offset) <= 0)
+					continue;
+
+				// same steps as rasterize() up to tessellation
+				memset(&outl, 0, sizeof(outl));
+				arena_reset(&scratch);
+
+				if (init_outline(&outl) < 0 || load_outline(font, glyph, offset, &outl) < 0)
+					continue;
+
+				transform_points(outl.numPoints, outl.points, transform);
+				clip_points(outl.numPoints, outl.points, c.width, c.height);
+
+				Curves curves = {std::vector<Point>(outl.points, outl.points + outl.numPoints), outl.numPoints, outl.numLines};
+
+				tesselate_curves(&outl, REFERENCE_FLATNESS);
+				cover(outl, c.width, c.height, reference);
+
+				measure(outl, curves, c.width, c.height, reference, [&]() { tesselate_midpoints(&outl); }, midpoints);
+
+				measure(outl, curves, c.width, c.height, reference, [&]() { tesselate_curves(&outl, flatness); }, forward);
+
+				glyphs++;
+			}
+		}
+
+		printf("%6g   %8.3f   %8.1f %8.1f    %8.3f %8.3f    %8.2f %8.2f      %8ld  %8ld\n", size, flatness,
+			(double)midpoints.lines / glyphs, (double)forward.lines / glyphs,
+			midpoints.micros / glyphs, forward.micros / glyphs,
+			midpoints.diff / midpoints.inked, forward.diff / forward.inked,
+			midpoints.bad, forward.bad);
+	}
+
+	for (SFT_Font* font : faces)
+		sft_freefont(font);
+
+	return 0;
+};
@@ -1,34 +1,276 @@
 #include "src/Latex.hpp"
+#include "src/Server.hpp"
+
+#include <fstream>
+#include <csignal>
+
+/* Server that SIGINT/SIGTERM stop gracefully */
+static Server* s_Server = nullptr;
+
+static void stopServer(int signal)
+{
+	if (s_Server != nullptr)
+		s_Server->stop();
+};
+
+/*
+	@brief Renders every `expression<TAB>output_path` line of the input. Failed lines are reported and skipped.
+	@param latex Latex instance with fonts loaded
+	@param input Manifest stream
+	@param pool Pool lines are rendered on, nullptr - render them one by one on the calling thread
+	@returns Number of failed lines
+*/
+static size_t renderBatch(const Latex& latex, std::istream& input, ThreadPool* pool)
+{
+	PROFILE_FUNCTION();
+
+	std::mutex outputMutex;
+	std::atomic<size_t> failed {0};
+	size_t total = 0;
+	std::string line;
+
+	auto fail = [&](size_t lineNumber, const std::string& message)
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		std::cerr << "line " << lineNumber << ": " << message << "\n";
+		failed++;
+	};
+
+	auto render = [&](size_t lineNumber, std::string expression, std::string filepath)
+	{
+		try
+		{
+			if (!latex.toImage(expression).write(filepath.c_str()))
+				fail(lineNumber, "could not write " + filepath);
+		}
+		catch (const std::exception& err)
+		{
+			fail(lineNumber, err.what());
+		}
+	};
+
+	// single thread renders right away, so huge manifests are never held in memory
+	TaskGroup group(pool);
+
+	for (size_t lineNumber = 1; std::getline(input, line); ++lineNumber)
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+
+		if (line.empty()) continue;
+
+		total++;
+
+		size_t tab = line.rfind('\t');
+
+		if (tab == std::string::npos || tab == 0 || tab + 1 == line.length())
+		{
+			fail(lineNumber, "expected expression<TAB>output_path");
+			continue;
+		}
+
+		group.run([&render, lineNumber, expression = line.substr(0, tab), filepath = line.substr(tab + 1)]()
+		{
+			render(lineNumber, expression, filepath);
+		});
+	}
+
+	group.wait();
+
+	std::cerr << "rendered " << total - failed << " of " << total << ", " << failed << " failed\n";
+
+	return failed;
+};
+
+/*
+	@brief Sends expression to a running server and writes returned image
+	@returns Exit status
+*/
+static int requestImage(int argc, char* argv[])
+{
+	// dumbtex --request <socket> <expression> <output_path> [--size N] [--color RRGGBB]
+	RenderRequest request;
+	request.expression = argv[3];
+	request.type = Image::getFileType(argv[4]);
+
+	if (request.type < ImageType::PNG)
+		request.type = ImageType::PNG;
+
+	for (int i = 5; i + 1 < argc; i += 2)
+	{
+		if (strcmp(argv[i], "--size") == 0)
+			request.size = (uint16_t)atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--color") == 0)
+			request.color = hexToRGBA(std::string(argv[i + 1]));
+	}
+
+	std::vector<uint8_t> bytes = Server::request(argv[2], request);
+	std::ofstream file(argv[4], std::ios::binary);
+
+	if (!file.write((const char*)bytes.data(), bytes.size()))
+		throw std::runtime_error(std::string("Could not write ") + argv[4]);
+
+	return 0;
+};
+
+/*
+	@brief Attaches glyph store shared with other processes
+	@param path Store file, nullptr - none
+*/
+static void openStore(Latex& latex, const char* path)
+{
+	if (path != nullptr)
+		latex.setGlyphStore(std::make_shared<GlyphStore>(path));
+};
+
+/*
+	@brief Fills glyph caches from snapshot. If snapshot can't be used, glyphs are rasterized and snapshot is written for the next start
+*/
+static void loadGlyphs(Latex& latex, const char* snapshot)
+{
+	if (snapshot == nullptr || latex.loadGlyphs(snapshot))
+		return;
+
+	latex.prewarmGlyphs();
+	latex.saveGlyphs(snapshot);
+};
 
 //Compiles from c++11
 int main(int argc, char* argv[]) {
-	
+
 	#if defined(DEBUG) || defined(PROFILER)
 	Instrumentor::Get().BeginSession("Profile");
 	{
 	#endif
-	
+
 	PROFILE_FUNCTION();
 
-	std::string equation = argv[1];
-	const char* filepath = argv[2];
+	int status = 0;
 
 	try
 	{
-		Latex::Get().setFonts("./fonts/OpenSans-Regular.ttf", "./fonts/OpenSans-Italic.ttf", "./fonts/OpenSans-Bold.ttf", "./fonts/OpenSans-BoldItalic.ttf");
+		if (argc >= 5 && strcmp(argv[1], "--request") == 0)
+			status = requestImage(argc, argv);
+		else
+		{
+			Latex latex;
+
+			latex.setFonts("./fonts/OpenSans-Regular.ttf", "./fonts/OpenSans-Italic.ttf", "./fonts/OpenSans-Bold.ttf", "./fonts/OpenSans-BoldItalic.ttf");
+
+			if (argc >= 2 && strcmp(argv[1], "--batch") == 0)
+			{
+				// dumbtex --batch [manifest | -] [--threads N] [--glyphs snapshot] [--store path]
+				const char* manifest = "-";
+				const char* snapshot = nullptr;
+				const char* store = nullptr;
+				size_t threads = 1;
+
+				for (int i = 2; i < argc; ++i)
+				{
+					if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+						threads = std::max(1, atoi(argv[++i]));
+					else if (strcmp(argv[i], "--glyphs") == 0 && i + 1 < argc)
+						snapshot = argv[++i];
+					else if (strcmp(argv[i], "--store") == 0 && i + 1 < argc)
+						store = argv[++i];
+					else
+						manifest = argv[i];
+				}
+
+				openStore(latex, store);
+				loadGlyphs(latex, snapshot);
+
+				// lines and subtrees of their expressions share workers
+				std::shared_ptr<ThreadPool> pool = threads > 1 ? std::make_shared<ThreadPool>(threads) : nullptr;
+				latex.setThreadPool(pool);
 
-		if (argc >= 3)
-			Latex::Get().toImage(equation).write(filepath);
-	
+				if (strcmp(manifest, "-") == 0)
+					status = renderBatch(latex, std::cin, pool.get()) == 0 ? 0 : 1;
+				else
+				{
+					std::ifstream file(manifest);
+
+					if (!file)
+						throw std::runtime_error(std::string("Could not open ") + manifest);
+
+					status = renderBatch(latex, file, pool.get()) == 0 ? 0 : 1;
+				}
+			}
+			else if (argc >= 3 && strcmp(argv[1], "--serve") == 0)
+			{
+				// dumbtex --serve <socket> [--threads N] [--timeout ms] [--glyphs snapshot] [--store path]
+				const char* snapshot = nullptr;
+				const char* store = nullptr;
+				size_t threads = 0;
+				int timeout = 5000;
+
+				for (int i = 3; i + 1 < argc; i += 2)
+				{
+					if (strcmp(argv[i], "--threads") == 0)
+						threads = std::max(0, atoi(argv[i + 1]));
+					else if (strcmp(argv[i], "--timeout") == 0)
+						timeout = std::max(1, atoi(argv[i + 1]));
+					else if (strcmp(argv[i], "--glyphs") == 0)
+						snapshot = argv[i + 1];
+					else if (strcmp(argv[i], "--store") == 0)
+						store = argv[i + 1];
+				}
+
+				openStore(latex, store);
+				loadGlyphs(latex, snapshot);
+
+				// connection workers block on sockets, so subtrees are drawn on a pool of their own
+				latex.setThreadPool(std::make_shared<ThreadPool>(threads));
+
+				Server server(latex, threads, timeout);
+
+				s_Server = &server;
+				std::signal(SIGINT, stopServer);
+				std::signal(SIGTERM, stopServer);
+
+				server.serve(argv[2]);
+
+				s_Server = nullptr;
+			}
+			else if (argc >= 3)
+			{
+				// dumbtex <expression> <output_path> [--threads N]
+				std::string equation = argv[1];
+				const char* filepath = argv[2];
+				size_t threads = 1;
+
+				for (int i = 3; i + 1 < argc; i += 2)
+				{
+					if (strcmp(argv[i], "--threads") == 0)
+						threads = std::max(1, atoi(argv[i + 1]));
+				}
+
+				// starting workers costs more than they save on a typical formula, so only when asked for
+				if (threads > 1)
+					latex.setThreadPool(std::make_shared<ThreadPool>(threads));
+
+				latex.toImage(equation).write(filepath);
+			}
+			else
+			{
+				std::cerr << "Usage: " << argv[0] << " <expression> <output_path> [--threads N]\n"
+					<< "       " << argv[0] << " --batch [manifest | -] [--threads N] [--glyphs snapshot] [--store path]\n"
+					<< "       " << argv[0] << " --serve <socket> [--threads N] [--timeout ms] [--glyphs snapshot] [--store path]\n"
+					<< "       " << argv[0] << " --request <socket> <expression> <output_path> [--size N] [--color RRGGBB]\n";
+				status = 2;
+			}
+		}
 	}
 	catch(const std::runtime_error& err)
 	{
 		std::cerr << "Runtime Error: " << err.what() << "\n";
+		status = 1;
 	}
 
 	#if defined(DEBUG) || defined(PROFILER)
 	}
 	Instrumentor::Get().EndSession();
 	#endif
-	
-};
\ No newline at end of file
+
+	return status;
+};
@@ -0,0 +1,659 @@
+#include "Box.hpp"
+#include "Latex.hpp"
+#include "ThreadPool.hpp"
+
+#include <memory>
+
+/* Children smaller than this (in pixels) are not worth a task of their own */
+#define PARALLEL_AREA 4096
+
+Box::Box(BoxType type): m_Type(type) { };
+
+Box Box::glyph(const Font& font, unsigned long charCode, const Color& color)
+{
+	Box box(BOX_GLYPH);
+
+	box.m_SFT = font.m_SFT;
+	box.m_GlyphCache = font.m_Glyphs.get();
+	box.m_DistanceField = font.m_DistanceFields;
+	box.m_CharCode = charCode;
+	box.m_Color = color;
+
+	return box;
+};
+
+void Box::append(Box&& child)
+{
+	m_Children.push_back(std::move(child));
+};
+
+bool Box::isEmpty() const
+{
+	return m_Width <= 0 && m_Height <= 0;
+};
+
+void Box::layout()
+{
+	PROFILE_SCOPE("Box::layout");
+
+	switch (m_Type)
+	{
+		case BOX_LIST:
+			layoutList();
+			break;
+		case BOX_GLYPH:
+			layoutGlyph();
+			break;
+		case BOX_SCRIPTS:
+			layoutScripts();
+			break;
+		case BOX_STACK:
+		case BOX_FRACTION:
+			layoutStack();
+			break;
+		case BOX_RAISE:
+		{
+			Box& child = m_Children[0];
+			int lift = m_Args[0];
+			int ascent, descent;
+
+			child.layout();
+
+			ascent = std::max(0, child.m_Baseline + lift);
+			descent = std::max(0, child.m_AdvanceHeight - lift);
+
+			child.m_X = 0;
+			child.m_Y = ascent - lift - child.m_Baseline;
+
+			m_Width = child.m_Width;
+			m_Height = ascent + descent;
+			m_Baseline = ascent;
+			m_AdvanceHeight = descent;
+			break;
+		}
+		case BOX_STRIKE:
+		case BOX_COMPOSE:
+		{
+			int ascent = 0, descent = 0;
+
+			m_Width = 0;
+
+			for (Box& child : m_Children)
+			{
+				child.layout();
+
+				ascent = std::max(ascent, child.m_Baseline);
+				descent = std::max(descent, child.m_AdvanceHeight);
+				m_Width = std::max(m_Width, child.m_Width);
+			}
+
+			for (Box& child : m_Children)
+			{
+				child.m_X = 0;
+				child.m_Y = ascent - child.m_Baseline;
+			}
+
+			m_Height = ascent + descent;
+			m_Baseline = ascent;
+			m_AdvanceHeight = descent;
+			break;
+		}
+		case BOX_DELIMITED:
+			layoutDelimited();
+			break;
+		case BOX_TRANSFORM:
+			layoutTransform();
+			break;
+		case BOX_PICTURE:
+			// children are positioned by picture itself
+			for (Box& child : m_Children)
+				child.layout();
+
+			m_Width = m_Args[0];
+			m_Height = m_Args[1];
+			m_Baseline = m_Height;
+			m_AdvanceHeight = 0;
+			break;
+		case BOX_LINE:
+			m_Width = std::max(m_Args[0], m_Args[2]) + 1;
+			m_Height = std::max(m_Args[1], m_Args[3]) + 1;
+			m_Baseline = m_Height;
+			m_AdvanceHeight = 0;
+			break;
+		case BOX_BEZIER:
+			m_Width = m_Height = 0;
+
+			for (size_t i = 0; i + 1 < m_Args.size(); i += 2)
+			{
+				m_Width = std::max(m_Width, m_Args[i] + 1);
+				m_Height = std::max(m_Height, m_Args[i + 1] + 1);
+			}
+
+			m_Baseline = m_Height;
+			m_AdvanceHeight = 0;
+			break;
+	}
+
+	#ifdef DEBUG
+		printf("[Box::layout] type = %d, width = %d, height = %d, baseline = %d, adv height = %d\n", m_Type, m_Width, m_Height, m_Baseline, m_AdvanceHeight);
+	#endif
+};
+
+void Box::layoutList()
+{
+	int ascent = 0, descent = 0;
+	// pen position, glyphs advance it by their exact advance and are drawn at the nearest subpixel phase
+	double x = 0, phase;
+	int left;
+
+	for (Box& child : m_Children)
+	{
+		child.layout();
+
+		ascent = std::max(ascent, child.m_Baseline);
+		descent = std::max(descent, child.m_AdvanceHeight);
+	}
+
+	m_Width = 0;
+
+	for (size_t i = 0; i < m_Children.size(); ++i)
+	{
+		Box& child = m_Children[i];
+
+		if (i > 0)
+			x += m_Children[i - 1].kerning(child);
+
+		if (child.m_Type == BOX_GLYPH)
+		{
+			left = (int)std::floor(x);
+			phase = std::round((x - left) * SUBPIXEL_PHASES) / SUBPIXEL_PHASES;
+
+			if (phase >= 1)
+			{
+				++left;
+				phase = 0;
+			}
+
+			// bounding box moves with the phase, the rest of the metrics doesn't
+			if (phase != child.m_Phase)
+			{
+				child.m_Phase = phase;
+				child.layoutGlyph();
+			}
+
+			child.m_X = left;
+			x += child.m_Advance;
+		}
+		else
+		{
+			// glyphs may reach past their advance (i.e. italic), other boxes start after all of them
+			child.m_X = std::max((int)std::ceil(x), m_Width);
+			x = child.m_X + child.m_Width;
+		}
+
+		child.m_Y = ascent - child.m_Baseline;
+
+		// kerned glyph may end before the previous one does
+		m_Width = std::max(m_Width, child.m_X + child.m_Width);
+	}
+
+	m_Height = ascent + descent;
+	m_Baseline = ascent;
+	m_AdvanceHeight = descent;
+};
+
+void Box::layoutGlyph()
+{
+	PROFILE_SCOPE("Box::layoutGlyph");
+
+	SFT_Glyph glyph;
+	SFT_GMetrics metrics;
+	SFT sft = m_SFT;
+
+	m_Width = m_Height = m_Baseline = m_AdvanceHeight = 0;
+	m_Char = {NULL, 0, 0, 0, 0, 0};
+	m_Glyph = 0;
+	m_Advance = 0;
+
+	if (m_SFT.font == NULL) return;
+
+	sft.xOffset += m_Phase;
+
+	// only metrics are read here, glyph is rasterized when box is drawn
+	if (sft_lookup(&sft, m_CharCode, &glyph) != 0 || glyph == 0 || sft_gmetrics(&sft, glyph, &metrics) != 0)
+	{
+		#ifdef DEBUG
+			printf("\e[31m[ERROR] Font is missing character '%c'\e[0m\n", (int)m_CharCode);
+		#endif
+
+		return;
+	}
+
+	m_Glyph = glyph;
+	m_Advance = metrics.advanceWidth;
+
+	// same bounding box sft_char() rasterizes into
+	m_Char.advance = (int)std::round(metrics.advanceWidth);
+
+	if (metrics.minWidth > 0 && metrics.minHeight > 0)
+	{
+		m_Char.x = (int)std::floor(metrics.leftSideBearing);
+		m_Char.y = metrics.yOffset - 1;
+		m_Char.width = metrics.minWidth;
+		m_Char.height = metrics.minHeight;
+	}
+
+	m_Width = std::max(m_Char.x + m_Char.width, m_Char.advance);
+	m_Baseline = std::max(0, -m_Char.y);
+	m_AdvanceHeight = std::max(0, m_Char.y + m_Char.height);
+	m_Height = m_Baseline + m_AdvanceHeight;
+};
+
+double Box::kerning(const Box& next) const
+{
+	SFT_Kerning kerning;
+
+	if (m_Type != BOX_GLYPH || next.m_Type != BOX_GLYPH || m_Glyph == 0 || next.m_Glyph == 0) return 0;
+
+	if (m_SFT.font != next.m_SFT.font || m_SFT.xScale != next.m_SFT.xScale || m_SFT.yScale != next.m_SFT.yScale) return 0;
+
+	if (sft_kerning(&m_SFT, m_Glyph, next.m_Glyph, &kerning) != 0) return 0;
+
+	return kerning.xShift;
+};
+
+void Box::drawGlyph(Image& canvas, int x, int y) const
+{
+	PROFILE_SCOPE("Box::drawGlyph");
+
+	GlyphCache::Glyph glyph;
+	SFT sft = m_SFT;
+
+	if (m_Char.width == 0 || m_Char.height == 0) return;
+
+	sft.xOffset += m_Phase;
+
+	// one field serves every size, scripts and stretched delimeters included
+	if (m_DistanceField && m_GlyphCache != nullptr)
+	{
+		GlyphCache::Field field = m_GlyphCache->getField(sft, m_CharCode);
+
+		if (field->status == 0)
+			canvas.blendField(field->field, sft.xScale / FIELD_SIZE, sft.yScale / FIELD_SIZE, x + sft.xOffset, y + m_Baseline - sft.yOffset, m_Color);
+
+		return;
+	}
+
+	// glyphs that would take an atlas page of their own (big delimiters, huge sizes) aren't worth caching,
+	// they are rasterized straight onto the canvas instead of going through a coverage mask
+	if (m_GlyphCache == nullptr || m_Char.width > ATLAS_PAGE_SIZE || m_Char.height > ATLAS_PAGE_SIZE)
+	{
+		canvas.renderGlyph(sft, m_Glyph, x, y + m_Baseline, m_Color);
+		return;
+	}
+
+	glyph = m_GlyphCache->get(sft, m_CharCode);
+
+	const SFT_Char& c = glyph->metrics;
+
+	if (glyph->status == 0 && glyph->coverage != NULL)
+		canvas.blendCoverage(glyph->coverage, c.width, c.height, x + c.x, y + m_Baseline + c.y, m_Color, glyph->stride);
+};
+
+/*
+	@brief Mixes value into hash
+*/
+static void combine(size_t& hash, uint64_t value)
+{
+	hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+};
+
+static uint64_t bits(double value)
+{
+	uint64_t result;
+	memcpy(&result, &value, sizeof(result));
+	return result;
+};
+
+size_t Box::hashTree()
+{
+	size_t hash = m_Type;
+
+	combine(hash, m_Kind);
+	combine(hash, ((uint64_t)(uint32_t)m_Width << 32) | (uint32_t)m_Height);
+	combine(hash, ((uint64_t)(uint32_t)m_Baseline << 32) | (uint32_t)m_AdvanceHeight);
+	combine(hash, ((uint64_t)m_Color.r << 24) | (m_Color.g << 16) | (m_Color.b << 8) | m_Color.a);
+	combine(hash, ((uint64_t)m_EndColor.r << 24) | (m_EndColor.g << 16) | (m_EndColor.b << 8) | m_EndColor.a);
+
+	for (int arg : m_Args)
+		combine(hash, (uint32_t)arg);
+
+	m_Overhang = 0;
+
+	if (m_Type == BOX_GLYPH)
+	{
+		combine(hash, (uint64_t)(uintptr_t)m_SFT.font);
+		combine(hash, bits(m_SFT.xScale));
+		combine(hash, bits(m_SFT.yScale));
+		combine(hash, bits(m_SFT.xOffset + m_Phase));
+		combine(hash, bits(m_SFT.yOffset));
+		combine(hash, m_SFT.flags);
+		combine(hash, m_CharCode);
+		combine(hash, m_DistanceField);
+
+		m_Overhang = std::max(0, -m_Char.x);
+	}
+
+	for (Box& child : m_Children)
+	{
+		combine(hash, child.hashTree());
+		combine(hash, ((uint64_t)(uint32_t)child.m_X << 32) | (uint32_t)child.m_Y);
+
+		// transformed children are drawn on a canvas of their own size
+		if (m_Type != BOX_TRANSFORM)
+			m_Overhang = std::max(m_Overhang, child.m_Overhang - child.m_X);
+	}
+
+	return m_Hash = hash;
+};
+
+void Box::layoutScripts()
+{
+	// nucleus, superscript, subscript
+	Box& nucleus = m_Children[0];
+	Box& sup = m_Children[1];
+	Box& sub = m_Children[2];
+
+	for (Box& child : m_Children)
+		child.layout();
+
+	nucleus.m_X = 0;
+	nucleus.m_Y = sup.m_Height;
+
+	sup.m_X = sub.m_X = nucleus.m_Width;
+	sup.m_Y = 0;
+	sub.m_Y = sup.m_Height + nucleus.m_Baseline;
+
+	m_Width = nucleus.m_Width + std::max(sup.m_Width, sub.m_Width);
+	m_Baseline = sup.m_Height + nucleus.m_Baseline;
+	m_AdvanceHeight = std::max(nucleus.m_AdvanceHeight, sub.m_Height);
+	m_Height = m_Baseline + m_AdvanceHeight;
+};
+
+void Box::layoutStack()
+{
+	int y = 0;
+	int space = m_Args.empty() ? 0 : m_Args[0];
+
+	m_Width = 0;
+
+	for (Box& child : m_Children)
+	{
+		child.layout();
+
+		// fraction without numerator or denominator is not drawn at all
+		if (m_Type == BOX_FRACTION && child.isEmpty())
+		{
+			m_Width = m_Height = m_Baseline = m_AdvanceHeight = 0;
+			return;
+		}
+
+		if (child.isEmpty()) continue;
+
+		child.m_X = 0;
+		child.m_Y = y;
+
+		y += child.m_Height + space;
+		m_Width = std::max(m_Width, child.m_Width);
+	}
+
+	m_Height = y > 0 ? y - space : 0;
+	m_Baseline = m_Height;
+	m_AdvanceHeight = 0;
+};
+
+void Box::layoutDelimited()
+{
+	// left delimeter, content, right delimeter
+	Box& content = m_Children[1];
+	int target, guard;
+
+	content.layout();
+	target = content.m_Height;
+
+	m_Width = m_Height = 0;
+
+	for (Box& child : m_Children)
+	{
+		if (&child != &content)
+		{
+			child.layoutGlyph();
+
+			// stretch delimeter vertically until it covers content
+			if (child.m_Height > 0 && child.m_Height < target)
+			{
+				child.m_SFT.yScale *= (double)target / child.m_Height;
+				child.layoutGlyph();
+
+				for (guard = 0; child.m_Height > 0 && child.m_Height < target && guard < 64; ++guard)
+				{
+					child.m_SFT.yScale += 1;
+					child.layoutGlyph();
+				}
+			}
+		}
+
+		child.m_X = m_Width;
+		child.m_Y = 0;
+
+		m_Width += child.m_Width;
+		m_Height = std::max(m_Height, child.m_Height);
+	}
+
+	m_Baseline = std::min(content.m_Baseline, m_Height);
+	m_AdvanceHeight = m_Height - m_Baseline;
+};
+
+void Box::layoutTransform()
+{
+	Box& child = m_Children[0];
+
+	child.layout();
+	child.m_X = child.m_Y = 0;
+
+	m_Width = child.m_Width;
+	m_Height = child.m_Height;
+	m_Baseline = child.m_Baseline;
+	m_AdvanceHeight = child.m_AdvanceHeight;
+
+	if (m_Kind == TRANSFORM_MAGNIFY)
+	{
+		m_Width *= m_Args[0];
+		m_Height *= m_Args[0];
+		m_Baseline *= m_Args[0];
+		m_AdvanceHeight *= m_Args[0];
+	}
+};
+
+void Box::draw(Image& canvas, int x, int y, ThreadPool* pool) const
+{
+	if (m_Bitmap != nullptr)
+	{
+		canvas.overlay(*m_Bitmap, x - m_Overhang, y);
+		return;
+	}
+
+	switch (m_Type)
+	{
+		case BOX_GLYPH:
+			drawGlyph(canvas, x, y);
+			break;
+		case BOX_FRACTION:
+			if (isEmpty()) break;
+
+			drawChildren(canvas, x, y, pool);
+
+			if (m_Kind == FRAC_NORMAL || m_Kind == FRAC_OVER)
+				canvas.drawLine(x, y + m_Children[0].m_Height - 1, x + m_Width, y + m_Children[0].m_Height - 1, m_Color);
+			break;
+		case BOX_STRIKE:
+			drawChildren(canvas, x, y, pool);
+
+			if (m_Kind == STRIKE_DIAGONAL)
+				canvas.drawLine(x, y + m_Height - 1, x + m_Width - 1, y, m_Color);
+			else if (m_Kind == STRIKE_HORIZONTAL)
+				canvas.drawLine(x, y + m_Height / 2, x + m_Width, y + m_Height / 2, m_Color);
+			break;
+		case BOX_TRANSFORM:
+			drawTransform(canvas, x, y, pool);
+			break;
+		case BOX_LINE:
+			canvas.drawLine(x + m_Args[0], y + m_Args[1], x + m_Args[2], y + m_Args[3], m_Color);
+			break;
+		case BOX_BEZIER:
+			drawBezier(canvas, x, y);
+			break;
+		default:
+			drawChildren(canvas, x, y, pool);
+			break;
+	}
+};
+
+void Box::drawChildren(Image& canvas, int x, int y, ThreadPool* pool) const
+{
+	// composed children are drawn over each other, so they are left to the calling thread
+	bool independent = m_Type == BOX_FRACTION || m_Type == BOX_SCRIPTS || m_Type == BOX_STACK || m_Type == BOX_DELIMITED;
+
+	if (pool == nullptr || pool->size() < 2 || !independent || m_Children.size() < 2)
+	{
+		for (const Box& child : m_Children)
+			child.draw(canvas, x + child.m_X, y + child.m_Y, pool);
+		return;
+	}
+
+	PROFILE_SCOPE("Box::drawChildren");
+
+	// big children are drawn on their own canvases at the same time (m_Overhang wider, like session bitmaps),
+	// then everything goes onto the canvas in the order of children, so overlapping ones stack as before
+	std::vector<std::unique_ptr<Image>> images(m_Children.size());
+	TaskGroup group(pool);
+
+	for (size_t i = 0; i < m_Children.size(); ++i)
+	{
+		const Box& child = m_Children[i];
+
+		if (child.isEmpty() || child.m_Width * child.m_Height < PARALLEL_AREA)
+			continue;
+
+		images[i] = std::make_unique<Image>(std::max(1, child.m_Width + child.m_Overhang), std::max(1, child.m_Height), 4);
+
+		group.run([&child, &image = *images[i], pool]()
+		{
+			child.draw(image, child.m_Overhang, 0, pool);
+		});
+	}
+
+	group.wait();
+
+	for (size_t i = 0; i < m_Children.size(); ++i)
+	{
+		const Box& child = m_Children[i];
+
+		if (images[i])
+			canvas.overlay(*images[i], x + child.m_X - child.m_Overhang, y + child.m_Y);
+		else if (!child.isEmpty())
+			child.draw(canvas, x + child.m_X, y + child.m_Y, pool);
+	}
+};
+
+void Box::drawTransform(Image& canvas, int x, int y, ThreadPool* pool) const
+{
+	PROFILE_SCOPE("Box::drawTransform");
+
+	const Box& child = m_Children[0];
+
+	if (child.isEmpty()) return;
+
+	// transforms work on pixels, so subtree is drawn separately
+	Image image(std::max(1, child.m_Width), std::max(1, child.m_Height), 4);
+	child.draw(image, 0, 0, pool);
+
+	switch (m_Kind)
+	{
+		case TRANSFORM_ROTATE:
+			image.rotate((double)m_Args[0]);
+			break;
+		case TRANSFORM_REFLECT:
+			if (m_Args[0] == AXIS::X || m_Args[0] == AXIS::Y)
+				image.flip((AXIS)m_Args[0]);
+			break;
+		case TRANSFORM_MAGNIFY:
+			image.scaleUp(m_Args[0]);
+			break;
+		case TRANSFORM_GRADIENT:
+			image.gradient(m_Color, m_EndColor);
+			break;
+	}
+
+	canvas.overlay(image, x, y);
+};
+
+void Box::drawBezier(Image& canvas, int x, int y) const
+{
+	PROFILE_SCOPE("Box::drawBezier");
+
+	auto getPoint = [](int n1, int n2, float perc) -> int
+	{
+		int diff = n2 - n1;
+
+		return n1 + (diff * perc);
+	};
+
+	std::vector<int> points;
+	uint8_t* dstPx;
+	int px, py;
+
+	for (float i = 0; i < 1; i += 0.01)
+	{
+		// de Casteljau's algorithm, reduce control points until one is left
+		points = m_Args;
+
+		for (size_t n = points.size(); n > 2; n -= 2)
+			for (size_t j = 0; j + 2 < n; j += 2)
+			{
+				points[j] = getPoint(points[j], points[j + 2], i);
+				points[j + 1] = getPoint(points[j + 1], points[j + 3], i);
+			}
+
+		px = x + points[0];
+		py = y + points[1];
+
+		if (px < 0 || py < 0 || px >= canvas.m_Width || py >= canvas.m_Height) continue;
+
+		dstPx = &canvas.m_Data[(px + py * canvas.m_Width) * canvas.m_Channels];
+
+		for (int j = 0; j < canvas.m_Channels; ++j)
+			dstPx[j] = m_Color[j];
+	}
+};
+
+Image Box::render(ThreadPool* pool)
+{
+	PROFILE_SCOPE("Box::render");
+
+	layout();
+
+	if (isEmpty()) return Image();
+
+	// overhangs size the canvases children are drawn on in parallel
+	if (pool != nullptr)
+		hashTree();
+
+	Image canvas(std::max(1, m_Width), std::max(1, m_Height), 4);
+	canvas.m_Baseline = m_Baseline;
+	canvas.m_AdvanceHeight = m_AdvanceHeight;
+
+	draw(canvas, 0, 0, pool);
+
+	return canvas;
+};
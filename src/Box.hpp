@@ -0,0 +1,228 @@
+#pragma once
+
+#include "Image.hpp"
+
+#include <vector>
+#include <memory>
+
+class ThreadPool;
+
+enum BoxType
+{
+	/* Children laid out left to right on a common baseline */
+	BOX_LIST,
+	/* Single character */
+	BOX_GLYPH,
+	/* Nucleus followed by superscript and subscript column */
+	BOX_SCRIPTS,
+	/* Children laid out top to bottom (newlines) */
+	BOX_STACK,
+	/* Numerator on top of denominator, optionally with line between */
+	BOX_FRACTION,
+	/* Child lifted up or dropped down */
+	BOX_RAISE,
+	/* Child crossed with line */
+	BOX_STRIKE,
+	/* Children drawn on top of each other */
+	BOX_COMPOSE,
+	/* Content between two delimeters, stretched to the content height */
+	BOX_DELIMITED,
+	/* Child rendered separately and transformed as an image (rotate, reflect, magnify, gradient) */
+	BOX_TRANSFORM,
+	/* Fixed size box with children at arbitrary positions */
+	BOX_PICTURE,
+	/* Straight line */
+	BOX_LINE,
+	/* Quadratic or cubic bezier curve */
+	BOX_BEZIER
+};
+
+enum TransformType { TRANSFORM_ROTATE, TRANSFORM_REFLECT, TRANSFORM_MAGNIFY, TRANSFORM_GRADIENT };
+
+enum StrikeType { STRIKE_NONE, STRIKE_DIAGONAL, STRIKE_HORIZONTAL };
+
+class Box {
+
+	public:
+
+		/*
+			@brief Constructs empty box
+			@param type Box type
+		*/
+		Box(BoxType type = BOX_LIST);
+
+		/*
+			@brief Constructs glyph box
+			@param font Font the glyph is rendered with, current size of the font is captured
+			@param charCode Unicode character code
+			@param color Color of the glyph
+		*/
+		static Box glyph(const Font& font, unsigned long charCode, const Color& color);
+
+		/*
+			@brief Appends child box
+		*/
+		void append(Box&& child);
+
+		/*
+			@brief Check if box has nothing to draw
+		*/
+		bool isEmpty() const;
+
+		/*
+			@brief Computes width, height, baseline and advance height of the box and all of its children,
+			@brief and positions children relative to the top left corner of the box.
+			@brief Only glyph metrics are used, nothing is rasterized
+		*/
+		void layout();
+
+		/*
+			@brief Draws laid out box onto canvas
+			@param canvas Image, big enough to fit the box
+			@param x,y Position of the top left corner of the box on canvas
+			@param pool Pool to draw independent subtrees on, nullptr - draw everything on the calling thread
+		*/
+		void draw(Image& canvas, int x, int y, ThreadPool* pool = nullptr) const;
+
+		/*
+			@brief Hashes laid out box and all of its children, filling m_Hash and m_Overhang.
+			@brief Boxes with equal hashes are drawn the same way
+			@returns Hash of the box
+		*/
+		size_t hashTree();
+
+		/*
+			@brief Lays out box, allocates canvas of its size and draws box onto it
+			@param pool Pool to draw independent subtrees on, nullptr - draw everything on the calling thread
+			@returns Rendered image, or empty image if box has nothing to draw
+		*/
+		Image render(ThreadPool* pool = nullptr);
+
+	private:
+
+		void layoutList();
+
+		void layoutGlyph();
+
+		void layoutScripts();
+
+		void layoutStack();
+
+		void layoutDelimited();
+
+		void layoutTransform();
+
+		/*
+			@brief Kerning between this glyph and the next one, both laid out
+			@returns Shift of the next glyph in pixels, 0 unless both are glyphs of the same font and size
+		*/
+		double kerning(const Box& next) const;
+
+		void drawChildren(Image& canvas, int x, int y, ThreadPool* pool) const;
+
+		void drawGlyph(Image& canvas, int x, int y) const;
+
+		void drawTransform(Image& canvas, int x, int y, ThreadPool* pool) const;
+
+		void drawBezier(Image& canvas, int x, int y) const;
+
+	public:
+
+		BoxType m_Type;
+
+		/*
+			@brief Subtype of the box (i.e. SubFunctionType for fractions and arrays, TransformType, StrikeType)
+		*/
+		int m_Kind = 0;
+
+		/*
+			@brief Numeric arguments of the box (i.e. lift, angle, coordinates, spacing)
+		*/
+		std::vector<int> m_Args;
+
+		std::vector<Box> m_Children;
+
+		/*
+			@brief Color of glyphs and lines, or start color of the gradient
+		*/
+		Color m_Color {255, 255, 255, 255};
+
+		/*
+			@brief Stop color of the gradient
+		*/
+		Color m_EndColor {255, 255, 255, 255};
+
+		/*
+			@brief Font state the glyph is rendered with
+		*/
+		SFT m_SFT = {NULL, 12, 12, 0, 0, SFT_DOWNWARD_Y};
+
+		unsigned long m_CharCode = 0;
+
+		/*
+			@brief Glyph cache of the font the glyph is rendered with, nullptr - rasterize every time
+		*/
+		GlyphCache* m_GlyphCache = nullptr;
+
+		/*
+			@brief Draw glyph from its distance field in m_GlyphCache instead of rasterizing it at its own size
+		*/
+		bool m_DistanceField = false;
+
+		/*
+			@brief Position of the top left corner relative to the parent box
+		*/
+		int m_X = 0, m_Y = 0;
+
+		int m_Width = 0;
+
+		int m_Height = 0;
+
+		/*
+			@brief Distance from the top of the box to the baseline
+		*/
+		int m_Baseline = 0;
+
+		/*
+			@brief Advance height under baseline
+		*/
+		int m_AdvanceHeight = 0;
+
+		/*
+			@brief Hash of everything that affects how the box is drawn (but not its position), filled by hashTree()
+		*/
+		size_t m_Hash = 0;
+
+		/*
+			@brief How far box is drawn to the left of its position (i.e. italic glyphs), filled by hashTree()
+		*/
+		int m_Overhang = 0;
+
+		/*
+			@brief Already rasterized box, drawn instead of its children. Bitmap starts m_Overhang pixels left of the box
+		*/
+		std::shared_ptr<const Image> m_Bitmap;
+
+	private:
+
+		/*
+			@brief Glyph bounding box and advance, filled during layout (image is always NULL)
+		*/
+		SFT_Char m_Char = {NULL, 0, 0, 0, 0, 0};
+
+		/*
+			@brief Glyph id of the character, filled during layout (0 if font is missing it)
+		*/
+		SFT_Glyph m_Glyph = 0;
+
+		/*
+			@brief Advance width in pixels, not rounded. Filled during layout
+		*/
+		double m_Advance = 0;
+
+		/*
+			@brief Horizontal subpixel offset the glyph is drawn at, picked by the list it's laid out in
+		*/
+		double m_Phase = 0;
+
+};
@@ -0,0 +1,610 @@
+#include "GlyphCache.hpp"
+#include "Profiler.hpp"
+
+#include <cstring>
+#include <cmath>
+
+/* Fixed point used for cache keys, 1/64 pixel */
+#define GLYPH_SCALE_UNIT 64.0
+
+static int64_t quantize(double value)
+{
+	return (int64_t)std::llround(value * GLYPH_SCALE_UNIT);
+};
+
+bool GlyphCache::Key::operator==(const Key& other) const
+{
+	return charCode == other.charCode && xScale == other.xScale && yScale == other.yScale
+		&& xOffset == other.xOffset && yOffset == other.yOffset && flags == other.flags;
+};
+
+size_t GlyphCache::KeyHash::operator()(const Key& key) const
+{
+	size_t hash = key.charCode;
+
+	for (int64_t value : {key.xScale, key.yScale, key.xOffset, key.yOffset, (int64_t)key.flags})
+		hash = hash * 0x100000001b3ull ^ (size_t)value;
+
+	return hash;
+};
+
+/*
+	@brief Rasterizes glyph into coverage buffer of the calling thread, which is reused from glyph to glyph
+	@returns Return value of sft_char(), image stays valid until the next glyph of the thread
+*/
+static int render(const SFT& sft, unsigned long charCode, SFT_Char& c)
+{
+	static thread_local std::vector<uint8_t> coverage;
+
+	SFT_Canvas canvas;
+	int status;
+
+	if ((status = sft_char_metrics(&sft, charCode, &c)) < 0 || c.width * c.height == 0)
+		return status;
+
+	if (coverage.size() < (size_t)c.width * c.height)
+		coverage.resize((size_t)c.width * c.height);
+
+	canvas = {coverage.data(), c.width, c.height, c.width, 1};
+
+	return sft_char_into(&sft, charCode, &c, &canvas);
+};
+
+/*
+	@brief Bytes glyph of the glyph store is counted as
+*/
+static size_t storedSize(const GlyphBitmap& glyph)
+{
+	return (size_t)glyph.metrics.width * glyph.metrics.height + GLYPH_ENTRY_SIZE;
+};
+
+GlyphCache::GlyphCache(size_t capacity): m_Capacity(capacity) { };
+
+std::shared_ptr<AtlasPage> GlyphCache::makePage(int width, int height)
+{
+	std::shared_ptr<AtlasPage> atlas = std::make_shared<AtlasPage>();
+
+	atlas->width = width;
+	atlas->height = height;
+	atlas->storage.resize((size_t)width * height);
+	atlas->pixels = atlas->storage.data();
+
+	return atlas;
+};
+
+GlyphCache::Glyph GlyphCache::place(const std::shared_ptr<AtlasPage>& atlas, const SFT_Char& c, int status, int x, int y)
+{
+	std::shared_ptr<GlyphBitmap> glyph = std::make_shared<GlyphBitmap>();
+
+	glyph->status = status;
+	glyph->metrics = c;
+	glyph->metrics.image = NULL;
+	glyph->coverage = NULL;
+	glyph->stride = 0;
+
+	if (atlas == nullptr) return glyph;
+
+	for (int row = 0; row < c.height; ++row)
+		memcpy(&atlas->storage[x + (y + row) * atlas->width], &c.image[row * c.width], c.width);
+
+	glyph->coverage = &atlas->pixels[x + y * atlas->width];
+	glyph->stride = atlas->width;
+	glyph->page = atlas;
+
+	return glyph;
+};
+
+GlyphCache::Glyph GlyphCache::rasterize(const SFT& sft, unsigned long charCode)
+{
+	PROFILE_SCOPE("GlyphCache::rasterize");
+
+	std::shared_ptr<AtlasPage> atlas;
+	SFT_Char c;
+	int status;
+
+	status = render(sft, charCode, c);
+
+	if (status == 0 && c.image != NULL)
+		atlas = makePage(c.width, c.height);
+
+	return place(atlas, c, status, 0, 0);
+};
+
+GlyphCache::Field GlyphCache::getField(const SFT& sft, unsigned long charCode)
+{
+	PROFILE_SCOPE("GlyphCache::getField");
+
+	SFT base = {sft.font, FIELD_SIZE, FIELD_SIZE, 0, 0, sft.flags};
+	Key key = {charCode, 0, 0, 0, 0, sft.flags};
+	std::shared_ptr<GlyphField> made;
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		auto it = m_Fields.find(key);
+
+		if (it != m_Fields.end())
+		{
+			m_Hits++;
+			m_FieldOrder.splice(m_FieldOrder.begin(), m_FieldOrder, it->second.order);
+			return it->second.field;
+		}
+
+		m_Misses++;
+	}
+
+	// made outside of the lock, like rasterized glyphs
+	made = std::make_shared<GlyphField>();
+	made->status = sft_field(&base, charCode, FIELD_SPREAD, &made->field);
+
+	if (made->field.image != NULL)
+	{
+		made->pixels.assign(made->field.image, made->field.image + (size_t)made->field.width * made->field.height);
+		free(made->field.image);
+		made->field.image = made->pixels.data();
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	auto [it, inserted] = m_Fields.emplace(key, FieldEntry{made, {}, made->pixels.size() + GLYPH_ENTRY_SIZE});
+
+	// other thread may have been faster, its field is kept
+	if (!inserted) return it->second.field;
+
+	m_FieldOrder.push_front(key);
+	it->second.order = m_FieldOrder.begin();
+	m_FieldSize += it->second.bytes;
+	m_Size += it->second.bytes;
+
+	shrink(m_Capacity);
+
+	return made;
+};
+
+bool GlyphCache::pack(Page& page, int width, int height, int& x, int& y)
+{
+	Shelf* best = nullptr;
+
+	// shelf that wastes the least height
+	for (Shelf& shelf : page.shelves)
+		if (shelf.height >= height && shelf.x + width <= page.atlas->width && (best == nullptr || shelf.height < best->height))
+			best = &shelf;
+
+	// glyph much lower than the best shelf starts a new one, if there is room
+	if ((best == nullptr || best->height > height * 2) && page.bottom + height <= page.atlas->height && width <= page.atlas->width)
+	{
+		page.shelves.push_back({page.bottom, height, 0});
+		page.bottom += height;
+		best = &page.shelves.back();
+	}
+
+	if (best == nullptr) return false;
+
+	x = best->x;
+	y = best->y;
+	best->x += width;
+
+	return true;
+};
+
+GlyphCache::Glyph GlyphCache::get(const SFT& sft, unsigned long charCode)
+{
+	PROFILE_SCOPE("GlyphCache::get");
+
+	Key key = {charCode, quantize(sft.xScale), quantize(sft.yScale), quantize(sft.xOffset), quantize(sft.yOffset), sft.flags};
+	SFT quantized = sft;
+	std::shared_ptr<GlyphStore> store;
+	std::shared_ptr<const AtlasPage> storePage;
+	std::list<Page>::iterator page;
+	const uint8_t* coverage;
+	GlyphKey storeKey;
+	Glyph glyph;
+	SFT_Char c;
+	int status, x = 0, y = 0, side;
+	size_t bytes;
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		auto it = m_Index.find(key);
+
+		if (it != m_Index.end())
+		{
+			m_Hits++;
+
+			if (it->second.page != m_Pages.end())
+			{
+				m_Pages.splice(m_Pages.begin(), m_Pages, it->second.page);
+				it->second.page->used = ++m_Clock;
+			}
+			else if (it->second.glyph->coverage != NULL)
+			{
+				m_Stored.splice(m_Stored.begin(), m_Stored, it->second.loose);
+				it->second.used = ++m_Clock;
+			}
+			else
+				m_Loose.splice(m_Loose.begin(), m_Loose, it->second.loose);
+
+			return it->second.glyph;
+		}
+
+		m_Misses++;
+
+		store = m_Store;
+		storePage = m_StorePage;
+		storeKey = {m_Face, charCode, key.xScale, key.yScale, key.xOffset, key.yOffset, key.flags};
+	}
+
+	// other process may have rasterized it already
+	if (store != nullptr && store->find(storeKey, c, status, coverage))
+	{
+		std::shared_ptr<GlyphBitmap> stored = std::make_shared<GlyphBitmap>();
+
+		stored->status = status;
+		stored->metrics = c;
+		stored->coverage = coverage;
+		stored->stride = c.width;
+		stored->page = storePage;
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		glyph = insertLoose(key, stored);
+		shrink(m_Capacity);
+		return glyph;
+	}
+
+	// rasterized outside of the lock, other threads keep hitting the cache meanwhile
+	quantized.xScale = key.xScale / GLYPH_SCALE_UNIT;
+	quantized.yScale = key.yScale / GLYPH_SCALE_UNIT;
+	quantized.xOffset = key.xOffset / GLYPH_SCALE_UNIT;
+	quantized.yOffset = key.yOffset / GLYPH_SCALE_UNIT;
+
+	status = render(quantized, charCode, c);
+
+	if (store != nullptr)
+		store->insert(storeKey, c, status);
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	auto it = m_Index.find(key);
+
+	if (it != m_Index.end())
+	{
+		// other thread was faster
+		return it->second.glyph;
+	}
+
+	if (status != 0 || c.image == NULL)
+	{
+		// nothing to keep in atlas
+		glyph = place(nullptr, c, status, 0, 0);
+		glyph = insertLoose(key, glyph);
+		shrink(m_Capacity);
+		return glyph;
+	}
+
+	// recently used pages are usually the ones still filling up
+	for (page = m_Pages.begin(); page != m_Pages.end(); ++page)
+		if (pack(*page, c.width, c.height, x, y))
+			break;
+
+	if (page != m_Pages.end())
+		m_Pages.splice(m_Pages.begin(), m_Pages, page);
+	else
+	{
+		side = std::max(ATLAS_PAGE_SIZE, std::max(c.width, c.height));
+		bytes = (size_t)side * side;
+
+		if (bytes > m_Capacity)
+		{
+			// too big to keep, glyph gets a page of its own that isn't cached, copied outside of the lock
+			lock.unlock();
+			return place(makePage(c.width, c.height), c, status, 0, 0);
+		}
+
+		shrink(m_Capacity - bytes);
+
+		m_Pages.push_front({makePage(side, side), {}, 0, {}});
+		m_Size += bytes;
+
+		page = m_Pages.begin();
+		pack(*page, c.width, c.height, x, y);
+	}
+
+	page->used = ++m_Clock;
+
+	glyph = place(page->atlas, c, status, x, y);
+	page->keys.push_back(key);
+	m_Index.emplace(key, Entry{glyph, page, {}, 0});
+
+	return glyph;
+};
+
+GlyphCache::Glyph GlyphCache::insertLoose(const Key& key, const Glyph& glyph)
+{
+	auto [it, inserted] = m_Index.emplace(key, Entry{glyph, m_Pages.end(), {}, 0});
+
+	if (!inserted) return it->second.glyph;
+
+	// glyphs of the glyph store are counted by their coverage, they are evicted with pages
+	if (glyph->coverage != NULL)
+	{
+		m_Stored.push_front(key);
+		it->second.loose = m_Stored.begin();
+		it->second.used = ++m_Clock;
+		m_Size += storedSize(*glyph);
+	}
+	else
+	{
+		m_Loose.push_front(key);
+		it->second.loose = m_Loose.begin();
+		m_Size += GLYPH_ENTRY_SIZE;
+	}
+
+	return glyph;
+};
+
+void GlyphCache::prewarm(const SFT& sft, const std::vector<unsigned long>& charCodes)
+{
+	PROFILE_SCOPE("GlyphCache::prewarm");
+
+	SFT_Glyph glyph;
+
+	for (unsigned long charCode : charCodes)
+		if (sft_lookup(&sft, charCode, &glyph) == 0 && glyph != 0)
+			get(sft, charCode);
+};
+
+bool GlyphCache::save(std::ostream& output)
+{
+	PROFILE_SCOPE("GlyphCache::save");
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	std::unordered_map<const AtlasPage*, int32_t> pages;
+	uint32_t counts[2] = {(uint32_t)m_Pages.size(), 0};
+	int32_t size[2];
+	Record record;
+
+	for (const auto& [key, entry] : m_Index)
+		if (entry.page != m_Pages.end() || entry.glyph->coverage == NULL)
+			counts[1]++;
+
+	output.write((const char*)counts, sizeof(counts));
+
+	for (const Page& page : m_Pages)
+	{
+		pages.emplace(page.atlas.get(), (int32_t)pages.size());
+		size[0] = page.atlas->width;
+		size[1] = page.atlas->height;
+
+		output.write((const char*)size, sizeof(size));
+		output.write((const char*)page.atlas->pixels, (size_t)size[0] * size[1]);
+	}
+
+	for (const auto& [key, entry] : m_Index)
+	{
+		const GlyphBitmap& glyph = *entry.glyph;
+
+		// glyphs of the glyph store are loaded from it
+		if (entry.page == m_Pages.end() && glyph.coverage != NULL)
+			continue;
+
+		record = {};
+		record.charCode = key.charCode;
+		record.xScale = key.xScale;
+		record.yScale = key.yScale;
+		record.xOffset = key.xOffset;
+		record.yOffset = key.yOffset;
+		record.flags = key.flags;
+		record.status = glyph.status;
+		record.advance = glyph.metrics.advance;
+		record.x = glyph.metrics.x;
+		record.y = glyph.metrics.y;
+		record.width = glyph.metrics.width;
+		record.height = glyph.metrics.height;
+		record.page = entry.page != m_Pages.end() ? pages[entry.page->atlas.get()] : -1;
+		record.offset = record.page >= 0 ? (uint64_t)(glyph.coverage - entry.page->atlas->pixels) : 0;
+
+		output.write((const char*)&record, sizeof(record));
+	}
+
+	return (bool)output;
+};
+
+bool GlyphCache::load(const uint8_t* data, size_t size, std::shared_ptr<const void> mapping)
+{
+	PROFILE_SCOPE("GlyphCache::load");
+
+	std::vector<std::shared_ptr<AtlasPage>> atlases;
+	std::vector<Record> records;
+	uint32_t counts[2];
+	int32_t dimensions[2];
+	size_t offset = 0, bytes;
+	Record record;
+
+	auto read = [&](void* dst, size_t length) -> bool
+	{
+		if (size - offset < length) return false;
+
+		memcpy(dst, data + offset, length);
+		offset += length;
+
+		return true;
+	};
+
+	if (!read(counts, sizeof(counts))) return false;
+
+	for (uint32_t i = 0; i < counts[0]; ++i)
+	{
+		if (!read(dimensions, sizeof(dimensions)) || dimensions[0] <= 0 || dimensions[1] <= 0)
+			return false;
+
+		bytes = (size_t)dimensions[0] * dimensions[1];
+
+		if (size - offset < bytes) return false;
+
+		std::shared_ptr<AtlasPage> atlas = std::make_shared<AtlasPage>();
+		atlas->width = dimensions[0];
+		atlas->height = dimensions[1];
+		atlas->pixels = data + offset;
+		atlas->mapping = mapping;
+
+		atlases.push_back(atlas);
+		offset += bytes;
+	}
+
+	for (uint32_t i = 0; i < counts[1]; ++i)
+	{
+		if (!read(&record, sizeof(record)) || record.page >= (int32_t)atlases.size())
+			return false;
+
+		// rectangle has to lie within its page
+		if (record.page >= 0 && (record.width <= 0 || record.height <= 0
+			|| record.offset % atlases[record.page]->width + record.width > (uint64_t)atlases[record.page]->width
+			|| record.offset / atlases[record.page]->width + record.height > (uint64_t)atlases[record.page]->height))
+			return false;
+
+		records.push_back(record);
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	// snapshot pages are full, new glyphs go to pages of their own
+	std::vector<std::list<Page>::iterator> pages;
+
+	for (const std::shared_ptr<AtlasPage>& atlas : atlases)
+	{
+		pages.push_back(m_Pages.insert(m_Pages.end(), {atlas, {}, atlas->height, {}}));
+		m_Size += (size_t)atlas->width * atlas->height;
+	}
+
+	for (const Record& record : records)
+	{
+		Key key = {(unsigned long)record.charCode, record.xScale, record.yScale, record.xOffset, record.yOffset, record.flags};
+		std::shared_ptr<GlyphBitmap> glyph = std::make_shared<GlyphBitmap>();
+
+		if (m_Index.count(key) != 0) continue;
+
+		glyph->status = record.status;
+		glyph->metrics = {NULL, record.advance, record.x, record.y, record.width, record.height};
+		glyph->coverage = NULL;
+		glyph->stride = 0;
+
+		if (record.page < 0)
+		{
+			insertLoose(key, glyph);
+			continue;
+		}
+
+		glyph->page = atlases[record.page];
+		glyph->coverage = atlases[record.page]->pixels + record.offset;
+		glyph->stride = atlases[record.page]->width;
+		pages[record.page]->keys.push_back(key);
+
+		m_Index.emplace(key, Entry{glyph, pages[record.page], {}, 0});
+	}
+
+	shrink(m_Capacity);
+
+	return true;
+};
+
+void GlyphCache::setStore(std::shared_ptr<GlyphStore> store, uint64_t face)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	std::shared_ptr<AtlasPage> storePage;
+
+	if (store != nullptr)
+	{
+		storePage = std::make_shared<AtlasPage>();
+		storePage->width = 0;
+		storePage->height = 0;
+		storePage->pixels = NULL;
+		storePage->mapping = store;
+	}
+
+	m_Store = std::move(store);
+	m_StorePage = std::move(storePage);
+	m_Face = face;
+};
+
+void GlyphCache::setCapacity(size_t capacity)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	m_Capacity = capacity;
+	shrink(capacity);
+};
+
+void GlyphCache::clear()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	m_Pages.clear();
+	m_Loose.clear();
+	m_Stored.clear();
+	m_Index.clear();
+	m_Fields.clear();
+	m_FieldOrder.clear();
+	m_FieldSize = 0;
+	m_Size = 0;
+};
+
+CacheStats GlyphCache::getStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	return { m_Hits, m_Misses, m_Evictions, m_Index.size() + m_Fields.size(), m_Size, m_Capacity };
+};
+
+void GlyphCache::shrink(size_t capacity)
+{
+	// shares are taken from the full capacity, glyphs without page and fields don't make room for new pages
+	while (m_Loose.size() * GLYPH_ENTRY_SIZE > m_Capacity / GLYPH_ENTRY_SHARE)
+	{
+		m_Index.erase(m_Loose.back());
+		m_Loose.pop_back();
+
+		m_Size -= GLYPH_ENTRY_SIZE;
+		m_Evictions++;
+	}
+
+	while (m_FieldSize > m_Capacity / FIELD_SHARE)
+	{
+		auto it = m_Fields.find(m_FieldOrder.back());
+
+		m_FieldSize -= it->second.bytes;
+		m_Size -= it->second.bytes;
+		m_Evictions++;
+
+		m_Fields.erase(it);
+		m_FieldOrder.pop_back();
+	}
+
+	while (m_Size > capacity && (!m_Pages.empty() || !m_Stored.empty()))
+	{
+		auto stored = m_Stored.empty() ? m_Index.end() : m_Index.find(m_Stored.back());
+
+		// least recently used of the last page and the last glyph of the glyph store goes
+		if (stored == m_Index.end() || (!m_Pages.empty() && m_Pages.back().used < stored->second.used))
+		{
+			Page& last = m_Pages.back();
+
+			for (const Key& key : last.keys)
+				m_Index.erase(key);
+
+			m_Size -= (size_t)last.atlas->width * last.atlas->height;
+			m_Evictions += last.keys.size();
+			m_Pages.pop_back();
+		}
+		else
+		{
+			m_Size -= storedSize(*stored->second.glyph);
+			m_Evictions++;
+
+			m_Index.erase(stored);
+			m_Stored.pop_back();
+		}
+	}
+};
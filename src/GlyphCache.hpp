@@ -0,0 +1,317 @@
+#pragma once
+
+#include "schrift.h"
+#include "RenderCache.hpp"
+#include "GlyphStore.hpp"
+
+#include <unordered_map>
+#include <ostream>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <list>
+
+/* Side of an atlas page in pixels, bigger glyphs get a page of their own */
+#define ATLAS_PAGE_SIZE 256
+
+/* Horizontal subpixel positions glyphs of a text run are rasterized at (SFT.xOffset of k / SUBPIXEL_PHASES),
+   each one is cached as a glyph of its own */
+#define SUBPIXEL_PHASES 4
+
+/* Bytes a glyph without coverage (empty or failed) is counted as, about what its index entry takes.
+   Glyphs of the glyph store are counted as their coverage plus this */
+#define GLYPH_ENTRY_SIZE 256
+
+/* Glyphs without coverage are evicted on their own and take at most 1/GLYPH_ENTRY_SHARE of capacity */
+#define GLYPH_ENTRY_SHARE 8
+
+/* Size (pixels per em) distance fields are made at, they are drawn at any other size */
+#define FIELD_SIZE 64
+
+/* Distance fields are evicted on their own and take at most 1/FIELD_SHARE of capacity */
+#define FIELD_SHARE 8
+
+/* Distance in field pixels covered on both sides of the outline, enough for fields drawn down to 1/FIELD_SPREAD of FIELD_SIZE */
+#define FIELD_SPREAD 8
+
+/*
+	Page of glyph atlas, one byte of coverage per pixel
+*/
+struct AtlasPage
+{
+	int width;
+	int height;
+	/* Coverage, width*height bytes. Points either to storage or into mapped snapshot */
+	const uint8_t* pixels;
+	/* Owned coverage, empty for pages of a snapshot */
+	std::vector<uint8_t> storage;
+	/* Keeps snapshot mapped while the page is in use */
+	std::shared_ptr<const void> mapping;
+};
+
+/*
+	Glyph rasterized by sft_char()
+*/
+struct GlyphBitmap
+{
+	/* Return value of sft_char() */
+	int status;
+	/* Bounding box and advance, image is always NULL (coverage holds it) */
+	SFT_Char metrics;
+	/* Top left corner of the glyph in atlas page, NULL if glyph has nothing to draw */
+	const uint8_t* coverage;
+	/* Distance between rows of coverage */
+	int stride;
+	/* Page (or glyph store) the coverage lives in, it stays valid as long as the glyph is held */
+	std::shared_ptr<const AtlasPage> page;
+};
+
+/*
+	Signed distance field of a glyph made by sft_field(), one per character whatever the size it's drawn at
+*/
+struct GlyphField
+{
+	/* Return value of sft_field() */
+	int status;
+	/* Field, image points to pixels (NULL if glyph has nothing to draw) */
+	SFT_Field field;
+	std::vector<uint8_t> pixels;
+};
+
+/*
+	Cache of rasterized glyphs of one font face, keyed by codepoint and scale.
+	Scales are quantized to 1/64 pixel and glyphs are rasterized at the quantized scale,
+	so cached and freshly rasterized glyphs are always the same.
+
+	Coverage is packed into atlas pages (shelf packing), so glyphs drawn together sit next to each other in memory
+	and are blitted straight from the page. Pages are evicted as a whole, least recently used first,
+	together with glyphs whose coverage lives in the glyph store, which are evicted one by one.
+	Glyphs without coverage have a list of their own and are evicted one by one, so do distance fields.
+*/
+class GlyphCache {
+
+	public:
+
+		using Glyph = std::shared_ptr<const GlyphBitmap>;
+
+		using Field = std::shared_ptr<const GlyphField>;
+
+		/*
+			@brief Constructs cache
+			@param capacity Memory cap in bytes, caching is disabled if a page doesn't fit
+		*/
+		GlyphCache(size_t capacity = 8 * 1024 * 1024);
+
+		/*
+			@brief Looks up glyph, rasterizing and storing it on miss
+			@param sft Face and scale, face must be the one this cache belongs to
+			@param charCode Unicode character code
+			@returns Rasterized glyph, never nullptr
+		*/
+		Glyph get(const SFT& sft, unsigned long charCode);
+
+		/*
+			@brief Looks up distance field of glyph, making and storing it on miss.
+			@brief Fields don't depend on scale, they are kept per character and flags and aren't saved to snapshots
+			@param sft Face and flags, scale and offsets are ignored
+			@param charCode Unicode character code
+			@returns Distance field, never nullptr
+		*/
+		Field getField(const SFT& sft, unsigned long charCode);
+
+		/*
+			@brief Rasterizes glyph without cache, onto a page of its own
+			@param sft Face and scale
+			@param charCode Unicode character code
+		*/
+		static Glyph rasterize(const SFT& sft, unsigned long charCode);
+
+		/*
+			@brief Rasterizes glyphs ahead of the first request, characters missing from face are skipped
+			@param sft Face and scale
+			@param charCodes Unicode character codes
+		*/
+		void prewarm(const SFT& sft, const std::vector<unsigned long>& charCodes);
+
+		/*
+			@brief Writes cached glyphs (snapshot section)
+			@returns false on write error
+		*/
+		bool save(std::ostream& output);
+
+		/*
+			@brief Adds glyphs of snapshot section. Their coverage is used in place, it is not copied
+			@param data,size Section written by save()
+			@param mapping Memory data lives in, pages keep it alive
+			@returns false if section is malformed, nothing is loaded then
+		*/
+		bool load(const uint8_t* data, size_t size, std::shared_ptr<const void> mapping);
+
+		/*
+			@brief Shares glyphs with other processes. Misses are looked up in the store before rasterizing
+			@brief and rasterized glyphs are added to it
+			@param store Glyph store, nullptr - don't share
+			@param face Hash of font file this cache belongs to
+		*/
+		void setStore(std::shared_ptr<GlyphStore> store, uint64_t face);
+
+		/*
+			@brief Sets memory cap, evicting pages that don't fit anymore
+			@param capacity Memory cap in bytes
+		*/
+		void setCapacity(size_t capacity);
+
+		/*
+			@brief Removes all glyphs, counters are kept
+		*/
+		void clear();
+
+		/*
+			@brief Get counters, bytes are the size of atlas pages plus GLYPH_ENTRY_SIZE per glyph without page
+			@brief plus coverage of glyphs of the glyph store
+			@brief and the size of distance fields plus GLYPH_ENTRY_SIZE per field
+		*/
+		CacheStats getStats();
+
+	private:
+
+		struct Key
+		{
+			unsigned long charCode;
+			/* Scales and offsets in 1/64 pixel */
+			int64_t xScale, yScale, xOffset, yOffset;
+			unsigned int flags;
+
+			bool operator==(const Key& other) const;
+		};
+
+		struct KeyHash
+		{
+			size_t operator()(const Key& key) const;
+		};
+
+		struct Shelf
+		{
+			int y;
+			int height;
+			/* Where next glyph on the shelf goes */
+			int x;
+		};
+
+		struct Page
+		{
+			std::shared_ptr<AtlasPage> atlas;
+			std::vector<Shelf> shelves;
+			/* Top of the free space under the last shelf */
+			int bottom;
+			/* Glyphs packed into the page */
+			std::vector<Key> keys;
+			/* Tick of m_Clock the page was last used at */
+			uint64_t used;
+		};
+
+		struct Entry
+		{
+			Glyph glyph;
+			/* m_Pages.end() if glyph has no coverage on a page */
+			std::list<Page>::iterator page;
+			/* Position in m_Loose, or in m_Stored for glyphs of the glyph store. Only for glyphs without page */
+			std::list<Key>::iterator loose;
+			/* Tick of m_Clock the glyph was last used at, only for glyphs of the glyph store */
+			uint64_t used;
+		};
+
+		struct FieldEntry
+		{
+			Field field;
+			/* Position in m_FieldOrder */
+			std::list<Key>::iterator order;
+			/* Pixels plus GLYPH_ENTRY_SIZE */
+			size_t bytes;
+		};
+
+		/* Glyph as stored in snapshot */
+		struct Record
+		{
+			uint64_t charCode;
+			int64_t xScale, yScale, xOffset, yOffset;
+			uint32_t flags;
+			int32_t status, advance, x, y, width, height;
+			/* Index of page in snapshot, -1 if glyph has no coverage */
+			int32_t page;
+			/* Offset of the top left corner in page */
+			uint64_t offset;
+		};
+
+		/*
+			@brief Allocates empty page
+		*/
+		static std::shared_ptr<AtlasPage> makePage(int width, int height);
+
+		/*
+			@brief Finds free rectangle on the page
+			@param x,y Top left corner of the rectangle
+			@returns false if glyph doesn't fit
+		*/
+		static bool pack(Page& page, int width, int height, int& x, int& y);
+
+		/*
+			@brief Copies rasterized glyph into page, page must own its coverage
+		*/
+		static Glyph place(const std::shared_ptr<AtlasPage>& atlas, const SFT_Char& c, int status, int x, int y);
+
+		/*
+			@brief Indexes glyph that has no page (nothing to draw or coverage in glyph store), unless other thread was faster.
+			@brief Doesn't evict, shrink() does
+			@returns Glyph of the index
+		*/
+		Glyph insertLoose(const Key& key, const Glyph& glyph);
+
+		/*
+			@brief Evicts least recently used pages and glyphs of the glyph store until cache takes no more than capacity,
+			@brief and least recently used glyphs without page and distance fields until they fit into their shares
+		*/
+		void shrink(size_t capacity);
+
+	private:
+
+		/* Most recently used page first */
+		std::list<Page> m_Pages;
+
+		/* Glyphs without coverage, most recently used first */
+		std::list<Key> m_Loose;
+
+		/* Glyphs of the glyph store, most recently used first */
+		std::list<Key> m_Stored;
+
+		/* Counts uses of pages and glyphs of the glyph store, tells which of them was used least recently */
+		uint64_t m_Clock = 0;
+
+		std::unordered_map<Key, Entry, KeyHash> m_Index;
+
+		/* Distance fields, keyed by character code and flags (scales and offsets are 0) */
+		std::unordered_map<Key, FieldEntry, KeyHash> m_Fields;
+
+		/* Keys of distance fields, most recently used first */
+		std::list<Key> m_FieldOrder;
+
+		/* Bytes of distance fields, part of m_Size */
+		size_t m_FieldSize = 0;
+
+		std::shared_ptr<GlyphStore> m_Store;
+
+		/* Keeps store mapped while its glyphs are held */
+		std::shared_ptr<const AtlasPage> m_StorePage;
+
+		/* Hash of font file, part of store keys */
+		uint64_t m_Face = 0;
+
+		std::mutex m_Mutex;
+
+		size_t m_Capacity;
+
+		size_t m_Size = 0;
+
+		size_t m_Hits = 0, m_Misses = 0, m_Evictions = 0;
+
+};
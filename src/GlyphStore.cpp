@@ -0,0 +1,257 @@
+#include "GlyphStore.hpp"
+#include "Profiler.hpp"
+
+#include <stdexcept>
+#include <cstdio>
+
+#if !defined(_WIN32)
+	#include <sys/file.h>
+#endif
+
+#define GLYPH_STORE_MAGIC 0x53585444
+#define GLYPH_STORE_VERSION 1
+
+struct GlyphStore::Header
+{
+	uint32_t magic;
+	uint32_t version;
+	/* Size of the file */
+	uint64_t size;
+	uint64_t slots;
+	/* End of the arena, relative to the beginning of the file */
+	std::atomic<uint64_t> used;
+};
+
+struct GlyphStore::Slot
+{
+	/* Hash of the key, 0 - empty slot. Written last */
+	std::atomic<uint64_t> hash;
+	uint64_t face;
+	uint64_t charCode;
+	int64_t xScale, yScale, xOffset, yOffset;
+	uint32_t flags;
+	int32_t status, advance, x, y, width, height;
+	/* Coverage, relative to the beginning of the file */
+	uint64_t offset;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Glyph store needs lock-free atomics shared between processes");
+
+/* Index starts at this offset, so slots are aligned */
+#define GLYPH_STORE_INDEX 64
+
+static uint64_t hashKey(const GlyphKey& key)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	for (uint64_t value : {key.face, (uint64_t)key.charCode, (uint64_t)key.xScale, (uint64_t)key.yScale,
+		(uint64_t)key.xOffset, (uint64_t)key.yOffset, (uint64_t)key.flags})
+		hash = (hash ^ value) * 0x100000001b3ull;
+
+	// 0 marks empty slot
+	return hash == 0 ? 1 : hash;
+};
+
+#if defined(_WIN32)
+
+GlyphStore::GlyphStore(const char* path, size_t size): m_Path(path)
+{
+	throw std::runtime_error("Glyph store is not supported on this platform.");
+};
+
+GlyphStore::~GlyphStore() { };
+
+GlyphStore::Slot* GlyphStore::probe(const GlyphKey& key, uint64_t hash) const { return nullptr; };
+
+bool GlyphStore::find(const GlyphKey& key, SFT_Char& metrics, int& status, const uint8_t*& coverage) const { return false; };
+
+bool GlyphStore::insert(const GlyphKey& key, const SFT_Char& c, int status) { return false; };
+
+#else
+
+GlyphStore::GlyphStore(const char* path, size_t size): m_Path(path)
+{
+	PROFILE_SCOPE("GlyphStore::GlyphStore");
+
+	std::string lockPath = m_Path + ".lock";
+	size_t index = GLYPH_STORE_INDEX + GLYPH_STORE_SLOTS * sizeof(Slot);
+	struct stat info;
+	Header header;
+	int fd;
+
+	if ((m_Lock = open(lockPath.c_str(), O_RDWR | O_CREAT, 0644)) < 0)
+		throw std::runtime_error("Could not open " + lockPath);
+
+	if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0)
+	{
+		close(m_Lock);
+		throw std::runtime_error(std::string("Could not open ") + path);
+	}
+
+	// the first process creates the file, others wait until it's done
+	flock(m_Lock, LOCK_EX);
+
+	if (fstat(fd, &info) == 0 && info.st_size == 0 && size > index)
+	{
+		header.magic = GLYPH_STORE_MAGIC;
+		header.version = GLYPH_STORE_VERSION;
+		header.size = size;
+		header.slots = GLYPH_STORE_SLOTS;
+		header.used.store(index);
+
+		if (ftruncate(fd, (off_t)size) < 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+			info.st_size = 0;
+		else
+			info.st_size = (off_t)size;
+	}
+
+	flock(m_Lock, LOCK_UN);
+
+	m_Size = (size_t)info.st_size;
+
+	if (m_Size > index)
+	{
+		m_Memory = (uint8_t*)mmap(NULL, m_Size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+		if (m_Memory == MAP_FAILED)
+			m_Memory = nullptr;
+	}
+
+	close(fd);
+
+	m_Header = (Header*)m_Memory;
+
+	if (m_Header == nullptr || m_Header->magic != GLYPH_STORE_MAGIC || m_Header->version != GLYPH_STORE_VERSION
+		|| m_Header->size != m_Size || m_Header->slots != GLYPH_STORE_SLOTS)
+	{
+		if (m_Memory != nullptr)
+			munmap(m_Memory, m_Size);
+
+		close(m_Lock);
+		throw std::runtime_error(std::string("Could not map glyph store ") + path);
+	}
+
+	m_Slots = (Slot*)(m_Memory + GLYPH_STORE_INDEX);
+
+	#ifdef DEBUG
+		printf("[GlyphStore::GlyphStore] %s: %zu bytes, %llu used\n", path, m_Size, (unsigned long long)m_Header->used.load());
+	#endif
+};
+
+GlyphStore::~GlyphStore()
+{
+	munmap(m_Memory, m_Size);
+	close(m_Lock);
+};
+
+GlyphStore::Slot* GlyphStore::probe(const GlyphKey& key, uint64_t hash) const
+{
+	const uint64_t mask = GLYPH_STORE_SLOTS - 1;
+	uint64_t slotHash;
+	Slot* slot;
+
+	// linear probing, slots are never emptied so the first empty slot ends the search
+	for (uint64_t i = 0; i < GLYPH_STORE_SLOTS; ++i)
+	{
+		slot = &m_Slots[(hash + i) & mask];
+		slotHash = slot->hash.load(std::memory_order_acquire);
+
+		if (slotHash == 0) return slot;
+
+		if (slotHash == hash && slot->face == key.face && slot->charCode == key.charCode
+			&& slot->xScale == key.xScale && slot->yScale == key.yScale && slot->xOffset == key.xOffset
+			&& slot->yOffset == key.yOffset && slot->flags == key.flags)
+			return slot;
+	}
+
+	return nullptr;
+};
+
+bool GlyphStore::find(const GlyphKey& key, SFT_Char& metrics, int& status, const uint8_t*& coverage) const
+{
+	PROFILE_SCOPE("GlyphStore::find");
+
+	size_t index = GLYPH_STORE_INDEX + GLYPH_STORE_SLOTS * sizeof(Slot);
+	Slot* slot = probe(key, hashKey(key));
+
+	if (slot == nullptr || slot->hash.load(std::memory_order_acquire) == 0)
+		return false;
+
+	// slots come from a file other processes write to, a bad one is a miss
+	uint64_t used = m_Header->used.load(std::memory_order_acquire), offset = slot->offset;
+
+	if (slot->width < 0 || slot->height < 0)
+		return false;
+
+	if (offset != 0 && (slot->width == 0 || slot->height == 0 || used > m_Size || offset < index || offset > used
+		|| used - offset < (uint64_t)slot->width * slot->height))
+		return false;
+
+	metrics = {NULL, slot->advance, slot->x, slot->y, slot->width, slot->height};
+	status = slot->status;
+	coverage = offset != 0 ? m_Memory + offset : NULL;
+
+	return true;
+};
+
+bool GlyphStore::insert(const GlyphKey& key, const SFT_Char& c, int status)
+{
+	PROFILE_SCOPE("GlyphStore::insert");
+
+	uint64_t hash = hashKey(key), offset = 0;
+	size_t bytes = c.image != NULL ? (size_t)c.width * c.height : 0;
+	bool stored = false;
+	Slot* slot;
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	flock(m_Lock, LOCK_EX);
+
+	slot = probe(key, hash);
+
+	// some process may have stored it since find()
+	if (slot != nullptr && slot->hash.load(std::memory_order_relaxed) == 0 && m_Header->used + bytes <= m_Size)
+	{
+		if (bytes != 0)
+		{
+			offset = m_Header->used;
+			memcpy(m_Memory + offset, c.image, bytes);
+			m_Header->used += bytes;
+		}
+
+		slot->face = key.face;
+		slot->charCode = key.charCode;
+		slot->xScale = key.xScale;
+		slot->yScale = key.yScale;
+		slot->xOffset = key.xOffset;
+		slot->yOffset = key.yOffset;
+		slot->flags = key.flags;
+		slot->status = status;
+		slot->advance = c.advance;
+		slot->x = c.x;
+		slot->y = c.y;
+		slot->width = c.width;
+		slot->height = c.height;
+		slot->offset = offset;
+
+		// publishes the slot
+		slot->hash.store(hash, std::memory_order_release);
+
+		stored = true;
+	}
+	else if (slot != nullptr && slot->hash.load(std::memory_order_relaxed) != 0)
+		stored = true;
+
+	flock(m_Lock, LOCK_UN);
+
+	// glyphs are never removed, so once full the store stays full
+	if (!stored && !m_Full)
+	{
+		printf("\e[31m[ERROR] Glyph store %s is full (%s), new glyphs aren't shared\e[0m\n", m_Path.c_str(), slot == nullptr ? "index" : "coverage");
+		m_Full = true;
+	}
+
+	return stored;
+};
+
+#endif
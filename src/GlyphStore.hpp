@@ -0,0 +1,102 @@
+#pragma once
+
+#include "schrift.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+/*
+	Glyph store shared by processes through a memory-mapped file, it survives restarts.
+
+	Layout (native byte order):
+	Header | slots of hash index | append-only arena of coverage
+	Slot is published by storing its hash last (release), readers check the hash first (acquire),
+	so readers never lock and never see a half written glyph. Glyphs are never removed.
+	Writers append under the lock file (<path>.lock), one at a time across all processes.
+*/
+
+/* Default size of the store file, it is sparse until glyphs are written */
+#define GLYPH_STORE_SIZE (64 * 1024 * 1024)
+
+/* Number of index slots, power of two */
+#define GLYPH_STORE_SLOTS 65536
+
+struct GlyphKey
+{
+	/* Hash of font file */
+	uint64_t face;
+	unsigned long charCode;
+	/* Scales and offsets in 1/64 pixel */
+	int64_t xScale, yScale, xOffset, yOffset;
+	unsigned int flags;
+};
+
+class GlyphStore {
+
+	public:
+
+		/*
+			@brief Opens store, creating the file if it doesn't exist
+			@param path Store file
+			@param size Size of a new store file in bytes, existing files keep their size
+		*/
+		GlyphStore(const char* path, size_t size = GLYPH_STORE_SIZE);
+
+		GlyphStore(const GlyphStore&) = delete;
+
+		~GlyphStore();
+
+		/*
+			@brief Looks up glyph, never blocks
+			@param metrics Bounding box and advance, image is NULL
+			@param status Return value of sft_char()
+			@param coverage Coverage of the glyph, metrics.width bytes per row. NULL if there's nothing to draw
+			@returns false if glyph isn't stored
+		*/
+		bool find(const GlyphKey& key, SFT_Char& metrics, int& status, const uint8_t*& coverage) const;
+
+		/*
+			@brief Stores rasterized glyph, unless some process already did
+			@param c Glyph by sft_char(), with its image
+			@param status Return value of sft_char()
+			@returns false if store is full, which is reported once
+		*/
+		bool insert(const GlyphKey& key, const SFT_Char& c, int status);
+
+		void operator=(const GlyphStore&) = delete;
+
+	private:
+
+		struct Header;
+
+		struct Slot;
+
+		/*
+			@brief Finds slot of the key, or the empty slot where it would go
+			@returns nullptr if index is full
+		*/
+		Slot* probe(const GlyphKey& key, uint64_t hash) const;
+
+	private:
+
+		std::string m_Path;
+
+		uint8_t* m_Memory = nullptr;
+
+		size_t m_Size = 0;
+
+		Header* m_Header = nullptr;
+
+		Slot* m_Slots = nullptr;
+
+		/* Lock file descriptor */
+		int m_Lock = -1;
+
+		/* Lock file serializes processes, this - threads of one process */
+		std::mutex m_Mutex;
+
+		/* Store was found full, guarded by m_Mutex */
+		bool m_Full = false;
+
+};
@@ -12,20 +12,14 @@ Font::Font(const char* fontFile, uint16_t size)
 	setSize(size);
 }
 
-Font::~Font()
-{
-	sft_freefont(m_SFT.font);
-}
-
 bool Font::setFont(const char* fontFile)
 {
-	if (m_SFT.font != NULL)
-	{
-		sft_freefont(m_SFT.font);
-		m_SFT.font = NULL;
-	}
+	// other copies keep the old face alive as long as they need it
+	m_Face.reset(sft_loadfile(fontFile), sft_freefont);
+	m_SFT.font = m_Face.get();
+	m_Glyphs = m_Face != nullptr ? std::make_shared<GlyphCache>() : nullptr;
 
-	if((m_SFT.font = sft_loadfile(fontFile)) == NULL) {
+	if (m_Face == nullptr) {
 		printf("\e[31m[ERROR] TTF font failed\e[0m\n");
 		m_FontFile = "";
 		return false;
@@ -66,6 +60,21 @@ Image::~Image()
 	delete[] m_Data;
 }
 
+void Image::reset(int w, int h, int channels)
+{
+	delete[] m_Data;
+
+	m_Width = w;
+	m_Height = h;
+	m_Channels = channels;
+	m_Baseline = h;
+	m_AdvanceHeight = 0;
+	m_Size = w * h * channels;
+	m_Data = new uint8_t[m_Size];
+
+	memset(m_Data, 0, m_Size);
+}
+
 bool Image::write(const char *filename)
 {
 	return write(filename, getFileType(filename));
@@ -99,6 +108,44 @@ bool Image::write(const char *filename, ImageType type)
 	return success;
 }
 
+std::vector<uint8_t> Image::encode(ImageType type) const
+{
+	PROFILE_SCOPE("Image::encode");
+
+	std::vector<uint8_t> bytes;
+	int success;
+
+	auto append = [](void* context, void* data, int size) -> void
+	{
+		std::vector<uint8_t>* bytes = (std::vector<uint8_t>*)context;
+		bytes->insert(bytes->end(), (uint8_t*)data, (uint8_t*)data + size);
+	};
+
+	switch (type)
+	{
+		case PNG:
+			success = stbi_write_png_to_func(append, &bytes, m_Width, m_Height, m_Channels, m_Data, m_Width * m_Channels);
+			break;
+		case BMP:
+			success = stbi_write_bmp_to_func(append, &bytes, m_Width, m_Height, m_Channels, m_Data);
+			break;
+		case JPG:
+			success = stbi_write_jpg_to_func(append, &bytes, m_Width, m_Height, m_Channels, m_Data, 100);
+			break;
+		case TGA:
+			success = stbi_write_tga_to_func(append, &bytes, m_Width, m_Height, m_Channels, m_Data);
+			break;
+		default:
+			success = 0;
+			break;
+	}
+
+	if (!success)
+		bytes.clear();
+
+	return bytes;
+}
+
 ImageType Image::getFileType(const char *filename)
 {
 	const char *ext = strrchr(filename, '.');
@@ -271,6 +318,19 @@ void Image::rotate(double degrees)
 	*this = Image::scaleDown(rotatedImage, 2);
 }
 
+/*
+	@brief Check if all pixels of RGBA row have alpha below 3 (what overlay treats as transparent)
+*/
+static bool isTransparent(const uint8_t* row, int pixels)
+{
+	uint8_t alpha = 0;
+
+	for (int i = 0; i < pixels; ++i)
+		alpha |= row[i * 4 + 3] & 0xFC;
+
+	return alpha == 0;
+};
+
 void Image::overlay(const Image &source, int x, int y)
 {
 	PROFILE_SCOPE("Image::overlay");
@@ -279,54 +339,76 @@ void Image::overlay(const Image &source, int x, int y)
 		printf("[Image::overlay] x = %d, y = %d\n", x, y);
 	#endif
 
-	uint8_t *srcPx;
+	// clip once, and keep everything the loop needs in locals, stores through pixel pointers may alias members
+	const int srcChannels = source.m_Channels, dstChannels = m_Channels;
+	const int fromX = std::max(0, -x), toX = std::min(source.m_Width, m_Width - x);
+	const int fromY = std::max(0, -y), toY = std::min(source.m_Height, m_Height - y);
+	const bool rgba = srcChannels == 4 && dstChannels == 4;
+	const uint8_t *srcPx;
 	uint8_t *dstPx;
-	int dy, dx;
 
-	for (int sy = 0; sy < source.m_Height; ++sy)
+	for (int sy = fromY; sy < toY; ++sy)
 	{
-		dy = sy + y;
-		
-		if (dy < 0)
+		srcPx = &source.m_Data[(fromX + sy * source.m_Width) * srcChannels];
+		dstPx = &m_Data[(fromX + x + (sy + y) * m_Width) * dstChannels];
+
+		if (rgba && isTransparent(dstPx, toX - fromX))
+		{
+			// same as the per pixel path below, but without branches, so it is vectorized
+			for (int i = 0; i < (toX - fromX) * 4; i += 4)
+			{
+				uint8_t keep = srcPx[i + 3] >= 3 ? 0xFF : 0;
+
+				dstPx[i] = srcPx[i] & keep;
+				dstPx[i + 1] = srcPx[i + 1] & keep;
+				dstPx[i + 2] = srcPx[i + 2] & keep;
+				dstPx[i + 3] = srcPx[i + 3] & keep;
+			}
+
 			continue;
-		else if (dy >= m_Height)
-			break;
+		}
 
-		for (int sx = 0; sx < source.m_Width; ++sx)
+		for (int sx = fromX; sx < toX; ++sx, srcPx += srcChannels, dstPx += dstChannels)
 		{
-			dx = sx + x;
+			// (almost) transparent destination, most of the pixels of rendered expression
+			if (rgba && dstPx[3] < 3)
+			{
+				if (srcPx[3] == 0)
+					memset(dstPx, 0, 4);
+				else if (srcPx[3] >= 3)
+					// nothing to blend with, source is taken as is
+					memcpy(dstPx, srcPx, 4);
+				else
+					memset(dstPx, 0, 4);
 
-			if (dx < 0)
 				continue;
-			else if (dx >= m_Width)
-				break;
-
-			srcPx = &source.m_Data[(sx + sy * source.m_Width) * source.m_Channels];
-			dstPx = &m_Data[(dx + dy * m_Width) * m_Channels];
+			}
 
-			float srcAlpha = source.m_Channels < 4 ? 1 : srcPx[3] / 255.f;
-			float dstAlpha = m_Channels < 4 ? 1 : dstPx[3] / 255.f;
+			float srcAlpha = srcChannels < 4 ? 1 : srcPx[3] / 255.f;
+			float dstAlpha = dstChannels < 4 ? 1 : dstPx[3] / 255.f;
 
-			if (srcAlpha > .99 && dstAlpha > .99)
+			if (dstAlpha < .01 && srcAlpha >= .01 && srcChannels >= dstChannels)
+				memcpy(dstPx, srcPx, dstChannels);
+			else if (srcAlpha > .99 && dstAlpha > .99)
 			{
-				if (source.m_Channels >= m_Channels)
-					memcpy(dstPx, srcPx, m_Channels);
+				if (srcChannels >= dstChannels)
+					memcpy(dstPx, srcPx, dstChannels);
 				else
 					// In case our source image is grayscale and the dest one isn't
-					memset(dstPx, srcPx[0], m_Channels);
+					memset(dstPx, srcPx[0], dstChannels);
 			}
 			else
 			{
 				float outAlpha = srcAlpha + dstAlpha * (1 - srcAlpha);
 
 				if (outAlpha < .01)
-					memset(dstPx, 0, m_Channels);
+					memset(dstPx, 0, dstChannels);
 				else
 				{
-					for (int chnl = 0; chnl < m_Channels; ++chnl)
+					for (int chnl = 0; chnl < dstChannels; ++chnl)
 						dstPx[chnl] = (uint8_t)BYTE_BOUND((srcPx[chnl] / 255.f * srcAlpha + dstPx[chnl] / 255.f * dstAlpha * (1 - srcAlpha)) / outAlpha * 255.f);
-					
-					if (m_Channels > 3)
+
+					if (dstChannels > 3)
 						dstPx[3] = (uint8_t)BYTE_BOUND(outAlpha * 255.f);
 				}
 			}
@@ -334,6 +416,30 @@ void Image::overlay(const Image &source, int x, int y)
 	}
 }
 
+/*
+	@brief Takes glyph from font's glyph cache, or rasterizes it if font has no face loaded
+*/
+static GlyphCache::Glyph getGlyph(const Font& font, unsigned long charCode)
+{
+	return font.m_Glyphs != nullptr ? font.m_Glyphs->get(font.m_SFT, charCode) : GlyphCache::rasterize(font.m_SFT, charCode);
+};
+
+/*
+	@brief Kerning between adjacent characters
+	@returns Shift of the right character in pixels
+*/
+static int getKerning(const Font& font, unsigned long left, unsigned long right)
+{
+	SFT_Glyph leftGlyph, rightGlyph;
+	SFT_Kerning kerning;
+
+	if (sft_lookup(&font.m_SFT, left, &leftGlyph) != 0 || sft_lookup(&font.m_SFT, right, &rightGlyph) != 0
+		|| sft_kerning(&font.m_SFT, leftGlyph, rightGlyph, &kerning) != 0)
+		return 0;
+
+	return (int)std::round(kerning.xShift);
+};
+
 void Image::overlayText(const Font& font, const std::string& txt, int x, int y, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
 {
 	PROFILE_SCOPE("Image::overlayText");
@@ -343,6 +449,7 @@ void Image::overlayText(const Font& font, const std::string& txt, int x, int y,
 	#endif
 
 	size_t len = txt.length();
+	GlyphCache::Glyph glyph;
 	SFT_Char c;
 	int32_t dx, dy;
 	uint8_t *dstPx;
@@ -351,7 +458,11 @@ void Image::overlayText(const Font& font, const std::string& txt, int x, int y,
 
 	for (size_t i = 0; i < len; ++i)
 	{
-		if (sft_char(&font.m_SFT, txt[i], &c) != 0)
+		glyph = getGlyph(font, txt[i]);
+		c = glyph->metrics;
+		c.image = (uint8_t*)glyph->coverage;
+
+		if (glyph->status != 0)
 		{
 			printf("\e[31m[ERROR] Font is missing character '%c'\e[0m\n", txt[i]);
 
@@ -381,7 +492,7 @@ void Image::overlayText(const Font& font, const std::string& txt, int x, int y,
 					break;
 
 				dstPx = &m_Data[(dx + dy * m_Width) * m_Channels];
-				srcPx = c.image[sx + sy * c.width];
+				srcPx = c.image[sx + sy * glyph->stride];
 
 				if(srcPx != 0) 
 				{
@@ -409,7 +520,9 @@ void Image::overlayText(const Font& font, const std::string& txt, int x, int y,
 		}
 
 		x += c.advance;
-		free(c.image);
+
+		if (i + 1 < len)
+			x += getKerning(font, txt[i], txt[i + 1]);
 	}
 }
 
@@ -426,7 +539,8 @@ void Image::rasterizeText(const Font& font, const std::string& txt, uint8_t r, u
 		printf("[Image::rasterizeText] text = %s, RGBA = {%d, %d, %d, %d}\n", txt.c_str(), r, g, b, a);
 	#endif
 
-	int len = txt.length();
+	int len = txt.length(), width;
+	GlyphCache::Glyph glyph;
 	SFT_Char c;
 
 	if (&font.m_SFT == NULL) return;
@@ -434,7 +548,11 @@ void Image::rasterizeText(const Font& font, const std::string& txt, uint8_t r, u
 	for (int i = 0; i < len; i++)
 	{
 		// if (font.m_SFT.font == NULL) throw Latex::ConversionException("", __FILE__, __LINE__);
-		if (sft_char(&font.m_SFT, txt[i], &c) != 0)
+		glyph = getGlyph(font, txt[i]);
+		c = glyph->metrics;
+		c.image = (uint8_t*)glyph->coverage;
+
+		if (glyph->status != 0)
 		{
 			printf("\e[31m[ERROR] Font is missing character '%c'\e[0m\n", txt[i]);
 			continue;
@@ -445,21 +563,27 @@ void Image::rasterizeText(const Font& font, const std::string& txt, uint8_t r, u
 			printf("[Image::rasterizeText] x = %d, y = %d, width = %d, height = %d, advance = %d\n", c.x, c.y, c.width, c.height, c.advance);
 		#endif
 
-		Image character(c.width + (c.advance < c.width ? 0 : (c.advance - c.width)), c.height, 4);
-		character.m_Baseline = std::abs(c.y - 1);
-		character.m_AdvanceHeight = c.height - character.m_Baseline;
+		width = c.width + (c.advance < c.width ? 0 : (c.advance - c.width));
 
-		handleRaster(font, character, c, r, g, b, a);
-		
-		if (!character.isEmpty())
-		{
-			if (!this->isEmpty())
-				concat(character);
-			else
-				*this = character;
-		}
+		// images can't overlap, so kerning pulls the next character in only as far as this one's padding goes
+		if (i + 1 < len)
+			width = std::max(c.width, width + getKerning(font, txt[i], txt[i + 1]));
 
-		free(c.image); //free anyway
+		if (width * c.height == 0)
+			continue;
+
+		// first glyph goes straight into this image, there's nothing to concat it with
+		Image character;
+		Image& target = this->isEmpty() ? *this : character;
+
+		target.reset(width, c.height, 4);
+		target.m_Baseline = std::abs(c.y - 1);
+		target.m_AdvanceHeight = c.height - target.m_Baseline;
+
+		handleRaster(font, target, c, glyph->stride, r, g, b, a);
+
+		if (&target == &character)
+			concat(character);
 	}
 }
 
@@ -476,11 +600,17 @@ void Image::rasterizeCharacter(const Font& font, unsigned long charCode, uint8_t
 		printf("[Image::rasterizeCharacter] charCode = %c, RGBA = {%d, %d, %d, %d}\n", (int)charCode, r, g, b, a);
 	#endif
 
+	GlyphCache::Glyph glyph;
 	SFT_Char c;
+	int width, height;
 
 	if (&font.m_SFT == NULL) return;
 
-	if (sft_char(&font.m_SFT, charCode, &c) != 0)
+	glyph = getGlyph(font, charCode);
+	c = glyph->metrics;
+	c.image = (uint8_t*)glyph->coverage;
+
+	if (glyph->status != 0)
 	{
 		printf("\e[31m[ERROR] Font is missing character '%c'\e[0m\n", (int)charCode);
 
@@ -491,24 +621,27 @@ void Image::rasterizeCharacter(const Font& font, unsigned long charCode, uint8_t
 		printf("[Image::rasterizeCharacter] x = %d, y = %d, width = %d, height = %d, advance = %d\n", c.x, c.y, c.width, c.height, c.advance);
 	#endif
 
-	Image character(c.width + (c.advance < c.width ? 0 : (c.advance - c.width)), (c.width == 0 && c.advance != 0) ? 1 : c.height, 4);
-	character.m_Baseline = std::abs(c.y - 1);
-	character.m_AdvanceHeight = c.height - character.m_Baseline;
+	width = c.width + (c.advance < c.width ? 0 : (c.advance - c.width));
+	height = (c.width == 0 && c.advance != 0) ? 1 : c.height;
 
-	if (character.m_AdvanceHeight < 0)
-		character.m_AdvanceHeight = 0;
+	if (width * height == 0)
+		return;
 
-	handleRaster(font, character, c, r, g, b, a);
-	
-	if (!character.isEmpty())
-	{
-		if (!this->isEmpty())
-			concat(character);
-		else
-			*this = character;
-	}
+	// first glyph goes straight into this image, there's nothing to concat it with
+	Image character;
+	Image& target = this->isEmpty() ? *this : character;
+
+	target.reset(width, height, 4);
+	target.m_Baseline = std::abs(c.y - 1);
+	target.m_AdvanceHeight = c.height - target.m_Baseline;
+
+	if (target.m_AdvanceHeight < 0)
+		target.m_AdvanceHeight = 0;
+
+	handleRaster(font, target, c, glyph->stride, r, g, b, a);
 
-	free(c.image); //free anyway
+	if (&target == &character)
+		concat(character);
 }
 
 void Image::rasterizeCharacter(const Font& font, unsigned long charCode, const Color& color)
@@ -579,7 +712,7 @@ void Image::drawLine(int x0, int y0, int x1, int y1, const Color& color)
 	drawLine(x0, y0, x1, y1, color.r, color.g, color.b, color.a);
 }
 
-void Image::handleRaster(const Font& font, Image& chr, SFT_Char& c, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+void Image::handleRaster(const Font& font, Image& chr, SFT_Char& c, int stride, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
 {
 	PROFILE_SCOPE("Image::handleRaster");
 
@@ -608,7 +741,7 @@ void Image::handleRaster(const Font& font, Image& chr, SFT_Char& c, uint8_t r, u
 				break;
 
 			dstPx = &(chr.m_Data[(dx + dy * chr.m_Width) * chr.m_Channels]);
-			srcPx = c.image[sx + sy * c.width];
+			srcPx = c.image[sx + sy * stride];
 
 			if (srcPx != 0)
 			{
@@ -637,6 +770,101 @@ void Image::handleRaster(const Font& font, Image& chr, SFT_Char& c, uint8_t r, u
 	}
 }
 
+void Image::blendCoverage(const uint8_t* coverage, int width, int height, int x, int y, const Color& color, int stride)
+{
+	PROFILE_SCOPE("Image::blendCoverage");
+
+	if (stride == 0) stride = width;
+
+	uint8_t rgba[4] = {color.r, color.g, color.b, color.a};
+
+	// Columns of coverage that land on the image
+	int begin = x < 0 ? -x : 0;
+	int end = std::min(width, m_Width - x);
+
+	if (begin >= end) return;
+
+	for (int sy = 0; sy < height; ++sy)
+	{
+		int dy = sy + y;
+
+		if (dy < 0)
+			continue;
+		else if (dy >= m_Height)
+			break;
+
+		sft_blend_span(&m_Data[(x + begin + dy * m_Width) * m_Channels], coverage + begin + sy * stride, end - begin, m_Channels, rgba);
+	}
+}
+
+bool Image::renderGlyph(const SFT& sft, SFT_Glyph glyph, int x, int y, const Color& color)
+{
+	PROFILE_SCOPE("Image::renderGlyph");
+
+	SFT_Canvas canvas = {m_Data, m_Width, m_Height, m_Width * m_Channels, m_Channels};
+	uint8_t rgba[4] = {color.r, color.g, color.b, color.a};
+
+	if (isEmpty()) return true;
+
+	return sft_render_into(&sft, glyph, &canvas, x, y, rgba) == 0;
+};
+
+void Image::blendField(const SFT_Field& field, double xScale, double yScale, double x, double y, const Color& color)
+{
+	PROFILE_SCOPE("Image::blendField");
+
+	// image pixels covered by the outline box, plus one for antialiasing
+	int left = std::max(0, (int)std::floor(x + (field.padding - field.originX) * xScale) - 1);
+	int right = std::min(m_Width, (int)std::ceil(x + (field.width - field.padding - field.originX) * xScale) + 1);
+	int top = std::max(0, (int)std::floor(y + (field.padding - field.originY) * yScale) - 1);
+	int bottom = std::min(m_Height, (int)std::ceil(y + (field.height - field.padding - field.originY) * yScale) + 1);
+
+	// encoded field distance to image pixels, stretched fields are as sharp as their narrow side
+	float scale = (float)(field.spread / 127.0 * std::min(xScale, yScale));
+	float fx, fy, wy, value;
+	int iy, y0, y1;
+
+	if (field.image == NULL || left >= right || top >= bottom) return;
+
+	std::vector<int> x0(right - left), x1(right - left);
+	std::vector<float> wx(right - left);
+	std::vector<uint8_t> coverage(right - left);
+
+	// sample positions of the columns (field pixel centers are at +0.5), clamped to the field
+	for (int tx = left; tx < right; ++tx)
+	{
+		fx = (float)((tx + 0.5 - x) / xScale + field.originX - 0.5);
+		iy = (int)std::floor(fx);
+		wx[tx - left] = fx - iy;
+		x0[tx - left] = std::clamp(iy, 0, field.width - 1);
+		x1[tx - left] = std::clamp(iy + 1, 0, field.width - 1);
+	}
+
+	for (int ty = top; ty < bottom; ++ty)
+	{
+		fy = (float)((ty + 0.5 - y) / yScale + field.originY - 0.5);
+		iy = (int)std::floor(fy);
+		wy = fy - iy;
+		y0 = std::clamp(iy, 0, field.height - 1);
+		y1 = std::clamp(iy + 1, 0, field.height - 1);
+
+		const uint8_t* row0 = &field.image[(size_t)y0 * field.width];
+		const uint8_t* row1 = &field.image[(size_t)y1 * field.width];
+
+		for (int i = 0; i < right - left; ++i)
+		{
+			float a = row0[x0[i]] + (row0[x1[i]] - row0[x0[i]]) * wx[i];
+			float b = row1[x0[i]] + (row1[x1[i]] - row1[x0[i]]) * wx[i];
+
+			// outline is at 128, pixel is half covered when its center is on it
+			value = ((a + (b - a) * wy) - 128.f) * scale + .5f;
+			coverage[i] = (uint8_t)(std::clamp(value, 0.f, 1.f) * 255.f + .5f);
+		}
+
+		blendCoverage(coverage.data(), right - left, 1, left, ty, color);
+	}
+};
+
 void Image::crop(uint16_t cx, uint16_t cy, uint16_t cw, uint16_t ch)
 {
 	PROFILE_SCOPE("Image::crop");
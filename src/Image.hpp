@@ -6,8 +6,10 @@
 
 #include "schrift.h"
 #include "Profiler.hpp"
+#include "GlyphCache.hpp"
 
 #include <functional>
+#include <memory>
 #include <vector>
 #include <string>
 #include <cmath>
@@ -53,8 +55,6 @@ class Font {
 		*/
 		Font(const char* fontFile, uint16_t size);
 
-		~Font();
-
 		/*
 			@brief Sets font file
 			@param fontFile Font file
@@ -69,12 +69,31 @@ class Font {
 
 	public:
 
-		const char* m_FontFile;
+		std::string m_FontFile;
+
+		FontType m_Type = FontType::Normal;
 
-		FontType m_Type;
+		/*
+			@brief Loaded font file. It is never modified after loading, so copies of the font share it
+			@brief and can rasterize from different threads
+		*/
+		std::shared_ptr<SFT_Font> m_Face;
 
+		/*
+			@brief Face and size of this copy of the font, m_SFT.font points to m_Face
+		*/
 		SFT m_SFT = {NULL, 12, 12, 0, 0, SFT_DOWNWARD_Y};
 
+		/*
+			@brief Rasterized glyphs of m_Face, shared by copies of the font
+		*/
+		std::shared_ptr<GlyphCache> m_Glyphs;
+
+		/*
+			@brief Draw glyphs from distance fields of m_Glyphs, so every size and stretch of a glyph shares one field
+		*/
+		bool m_DistanceFields = false;
+
 };
 
 class Image {
@@ -112,6 +131,13 @@ class Image {
 		*/
 		bool write(const char* filename, ImageType type);
 
+		/*
+			@brief Encode image in memory instead of writing it to file
+			@param type Image format
+			@return Encoded bytes, empty if encoding failed
+		*/
+		std::vector<uint8_t> encode(ImageType type = ImageType::PNG) const;
+
 		/*
 			@brief Get image details
 			@return image details (width, height, channels, size, etc.)
@@ -221,6 +247,35 @@ class Image {
 		*/
 		void drawLine(int x0, int y0, int x1, int y1, const Color& color = {255, 255, 255, 255});
 
+		/*
+			@brief Blends 8-bit coverage mask (i.e. rasterized glyph) onto image with given color
+			@param coverage Coverage values, width*height bytes
+			@param width,height Size of coverage mask
+			@param x,y Coordinates of the top left corner of the mask on image
+			@param color Color struct with RGBA parameters (0-255)
+			@param stride Distance between rows of coverage (i.e. in glyph atlas), 0 if rows are packed
+		*/
+		void blendCoverage(const uint8_t* coverage, int width, int height, int x, int y, const Color& color, int stride = 0);
+
+		/*
+			@brief Rasterizes glyph straight onto image, each pixel is blended once and no coverage mask is kept
+			@param sft Face, scale and subpixel offset
+			@param glyph Glyph id
+			@param x,y Pen position on image (glyph origin on the baseline)
+			@param color Color struct with RGBA parameters (0-255)
+			@returns false if glyph couldn't be rendered
+		*/
+		bool renderGlyph(const SFT& sft, SFT_Glyph glyph, int x, int y, const Color& color);
+
+		/*
+			@brief Draws glyph from its distance field, resampled to any size and thresholded with one pixel of antialiasing
+			@param field Distance field by sft_field()
+			@param xScale,yScale Size of a field pixel in image pixels
+			@param x,y Pen position on image (glyph origin on the baseline), may fall between pixels
+			@param color Color struct with RGBA parameters (0-255)
+		*/
+		void blendField(const SFT_Field& field, double xScale, double yScale, double x, double y, const Color& color);
+
 		/*
 			@brief Crops image
 			@param cx,cy Beginning of cropped image (in pixels)
@@ -308,16 +363,26 @@ class Image {
 
 		friend struct Handlers;
 
+		friend class Box;
+
+		friend class Session;
+
 	private:
 
+		/*
+			@brief Reallocates image, pixels are cleared
+		*/
+		void reset(int w, int h, int channels);
+
 		/*
 			@brief Handle rasterization of a character. Freeing of an image is on a user
 			@param font Font to use for rasterization
 			@param chr Image pointer
 			@param c SFT_Char struct containing character data
+			@param stride Distance between rows of c.image
 			@param r,g,b,a RGBA params (0-255)
 		*/
-		void handleRaster(const Font& font, Image& chr, SFT_Char& c, uint8_t r = 255, uint8_t g = 255, uint8_t b = 255, uint8_t a = 255);
+		void handleRaster(const Font& font, Image& chr, SFT_Char& c, int stride, uint8_t r = 255, uint8_t g = 255, uint8_t b = 255, uint8_t a = 255);
 
 	private:
 
@@ -1,4 +1,12 @@
 #include "Latex.hpp"
+#include "Trie.hpp"
+
+#include <fstream>
+#include <sstream>
+
+/* Glyph snapshot: magic, version, then section of every font (face hash, section size, GlyphCache::save() data) */
+#define GLYPH_SNAPSHOT_MAGIC 0x47585444
+#define GLYPH_SNAPSHOT_VERSION 1
 
 /*
 	DumbTeX
@@ -8,32 +16,13 @@
 
 */
 
-Latex::Latex(): p_SelectedFont(&m_NormalFont) { };
+Latex::Latex() { };
 
 Latex::~Latex() { };
 
-Latex& Latex::Get()
-{
-	static Latex instance;
-	return instance;
-}
-
-Image Latex::toImage(std::string& expression)
+Image Latex::toImage(std::string& expression) const
 {
-	PROFILE_SCOPE("Latex::toImage"); 
-
-   /*
-		toImage()
-		|__rastlimits()
-		   |__rastscripts()
-			  |__texscripts()
-   
-   */
-
-	Image finalImage;
-	size_t i, j;
-	static bool isFirstIteration = false;
-	SubFunction subFunction;
+	PROFILE_SCOPE("Latex::toImage");
 
 	#ifdef DEBUG
 		printf("[Latex::toImage] start expression: %s\n", expression.c_str());
@@ -42,86 +31,167 @@ Image Latex::toImage(std::string& expression)
 	if (expression.length() == 0)
 		throw std::runtime_error("There's nothing to rasterize.");
 
-	if (isFirstIteration == false) 
-	{
-		prepExpression(expression); //prepare expression to find unsupported subfunctions and remove unnecessary braces, if found
-		isFirstIteration = true;
-	}
+	prepExpression(expression); //prepare expression to find unsupported subfunctions and remove unnecessary braces, if found
 
 	#ifdef DEBUG
 		printf("[Latex::toImage] prepared start expression: %s\n", expression.c_str());
 	#endif
 
-	while (expression.length() > 0)
+	Latex context(*this); //font, size and color change while parsing, so every render has its own copy
+
+	return context.parse(expression).render(p_Pool.get());
+};
+
+RenderCache::Bytes Latex::render(std::string& expression, ImageType type) const
+{
+	PROFILE_SCOPE("Latex::render");
+
+	std::string key;
+	RenderCache::Bytes bytes;
+	Image image;
+
+	if (expression.length() == 0)
+		throw std::runtime_error("There's nothing to rasterize.");
+
+	prepExpression(expression);
+
+	key = cacheKey(expression, type);
+
+	if ((bytes = p_Cache->find(key)) != nullptr)
+		return bytes;
+
+	Latex context(*this);
+	image = context.parse(expression).render(p_Pool.get());
+
+	bytes = std::make_shared<const std::vector<uint8_t>>(image.isEmpty() ? std::vector<uint8_t>() : image.encode(type));
+
+	p_Cache->insert(key, bytes);
+
+	return bytes;
+};
+
+RenderCache& Latex::getCache() const
+{
+	return *p_Cache;
+};
+
+std::string Latex::cacheKey(const std::string& expression, ImageType type) const
+{
+	std::string key;
+	char params[64];
+
+	// everything that changes the image, separated with '\0' that can't appear in paths
+	for (const Font* font : {&m_NormalFont, &m_ItalicFont, &m_BoldFont, &m_BoldItalicFont})
 	{
-		for (i = 0; i < expression.length(); ++i)
-		{
-			Image tempImage;
+		snprintf(params, sizeof(params), "%g:%g:%d", font->m_SFT.xScale, font->m_SFT.yScale, font->m_DistanceFields);
+
+		key.append(font->m_FontFile);
+		key.push_back('\0');
+		key.append(params);
+		key.push_back('\0');
+	}
+
+	snprintf(params, sizeof(params), "%d:%d:%02x%02x%02x%02x", p_SelectedFont, type, p_Color.r, p_Color.g, p_Color.b, p_Color.a);
+
+	key.append(params);
+	key.push_back('\0');
+	key.append(expression);
+
+	return key;
+};
+
+Details Latex::measure(std::string& expression) const
+{
+	PROFILE_SCOPE("Latex::measure");
+
+	Box box;
+	Latex context(*this);
+
+	if (expression.length() == 0)
+		throw std::runtime_error("There's nothing to measure.");
+
+	prepExpression(expression);
+
+	box = context.parse(expression);
+	box.layout();
+
+	if (box.isEmpty())
+		return {0, 0, 0, 0, 0};
+
+	// render() never allocates less than 1x1 canvas
+	int width = std::max(1, box.m_Width), height = std::max(1, box.m_Height);
+
+	return {width, height, 4, box.m_Baseline, (size_t)width * height * 4};
+};
+
+Box Latex::parse(std::string_view expression)
+{
+	PROFILE_SCOPE("Latex::parse"); 
+
+   /*
+		parse()
+		|__handlers (append boxes to list)
+		   |__rastscripts()
+			  |__texscripts()
+   
+   */
+
+	Box list(BOX_LIST);
+	Tokenizer tokens(expression);
+	Token token;
 
-			#ifdef DEBUG
-				if (i != 0) printf("[Latex::toImage] expression: %s\n", expression.c_str());
-			#endif
+	while (!tokens.atEnd())
+	{
+		#ifdef DEBUG
+			printf("[Latex::parse] expression: %.*s\n", (int)(expression.length() - tokens.position()), expression.data() + tokens.position());
+		#endif
 
-			if (expression[i] == '_' || expression[i] == '^')
+		switch ((token = tokens.peek()).type)
+		{
+			case TOKEN_SCRIPT:
 			{
-				Handlers::rastScripts(*this, expression, finalImage, NONE);
+				//scripts without nucleus are attached to everything before them
+				Box nucleus(BOX_LIST);
+
+				nucleus.m_Children.swap(list.m_Children);
+				Handlers::rastScripts(*this, tokens, nucleus, NONE);
+				list.append(std::move(nucleus));
 				break;
 			}
-			else if (expression[i] == '{')
-			{
-				std::string subexpression = Latex::getSubExpression(expression, 0, '{', '}', false);
+			case TOKEN_GROUP:
+				tokens.next();
+				list.append(parse(token.text));
+				break;
+			case TOKEN_COMMAND:
+				tokens.next();
+
+				//?Esaped delimeters like "\}" or "\{" are processed after everything between them is laid out
+				//?Because escaped delims depend on size of all expression
 
-				if (expression.length() <= 0)
-					expression = subexpression;
-				else
-					finalImage.concat(toImage(subexpression));
+				//!Take inspiration from MimeTeX's texsubexpr() function, quite a gold mine
+				if (token.subFunction != nullptr && token.subFunction->handler)
+					token.subFunction->handler(*this, tokens, list, token.subFunction->type);
 				break;
-			}
-			else if (expression[i] == '\\')
+			case TOKEN_LITERAL:
 			{
-				if ((subFunction = getSubFunction(expression, i)).expression != NULL)
-				{
-					//?Esaped delimeters like "\}" or "\{" are processed after everything between them is rasterized
-					//?Because escaped delims depend on size of all expression
-
-					//!Take inspiration from MimeTeX's texsubexpr() function, quite a gold mine
-					expression.erase(i, strlen(subFunction.expression));
-
-					if (subFunction.handler) 
-						subFunction.handler(*this, expression, finalImage, subFunction.type);
-						
-				}
-				else 
-				{
-					for (j = i; j < expression.length(); j++)
-					{
-						if (expression[j] == '{' || isdigit(expression[j]) || expression[j] == '~')
-							expression.erase(i, j - i); //or enclose it in [] and add '?' at the end of function
-					}
-
-					j = 0;
-				}
-			}
-			else
-			{
-				tempImage.rasterizeCharacter(getSelectedFont(), expression[i], p_Color);
-				expression.erase(i, 1);
-				if (expression[i] == '_' || expression[i] == '^')
-					Handlers::rastScripts(*this, expression, tempImage, NONE);
-			}
+				tokens.next();
+				Box glyph = Box::glyph(getSelectedFont(), (unsigned char)token.text[0], p_Color);
 
-			if (!tempImage.isEmpty()) 
-				finalImage.concat(tempImage);
-			break;
-		}
+				if (tokens.peek().type == TOKEN_SCRIPT)
+					Handlers::rastScripts(*this, tokens, glyph, NONE);
 
-		i = 0;
+				list.append(std::move(glyph));
+				break;
+			}
+			default:
+				break;
+		}
 	}
 
-	return finalImage;
+	return list;
 };
 
-void Latex::prepExpression(std::string& expression)
+void Latex::prepExpression(std::string& expression) const
 {
 	PROFILE_SCOPE("Latex::prepExpression");
 
@@ -238,30 +308,42 @@ void Latex::setFonts(const char* normal, const char* italic, const char* bold, c
 	if (strlen(boldItalic) > 0) this->setFont(FontType::BoldItalic, boldItalic);
 };
 
-Font& Latex::getSelectedFont()
+void Latex::setFontSize(uint16_t size)
 {
-	return *p_SelectedFont;
+	m_NormalFont.setSize(size);
+	m_ItalicFont.setSize(size);
+	m_BoldFont.setSize(size);
+	m_BoldItalicFont.setSize(size);
 };
 
-void Latex::setSelectedFont(FontType type)
+void Latex::setDistanceFields(bool enable)
 {
-	switch(type)
+	m_NormalFont.m_DistanceFields = enable;
+	m_ItalicFont.m_DistanceFields = enable;
+	m_BoldFont.m_DistanceFields = enable;
+	m_BoldItalicFont.m_DistanceFields = enable;
+};
+
+Font& Latex::getSelectedFont()
+{
+	switch(p_SelectedFont)
 	{
-		case FontType::Normal:
-			p_SelectedFont = &m_NormalFont;
-			break;
 		case FontType::Italic:
-			p_SelectedFont = &m_ItalicFont;
-			break;
+			return m_ItalicFont;
 		case FontType::Bold:
-			p_SelectedFont = &m_BoldFont;
-			break;
+			return m_BoldFont;
 		case FontType::BoldItalic:
-			p_SelectedFont = &m_BoldItalicFont;
-			break;
+			return m_BoldItalicFont;
+		default:
+			return m_NormalFont;
 	}
 };
 
+void Latex::setSelectedFont(FontType type)
+{
+	p_SelectedFont = type;
+};
+
 void Latex::setFontColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
 {
 	this->p_Color = {r, g, b, a};
@@ -277,87 +359,269 @@ const Color& Latex::getFontColor()
 	return this->p_Color;
 }
 
-std::string Latex::getSubExpression(std::string& expression, unsigned from, const char left, const char right, bool returnDelims)
+void Latex::setThreadPool(std::shared_ptr<ThreadPool> pool)
 {
-	PROFILE_SCOPE("Latex::getSubExpression");
+	this->p_Pool = std::move(pool);
+};
 
-	unsigned first, last;
-	std::string result;
-	std::stack<char> brackets;
+/* Math symbols prewarmGlyphs() rasterizes besides ASCII, greek and cyrillic letters */
+static const unsigned long mathSymbols[] =
+{
+	0x00B0 /*°*/, 0x00B1 /*±*/, 0x00B7 /*·*/, 0x00D7 /*×*/, 0x00F7 /*÷*/, 0x2032 /*′*/,
+	0x2190 /*←*/, 0x2191 /*↑*/, 0x2192 /*→*/, 0x2193 /*↓*/, 0x2194 /*↔*/,
+	0x21D0 /*⇐*/, 0x21D2 /*⇒*/, 0x21D4 /*⇔*/,
+	0x2200 /*∀*/, 0x2202 /*∂*/, 0x2203 /*∃*/, 0x2205 /*∅*/, 0x2207 /*∇*/, 0x2208 /*∈*/, 0x2209 /*∉*/,
+	0x220F /*∏*/, 0x2211 /*∑*/, 0x2212 /*−*/, 0x221A /*√*/, 0x221E /*∞*/,
+	0x2227 /*∧*/, 0x2228 /*∨*/, 0x2229 /*∩*/, 0x222A /*∪*/, 0x222B /*∫*/,
+	0x2248 /*≈*/, 0x2260 /*≠*/, 0x2261 /*≡*/, 0x2264 /*≤*/, 0x2265 /*≥*/,
+	0x2282 /*⊂*/, 0x2283 /*⊃*/, 0x2286 /*⊆*/, 0x2287 /*⊇*/, 0
+};
 
-	if (expression[from] != left) // if expression not starts from left delimeter
-	{
-		result = expression[from];
-		expression.erase(from, 1);
-		return result; //just return first char
-	}
+/*
+	@brief Hash of font file, so snapshot of other font is never loaded
+*/
+static uint64_t faceHash(const Font& font)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	for (unsigned long i = 0; i < font.m_Face->size; ++i)
+		hash = (hash ^ font.m_Face->memory[i]) * 0x100000001b3ull;
+
+	return hash;
+};
+
+/*
+	@brief Maps file read-only
+	@param size Size of the file
+	@returns Mapping, unmapped with the last reference. nullptr on error
+*/
+static std::shared_ptr<const void> mapFile(const char* path, size_t& size)
+{
+	#if defined(_WIN32)
+		HANDLE file, mapping;
+		LARGE_INTEGER length;
+		const void* memory;
+
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+
+		if (file == INVALID_HANDLE_VALUE) return nullptr;
+
+		if (!GetFileSizeEx(file, &length) || length.QuadPart == 0)
+		{
+			CloseHandle(file);
+			return nullptr;
+		}
+
+		mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		CloseHandle(file);
+
+		if (!mapping) return nullptr;
+
+		// view keeps mapping alive
+		memory = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+
+		if (!memory) return nullptr;
+
+		size = (size_t)length.QuadPart;
 
-	first = expression.find(left, from); //find index of left delimeter
-	if (first > from) return NULL;
+		return std::shared_ptr<const void>(memory, [](const void* memory) { UnmapViewOfFile(memory); });
+	#else
+		struct stat info;
+		void* memory;
+		int fd;
 
-	for (size_t i = 0; i < expression.length(); i++) //find index of right delimeter
+		if ((fd = open(path, O_RDONLY)) < 0) return nullptr;
+
+		if (fstat(fd, &info) < 0 || info.st_size == 0)
+		{
+			close(fd);
+			return nullptr;
+		}
+
+		memory = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if (memory == MAP_FAILED) return nullptr;
+
+		size = (size_t)info.st_size;
+
+		return std::shared_ptr<const void>(memory, [length = size](const void* memory) { munmap((void*)memory, length); });
+	#endif
+};
+
+void Latex::setGlyphStore(std::shared_ptr<GlyphStore> store)
+{
+	for (Font* font : {&m_NormalFont, &m_ItalicFont, &m_BoldFont, &m_BoldItalicFont})
+		if (font->m_Glyphs != nullptr)
+			font->m_Glyphs->setStore(store, store != nullptr ? faceHash(*font) : 0);
+};
+
+void Latex::prewarmGlyphs()
+{
+	PROFILE_SCOPE("Latex::prewarmGlyphs");
+
+	std::vector<unsigned long> charCodes;
+	uint16_t size;
+	SFT sft;
+
+	for (unsigned long charCode = ' '; charCode <= '~'; ++charCode)
+		charCodes.push_back(charCode);
+
+	for (const Letter* table : {greekTable, cyrTable})
+		for (size_t i = 0; table[i].character != NULL; ++i)
+			charCodes.push_back(table[i].charCode);
+
+	for (size_t i = 0; mathSymbols[i] != 0; ++i)
+		charCodes.push_back(mathSymbols[i]);
+
+	for (Font* font : {&m_NormalFont, &m_ItalicFont, &m_BoldFont, &m_BoldItalicFont})
 	{
-		if (expression[i] == left)
-			brackets.push(expression[i]);
+		if (font->m_Glyphs == nullptr) continue;
 
-		if (expression[i] == right)
+		sft = font->m_SFT;
+		size = (uint16_t)font->m_SFT.xScale;
+
+		// same sizes parse() sets, scripts truncate the scaled size as well
+		for (uint16_t scaled : {size, (uint16_t)(size * SCRIPT_SCALE)})
 		{
-			if (brackets.size() > 1)
-				brackets.pop();
-			else
-			{
-				last = i;
-				break;
-			}
+			sft.xScale = scaled;
+			sft.yScale = scaled;
+			font->m_Glyphs->prewarm(sft, charCodes);
 		}
 	}
+};
+
+bool Latex::saveGlyphs(const char* path) const
+{
+	PROFILE_SCOPE("Latex::saveGlyphs");
 
-	while (expression[last - 1] == '\\') //if delimeter is escaped
-		last = expression.find(right, last+1); //find right delimeter again
+	// written aside and renamed, processes that have the old snapshot mapped keep reading it
+	std::string temporary = std::string(path) + ".tmp";
+	std::ofstream file(temporary, std::ios::binary);
+	uint32_t header[2] = {GLYPH_SNAPSHOT_MAGIC, GLYPH_SNAPSHOT_VERSION};
+	uint64_t section[2];
 
-	result = returnDelims ? expression.substr(first, last - first + 1) : expression.substr(first + 1, last - first - 1);
-	expression.erase(0, returnDelims ? result.length() : result.length() + 2);
+	file.write((const char*)header, sizeof(header));
 
-	return result;
+	for (const Font* font : {&m_NormalFont, &m_ItalicFont, &m_BoldFont, &m_BoldItalicFont})
+	{
+		std::ostringstream data;
+
+		if (font->m_Glyphs != nullptr)
+			font->m_Glyphs->save(data);
+
+		section[0] = font->m_Glyphs != nullptr ? faceHash(*font) : 0;
+		section[1] = data.str().size();
+
+		file.write((const char*)section, sizeof(section));
+		file << data.str();
+	}
+
+	file.close();
+
+	if (!file || std::rename(temporary.c_str(), path) != 0)
+	{
+		printf("\e[31m[ERROR] Could not write glyph snapshot %s\e[0m\n", path);
+		std::remove(temporary.c_str());
+		return false;
+	}
+
+	return true;
 };
 
-const struct SubFunction Latex::getSubFunction(const std::string& expression, size_t at)
+bool Latex::loadGlyphs(const char* path)
 {
-	PROFILE_SCOPE("Latex::getSubFunction");
+	PROFILE_SCOPE("Latex::loadGlyphs");
 
-	size_t i, match;
+	Font* fonts[] = {&m_NormalFont, &m_ItalicFont, &m_BoldFont, &m_BoldItalicFont};
+	size_t size = 0, offset = 0, starts[4];
+	std::shared_ptr<const void> mapping = mapFile(path, size);
+	const uint8_t* data = (const uint8_t*)mapping.get();
+	uint32_t header[2];
+	uint64_t sections[4][2];
+	bool matched = true;
 
-	for (i = 0; subfunctions[i].expression != NULL; i++) //iterate through subfunction list
+	if (mapping == nullptr || size < sizeof(header))
 	{
-		match = expression.find(subfunctions[i].expression, at); //get match
+		printf("\e[31m[ERROR] Could not read glyph snapshot %s\e[0m\n", path);
+		return false;
+	}
 
-		if (match != std::string::npos && match == at) //if matches
-			return subfunctions[i];
-	};
+	memcpy(header, data, sizeof(header));
+	offset += sizeof(header);
+
+	if (header[0] != GLYPH_SNAPSHOT_MAGIC || header[1] != GLYPH_SNAPSHOT_VERSION)
+	{
+		printf("\e[31m[ERROR] %s is not a glyph snapshot of this version\e[0m\n", path);
+		return false;
+	}
+
+	// all sections are checked first, so truncated snapshot loads nothing
+	for (size_t i = 0; i < 4; ++i)
+	{
+		if (size - offset >= sizeof(sections[i]))
+			memcpy(sections[i], data + offset, sizeof(sections[i]));
+
+		if (size - offset < sizeof(sections[i]) || sections[i][1] > size - offset - sizeof(sections[i]))
+		{
+			printf("\e[31m[ERROR] Glyph snapshot %s is truncated\e[0m\n", path);
+			return false;
+		}
+
+		starts[i] = offset + sizeof(sections[i]);
+		offset = starts[i] + sections[i][1];
+	}
+
+	for (size_t i = 0; i < 4; ++i)
+	{
+		// snapshot of other font file (or other version of it) would draw wrong glyphs
+		if (fonts[i]->m_Glyphs != nullptr && (sections[i][0] != faceHash(*fonts[i]) || !fonts[i]->m_Glyphs->load(data + starts[i], sections[i][1], mapping)))
+			matched = false;
+	}
+
+	#ifdef DEBUG
+		printf("[Latex::loadGlyphs] %s: %zu bytes, matched = %d\n", path, size, matched);
+	#endif
+
+	if (!matched)
+		printf("\e[31m[ERROR] Glyph snapshot %s doesn't match loaded fonts\e[0m\n", path);
+
+	return matched;
+};
+
+/* Built at compile time from subfunctions[] */
+static constexpr auto subfunctionTrie = TrieBuilder::build<TrieBuilder::countNodes(subfunctions)>(subfunctions);
+
+const struct SubFunction* Latex::getSubFunction(std::string_view expression, size_t at)
+{
+	PROFILE_SCOPE("Latex::getSubFunction");
 
-	return subfunctions[i]; //if not, should return NULL defined subfunction (dummy)
+	int index = subfunctionTrie.find(expression, at); //longest subfunction that matches
+
+	return index >= 0 ? &subfunctions[index] : nullptr;
 };
 
-const struct Scripts Latex::texScripts(std::string& expression, ScriptType which)
+const struct Scripts Latex::texScripts(Tokenizer& tokens, ScriptType which)
 {
 	PROFILE_SCOPE("Latex::texScripts");
 
 	bool gotSub = false, gotSup = false;
-	std::string subScript, supScript;
+	std::string_view subScript, supScript;
 
-	while (expression.length() > 0)
+	while (!tokens.atEnd())
 	{
-		if (expression[0] == '_' && (which == 1 || which == 3) && !gotSub)
+		if (tokens.peekChar() == '_' && (which == 1 || which == 3) && !gotSub)
 		{
-			expression.erase(0, 1);
+			tokens.skip();
 			gotSub = true;
-			subScript = Latex::getSubExpression(expression, 0, '{', '}', false);
+			subScript = tokens.getSubExpression('{', '}');
 		}
-		else if (expression[0] == '^' && (which == 2 || which == 3) && !gotSup)
+		else if (tokens.peekChar() == '^' && (which == 2 || which == 3) && !gotSup)
 		{
-			expression.erase(0, 1);
+			tokens.skip();
 			gotSup = true;
-			supScript = Latex::getSubExpression(expression, 0, '{', '}', false);
+			supScript = tokens.getSubExpression('{', '}');
 		}
 		else
 			return {subScript, supScript};
@@ -382,154 +646,153 @@ Color hexToRGBA(const int& hex, uint8_t alpha)
 	return RGBA;
 };
 
-void Handlers::rastNewline(Latex& latex, std::string& expression, Image& image, SubFunctionType arg1)
+void Handlers::rastNewline(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType arg1)
 {
 	PROFILE_SCOPE("Handlers::rastNewline");
 
 	int space = 0;
-	std::string arg;
+	std::string_view arg;
 
-	if (image.isEmpty() || expression.length() == 0) return;
+	if (box.m_Children.empty() || tokens.atEnd()) return;
 
 	//optional parameter
-	if (expression[0] == '[')
-		arg = Latex::getSubExpression(expression, 0, '[', ']', false);
+	if (tokens.peekChar() == '[')
+		arg = tokens.getSubExpression('[', ']');
 
 	if (arg.length() != 0 && arg.find_first_not_of("0123456789") == std::string::npos)
-		space = std::stoi(arg);
+		space = std::stoi(std::string(arg));
+
+	Box upper(BOX_LIST), stack(BOX_STACK);
+
+	upper.m_Children.swap(box.m_Children);
 
-	image.concat(latex.toImage(expression), ImagePosition::BOTTOM, space);
+	stack.m_Args = {space};
+	stack.append(std::move(upper));
+	stack.append(latex.parse(tokens.rest()));
+
+	box.append(std::move(stack));
 };
 
-void Handlers::rastColor(Latex& latex, std::string& expression, Image& image, SubFunctionType colorType)
+void Handlers::rastColor(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType colorType)
 {
 	PROFILE_SCOPE("Handlers::rastColor");
 
-	Image tempImage;
-
 	if (colorType == COLOR_GRADIENT) //color with gradient
 	{
-		std::string hex1, hex2, arg;
+		std::string_view hex1, hex2, arg;
 
-		hex1 = Latex::getSubExpression(expression, 0, '{', '}', false);
+		hex1 = tokens.getSubExpression('{', '}');
 		if (hex1.length() == 0) return;
 
-		hex2 = Latex::getSubExpression(expression, 0, '{', '}', false);
+		hex2 = tokens.getSubExpression('{', '}');
 		if (hex2.length() == 0) return;
 
-		if (expression[0] == '~')
+		if (tokens.peekChar() == '~')
 		{
-			arg = expression.substr(1);
-			expression.erase(0);
+			tokens.skip();
+			arg = tokens.rest();
 		}
 		else
 		{
-			arg = Latex::getSubExpression(expression, 0, '{', '}', false);
+			arg = tokens.getSubExpression('{', '}');
 			if (arg.length() == 0) return;
 		}
 
-		tempImage = latex.toImage(arg);
-		tempImage.gradient(hexToRGBA(hex1), hexToRGBA(hex2));
+		Box gradient(BOX_TRANSFORM);
+		gradient.m_Kind = TRANSFORM_GRADIENT;
+		gradient.m_Color = hexToRGBA(std::string(hex1));
+		gradient.m_EndColor = hexToRGBA(std::string(hex2));
+		gradient.append(latex.parse(arg));
+
+		box.append(std::move(gradient));
 	}
 	else //color with certain color
 	{
 		Color tempColor = latex.getFontColor();
-		std::string hex, arg;
-		
+		std::string_view hex, arg;
+
 		if (colorType == COLOR_CUSTOM)
 		{
-			hex = Latex::getSubExpression(expression, 0, '{', '}', false);
+			hex = tokens.getSubExpression('{', '}');
 			if (hex.length() == 0) return;
 		}
 		else
-			hex = 
-				colorType == COLOR_RED ? "ff0000" : 
-				colorType == COLOR_GREEN ? "00ff00" : 
-				colorType == COLOR_BLUE ? "0000ff" : 
+			hex =
+				colorType == COLOR_RED ? "ff0000" :
+				colorType == COLOR_GREEN ? "00ff00" :
+				colorType == COLOR_BLUE ? "0000ff" :
 				colorType == COLOR_WHITE ? "ffffff" : "000000";
-		
-		latex.setFontColor(hexToRGBA(hex));
 
-		if (expression[0] == '~') //color all text after subfunction 
+		latex.setFontColor(hexToRGBA(std::string(hex)));
+
+		if (tokens.peekChar() == '~') //color all text after subfunction
 		{
-			arg = expression.substr(1);
+			tokens.skip();
+			arg = tokens.rest();
 			if (arg.length() == 0) return;
 
-			expression.erase(0);
-			tempImage = latex.toImage(arg);
+			box.append(latex.parse(arg));
 		}
 		else //color only text in brackets
 		{
-			arg = Latex::getSubExpression(expression, 0, '{', '}', false);
+			arg = tokens.getSubExpression('{', '}');
 			if (arg.length() == 0) return;
 
-			tempImage = latex.toImage(arg);
+			box.append(latex.parse(arg));
 			latex.setFontColor(tempColor);
 		}
 	}
-
-	image.concat(tempImage);
 };
 
-void Handlers::rastRaise(Latex& latex, std::string& expression, Image& image, SubFunctionType arg1)
+void Handlers::rastRaise(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType arg1)
 {
 	PROFILE_SCOPE("Handlers::rastRaise");
 
-	Image tempImage;
-	int lift_num;
-	std::string lift, arg;
+	std::string_view lift, arg;
 
-	lift = Latex::getSubExpression(expression, 0, '{', '}', false);
+	lift = tokens.getSubExpression('{', '}');
 	if (lift.length() == 0) return;
 
-	arg = Latex::getSubExpression(expression, 0, '{', '}', false);
+	arg = tokens.getSubExpression('{', '}');
 	if (arg.length() == 0) return;
 
 	if (lift.find_first_not_of("-0123456789") != std::string::npos) return;
 
-	lift_num = std::stoi(lift);
-	tempImage = latex.toImage(arg);
-
-	if (!tempImage.isEmpty())
-	{
-		tempImage.m_Baseline += lift_num;
-		tempImage.m_AdvanceHeight -= lift_num > 0 ? lift_num : -lift_num;
+	Box raise(BOX_RAISE);
+	raise.m_Args = {std::stoi(std::string(lift))};
+	raise.append(latex.parse(arg));
 
-		image.concat(tempImage);
-	}
+	box.append(std::move(raise));
 };
 
-void Handlers::rastText(Latex& latex, std::string& expression, Image& image, SubFunctionType textType)
+void Handlers::rastText(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType textType)
 {
 	PROFILE_SCOPE("Handlers::rastText");
 
-	auto findLetter = [](const Letter* table, std::string& expr) -> const Letter*
+	auto findLetter = [](const Letter* table, std::string_view expr) -> const Letter*
 	{
-		size_t i, match;
-		const Letter* letter;
+		size_t i;
+		const Letter* letter = NULL;
 
 		for (i = 0; table[i].character != NULL; ++i)
 		{
-			match = expr.find(table[i].character, 0);
-
-			if (match != std::string::npos && match == 0)
+			if (expr.compare(0, strlen(table[i].character), table[i].character) == 0)
 				letter = &table[i];
 		};
 
-		return expr.find(letter->character, 0) == 0 ? letter : &table[i];
+		return letter != NULL ? letter : &table[i];
 	};
 
-	Image tempImage;
-	const Letter* letter;
-	std::string subexpression;
+	const Letter* letter = NULL;
+	std::string_view subexpression;
 
-	subexpression = Latex::getSubExpression(expression, 0, '{', '}', false);
+	subexpression = tokens.getSubExpression('{', '}');
 	if (subexpression.length() == 0) return;
 
 	while (subexpression.length() > 0)
 	{
 		#ifdef DEBUG
-			printf("[Handlers::rastText] subexpression = %s\n", subexpression.c_str());
+			printf("[Handlers::rastText] subexpression = %.*s\n", (int)subexpression.length(), subexpression.data());
 		#endif
 		switch (textType)
 		{
@@ -545,137 +808,102 @@ void Handlers::rastText(Latex& latex, std::string& expression, Image& image, Sub
 
 		if (letter->character != NULL)
 		{
-			subexpression.erase(0, strlen(letter->character));
-			tempImage.rasterizeCharacter(latex.getSelectedFont(), letter->charCode, latex.getFontColor());
+			subexpression.remove_prefix(strlen(letter->character));
+			box.append(Box::glyph(latex.getSelectedFont(), letter->charCode, latex.getFontColor()));
 		}
 		else
-			subexpression.erase(0, 1);
+			subexpression.remove_prefix(1);
 	}
-
-	image.concat(tempImage);
 };
 
-void Handlers::rastSetWeight(Latex& latex, std::string& expression, Image& image, SubFunctionType fontType)
+void Handlers::rastSetWeight(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType fontType)
 {
 	PROFILE_SCOPE("Handlers::rastSetWeight");
 
-	Image tempImage;
 	FontType type = latex.getSelectedFont().m_Type;
-	std::string subexpression;
+	std::string_view subexpression;
 
-	subexpression = Latex::getSubExpression(expression, 0, '{', '}', false);
+	subexpression = tokens.getSubExpression('{', '}');
 	if (subexpression.length() == 0) return;
 
 	latex.setSelectedFont(
-		fontType == FONT_REGULAR ? FontType::Normal : 
-		fontType == FONT_ITALIC ? FontType::Italic : 
-		fontType == FONT_BOLD ? FontType::Bold : 
+		fontType == FONT_REGULAR ? FontType::Normal :
+		fontType == FONT_ITALIC ? FontType::Italic :
+		fontType == FONT_BOLD ? FontType::Bold :
 		fontType == FONT_BOLDITALIC ? FontType::BoldItalic : FontType::Normal
 	);
 
-	tempImage = latex.toImage(subexpression);
+	box.append(latex.parse(subexpression));
 
 	latex.setSelectedFont(type);
-
-	image.concat(tempImage);
 };
 
-void Handlers::rastScripts(Latex& latex, std::string& expression, Image& image, SubFunctionType type)
+void Handlers::rastScripts(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType type)
 {
 	PROFILE_SCOPE("Handlers::rastScripts");
 
-	Image subImg, supImg;
-	Details subDetails = {0, 0, 0, 0, 0}, supDetails = {0, 0, 0, 0, 0};
-	int newWidth, newHeight;
-	bool isSub, isSup;
-	float sizeOff = 0.6f;
+	float sizeOff = SCRIPT_SCALE;
 	Scripts scripts;
 	Font& font = latex.getSelectedFont();
+	Box supBox(BOX_LIST), subBox(BOX_LIST), scriptsBox(BOX_SCRIPTS);
 
-	if (expression.length() == 0) return;
-
-	scripts = Latex::texScripts(expression, ScriptType::BOTH);
-
-	font.setSize(font.m_SFT.xScale * sizeOff);
-
-	if (scripts.subScript.length() != 0)
-	{
-		isSub = true;
-		subImg = latex.toImage(scripts.subScript); // implement proper size changer
-	}
-
-	if (scripts.supScript.length() != 0)
-	{
-		isSup = true;
-		supImg = latex.toImage(scripts.supScript);
-	}
+	if (tokens.atEnd()) return;
 
-	font.setSize(font.m_SFT.xScale / sizeOff);
+	scripts = Latex::texScripts(tokens, ScriptType::BOTH);
 
-	if (!isSub && !isSup) return;
+	if (scripts.subScript.length() == 0 && scripts.supScript.length() == 0) return;
 
-	if (isSub)
-		subDetails = subImg.getDetails();
+	uint16_t size = font.m_SFT.xScale; //restore exact size afterwards, scaling back would truncate it
 
-	if (isSup)
-		supDetails = supImg.getDetails();
+	font.setSize(size * sizeOff);
 
-	#ifdef DEBUG
-		printf("[Handlers::rastScripts] Subscript details: height = %d, width = %d\n", subDetails.height, subDetails.width);
-		printf("[Handlers::rastScripts] Superscript details: height = %d, width = %d\n", supDetails.height, supDetails.width);
-	#endif
-
-	newWidth = subDetails.width > supDetails.width ? subDetails.width : supDetails.width;
-	newHeight = (image.m_Height - image.m_AdvanceHeight) + subDetails.height + supDetails.height;
+	if (scripts.subScript.length() != 0)
+		subBox = latex.parse(scripts.subScript); // implement proper size changer
 
-	#ifdef DEBUG
-		printf("[Handlers::rastScripts] Combined height = %d, width = %d\n", newHeight, newWidth);
-	#endif
+	if (scripts.supScript.length() != 0)
+		supBox = latex.parse(scripts.supScript);
 
-	Image tempImg(newWidth, newHeight, 4);
-	tempImg.m_Baseline = newHeight - subDetails.height;
-	if (subDetails.height > 0) tempImg.m_AdvanceHeight += subDetails.height;
+	font.setSize(size);
 
-	tempImg.overlay(supImg, 0, 0);
-	tempImg.overlay(subImg, 0, newHeight - subDetails.height);
+	// nucleus, superscript, subscript
+	scriptsBox.append(std::move(box));
+	scriptsBox.append(std::move(supBox));
+	scriptsBox.append(std::move(subBox));
 
-	image.concat(tempImg);
+	box = std::move(scriptsBox);
 };
 
-void Handlers::rastBegin(Latex& latex, std::string& expression, Image& image, SubFunctionType type)
+void Handlers::rastBegin(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType type)
 {
 	PROFILE_SCOPE("Handlers::rastBegin");
 
 	return; //!!!!
-	auto findEnv = [](const char* table[], std::string& expr) -> int
+	auto findEnv = [](const char* table[], std::string_view expr) -> int
 	{
-		size_t i, match;
-		const char* env;
+		size_t i;
 
 		for (i = 0; table[i] != NULL; ++i)
 		{
-			match = expr.find(table[i], 0);
-
-			if (match != std::string::npos && match == 0)
+			if (expr.compare(0, strlen(table[i]), table[i]) == 0)
 				return i;
 		};
 
 		return i;
 	};
 
-	std::string subexpression, environment;
+	std::string_view subexpression, environment;
 	const char* end = "\\end";
 
 	const char* environments[] =
 	{
-		"eqnarray", "array", "matrix", "tabular", 
-		"pmatrix", "bmatrix", "Bmatrix", "vmatrix", 
+		"eqnarray", "array", "matrix", "tabular",
+		"pmatrix", "bmatrix", "Bmatrix", "vmatrix",
 		"Vmatrix", "gather", "align", "verbatim",
 		"picture", "cases", "equation", NULL
 	};
 
 	// get used environment
-	environment = Latex::getSubExpression(expression, 0, '{', '}', false);
+	environment = tokens.getSubExpression('{', '}');
 
 	// eh...
 	switch (findEnv(environments, environment))
@@ -715,208 +943,140 @@ void Handlers::rastBegin(Latex& latex, std::string& expression, Image& image, Su
 	}
 
 	// find first \end{...} token
-	// if token is found, and environment isn't matching, check for another 
+	// if token is found, and environment isn't matching, check for another
 	// \begin between them, or check for another \end after first one
 
-	/* 
-		get all thingys between \begin{...} and \end{...} (everything before 
-		\end{...}, to be exact, 'cause \begin is chopped before handler 
-		calling, and {...} is chopped after Latex::getSubExpression)
+	/*
+		get all thingys between \begin{...} and \end{...} (everything before
+		\end{...}, to be exact, 'cause \begin is chopped before handler
+		calling, and {...} is chopped after Tokenizer::getSubExpression)
 	*/
 
 }
 
-void Handlers::rastArray(Latex& latex, std::string& expression, Image& image, SubFunctionType type)
+void Handlers::rastArray(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType type)
 {
 	PROFILE_SCOPE("Handlers::rastArray");
 
 	// search for subexpression between brackets
-	// rasterize it
-	// rasterize left bracket the same height as rasterized expression
-	// create bracket rasterizer with some height/width parameters
+	// lay it out
+	// stretch left bracket to the same height as laid out expression
 	// do the same with right bracket
 	// lbracket + subexpr + rbracket
-	// concat result with image
 
-	Image exprImg, tempImg; 
-	std::string subexpr;
+	std::string_view subexpr;
+	Box content;
 
-	subexpr = Latex::getSubExpression(expression, 0, '{', '}', false);
-	exprImg = latex.toImage(subexpr);
+	subexpr = tokens.getSubExpression('{', '}');
+	content = latex.parse(subexpr);
 
 	switch(type)
 	{
 		case ARR_NORMAL:
 		case ARR_MATRIX:
 		{
-			Image lbImg, rbImg;
-			SFT_Char c;
-			Font font = latex.getSelectedFont();
-			Color color = latex.getFontColor();
-
-			double tempval = font.m_SFT.yScale;
-			int ttt = exprImg.m_Height;
-
-			sft_char(&(font.m_SFT), '{', &c);
-
-			while (c.height < ttt) 
-			{
-				// uint_fast32_t outline;
-				// outline_offset(font.m_SFT.font, '{', &outline);
-				// y1 = geti16(sft->font, outline + 4);
-				// y2 = geti16(sft->font, outline + 8);
-				//font.m_SFT.yScale = exprImg.m_Height / (y2 + 1 - y1);
-				font.m_SFT.yScale = (ttt / (c.height / (font.m_SFT.yScale / font.m_SFT.font->unitsPerEm)));
-				sft_char(&(font.m_SFT), '{', &c);
-			}
+			Box delimited(BOX_DELIMITED);
+			const Font& font = latex.getSelectedFont();
+			const Color& color = latex.getFontColor();
 
-			lbImg.rasterizeCharacter(font, type == ARR_NORMAL ? '{' : '[', color);
-			rbImg.rasterizeCharacter(font, type == ARR_NORMAL ? '}' : ']', color);
+			delimited.m_Kind = type;
+			delimited.append(Box::glyph(font, type == ARR_NORMAL ? '{' : '[', color));
+			delimited.append(std::move(content));
+			delimited.append(Box::glyph(font, type == ARR_NORMAL ? '}' : ']', color));
 
-			font.setSize(tempval);
-
-			tempImg = Image::concat(lbImg, exprImg);
-			tempImg.concat(rbImg);
+			box.append(std::move(delimited));
 			break;
 		}
 		case ARR_TABULAR:
 		{
-			tempImg = exprImg;
+			box.append(std::move(content));
 			break;
 		}
 		default:
 			break;
 	}
-
-	image.concat(tempImg);
 };
 
-void Handlers::rastRotate(Latex& latex, std::string& expression, Image& image, SubFunctionType type)
+void Handlers::rastRotate(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType type)
 {
 	PROFILE_SCOPE("Handlers::rastRotate");
 
-	Image tempImage;
-	int degrees_num;
-	std::string subexpr, degrees;
+	std::string_view subexpr, degrees;
 
-	degrees = Latex::getSubExpression(expression, 0, '{', '}', false);
+	degrees = tokens.getSubExpression('{', '}');
 	if (degrees.length() == 0) return;
 
-	subexpr = Latex::getSubExpression(expression, 0, '{', '}', false);
+	subexpr = tokens.getSubExpression('{', '}');
 	if (subexpr.length() == 0) return;
 
 	if (degrees.find_first_not_of("-0123456789") != std::string::npos) return;
 
-	degrees_num = std::stoi(degrees);
-
-	tempImage = latex.toImage(subexpr);
+	Box rotate(BOX_TRANSFORM);
+	rotate.m_Kind = TRANSFORM_ROTATE;
+	rotate.m_Args = {std::stoi(std::string(degrees)) % 360};
+	rotate.append(latex.parse(subexpr));
 
-	if (!tempImage.isEmpty())
-	{
-		tempImage.rotate((double)(degrees_num % 360));
-		image.concat(tempImage);
-	}
+	box.append(std::move(rotate));
 };
 
-void Handlers::rastFrac(Latex& latex, std::string& expression, Image& image, SubFunctionType type)
+void Handlers::rastFrac(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType type)
 {
 	PROFILE_SCOPE("Handlers::rastFrac");
 
-	Image tempImage, numerImg, denomImg;
-	std::string numer, denom;
-	
-	numer = Latex::getSubExpression(expression, 0, '{', '}', false);
+	std::string_view numer, denom;
+
+	numer = tokens.getSubExpression('{', '}');
 	if (numer.length() == 0) return;
 
-	denom = Latex::getSubExpression(expression, 0, '{', '}', false);
+	denom = tokens.getSubExpression('{', '}');
 	if (denom.length() == 0) return;
 
 	//lower size
-	numerImg = latex.toImage(numer);
-	denomImg = latex.toImage(denom);
-
-	if (numerImg.isEmpty() || denomImg.isEmpty()) return;
-
-	tempImage = Image::concat(numerImg, denomImg, ImagePosition::BOTTOM, 1);
+	Box frac(BOX_FRACTION);
+	frac.m_Kind = type;
+	frac.m_Color = latex.getFontColor();
+	frac.append(latex.parse(numer));
+	frac.append(latex.parse(denom));
 
-	switch(type)
-	{
-		case FRAC_NORMAL:
-		case FRAC_OVER:
-			tempImage.drawLine(0, numerImg.m_Height - 1, tempImage.m_Width, numerImg.m_Height - 1, latex.getFontColor());
-			break;
-		case FRAC_ATOP:
-			break;
-		case FRAC_CHOOSE:
-			// Add parenthesis around rasterized text
-			break;
-		default:
-			break;
-	}
-
-	image.concat(tempImage);
+	box.append(std::move(frac));
 }
 
-void Handlers::rastOverlay(Latex& latex, std::string& expression, Image& image, SubFunctionType overlayType)
+void Handlers::rastOverlay(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType overlayType)
 {
 	PROFILE_SCOPE("Handlers::rastOverlay");
 
-	auto overlayLine = [&latex, &expression, &image, &overlayType]() -> void
+	auto overlayLine = [&latex, &tokens, &box, &overlayType]() -> void
 	{
-		Image subImage1, subImage2;
-		std::string subexpr;
+		std::string_view subexpr;
 
-		subexpr = Latex::getSubExpression(expression, 0, '{', '}', false);
+		subexpr = tokens.getSubExpression('{', '}');
 		if (subexpr.length() == 0) return;
 
-		subImage1 = latex.toImage(subexpr);
-
-		switch (overlayType)
-		{
-			case OVERLAY_DIAG_LINE:
-				subImage1.drawLine(0, subImage1.m_Height - 1, subImage1.m_Width - 1, 0, latex.getFontColor());
-				break;
-			case OVERLAY_HOR_LINE:
-				subImage1.drawLine(0, subImage1.m_Height / 2, subImage1.m_Width, subImage1.m_Height / 2, latex.getFontColor());
-				break;
-			case OVERLAY_SLASH:
-				break;
-			default:
-				break;
-		}
+		Box strike(BOX_STRIKE);
+		strike.m_Color = latex.getFontColor();
+		strike.m_Kind =
+			overlayType == OVERLAY_DIAG_LINE ? STRIKE_DIAGONAL :
+			overlayType == OVERLAY_HOR_LINE ? STRIKE_HORIZONTAL : STRIKE_NONE;
+		strike.append(latex.parse(subexpr));
 
-		image.concat(subImage1);
+		box.append(std::move(strike));
 	};
 
-	auto overlayCompose = [&latex, &expression, &image]() mutable -> void
+	auto overlayCompose = [&latex, &tokens, &box]() mutable -> void
 	{
-		Image subImage1, subImage2;
-		std::string subexpr1, subexpr2;
+		std::string_view subexpr1, subexpr2;
 
-		subexpr1 = Latex::getSubExpression(expression, 0, '{', '}', false);
+		subexpr1 = tokens.getSubExpression('{', '}');
 		if (subexpr1.length() == 0) return;
 
-		subexpr2 = Latex::getSubExpression(expression, 0, '{', '}', false);
+		subexpr2 = tokens.getSubExpression('{', '}');
 		if (subexpr2.length() == 0) return;
 
-		subImage1 = latex.toImage(subexpr1);
-		subImage2 = latex.toImage(subexpr2);
-
-		Details subDetails1 = subImage1.getDetails();
-		Details subDetails2 = subImage2.getDetails();
+		Box compose(BOX_COMPOSE);
+		compose.append(latex.parse(subexpr1));
+		compose.append(latex.parse(subexpr2));
 
-		Image tempImage(
-			subDetails1.width > subDetails2.width ? subDetails1.width : subDetails2.width, 
-			subDetails1.height > subDetails2.height ? subDetails1.height : subDetails2.height, 
-			subDetails1.channels > subDetails2.channels ? subDetails1.channels : subDetails2.channels
-		);
-
-		int baseline = subDetails1.baseline > subDetails2.baseline ? subDetails1.baseline : subDetails2.baseline;
-
-		tempImage.overlay(subImage1, 0, baseline > 0 ? baseline - subDetails1.baseline : 0);
-		tempImage.overlay(subImage2, 0, baseline > 0 ? baseline - subDetails2.baseline : 0);
-
-		image.concat(tempImage);
+		box.append(std::move(compose));
 	};
 
 	switch (overlayType)
@@ -934,43 +1094,44 @@ void Handlers::rastOverlay(Latex& latex, std::string& expression, Image& image,
 	}
 }
 
-void Handlers::rastSqrt(Latex& latex, std::string& expression, Image& image, SubFunctionType type)
+void Handlers::rastSqrt(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType type)
 {
 	PROFILE_SCOPE("Handlers::rastSqrt");
 	//! how.
 	return;
 }
 
-void Handlers::rastEval(Latex& latex, std::string& expression, Image& image, SubFunctionType type)
+void Handlers::rastEval(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType type)
 {
 	PROFILE_SCOPE("Handlers::rastEval");
 
 	std::string subexpr;
 	int subexpr_int;
+	Box result;
 	std::function<char(void)> get, peek;
 	std::function<int(void)> expr, term, factor, number;
 
-	peek = [&subexpr]() -> char 
-	{ 
-		return subexpr[0]; 
+	peek = [&subexpr]() -> char
+	{
+		return subexpr[0];
 	};
 
-	get = [&subexpr]() -> char 
-	{ 
-		char result = subexpr[0]; 
-		subexpr.erase(0, 1); 
-		return result; 
+	get = [&subexpr]() -> char
+	{
+		char result = subexpr[0];
+		subexpr.erase(0, 1);
+		return result;
 	};
 
-	number = [&get, &peek]() -> int 
+	number = [&get, &peek]() -> int
 	{
 		int result = get() - '0';
-		while (peek() >= '0' && peek() <= '9') 
-			result = 10*result + get() - '0'; 
-		return result; 
+		while (peek() >= '0' && peek() <= '9')
+			result = 10*result + get() - '0';
+		return result;
 	};
 
-	factor = [&get, &peek, &number, &factor, &expr]() -> int 
+	factor = [&get, &peek, &number, &factor, &expr]() -> int
 	{
 		if (peek() >= '0' && peek() <= '9')
         	return number();
@@ -1019,34 +1180,37 @@ void Handlers::rastEval(Latex& latex, std::string& expression, Image& image, Sub
 		return result;
 	};
 
-	subexpr = Latex::getSubExpression(expression, 0, '(', ')', false);
+	subexpr = tokens.getSubExpression('(', ')');
 	if (subexpr.length() == 0)
 		return;
-	
+
 	subexpr_int = expr();
-	expression.insert(0, std::to_string(subexpr_int));
+	result = latex.parse(std::string_view(std::to_string(subexpr_int)));
+
+	if (tokens.peek().type == TOKEN_SCRIPT)
+		Handlers::rastScripts(latex, tokens, result, NONE);
+
+	box.append(std::move(result));
 }
 
-void Handlers::rastToday(Latex& latex, std::string& expression, Image& image, SubFunctionType type)
+void Handlers::rastToday(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType type)
 {
 	PROFILE_SCOPE("Handlers::rastToday");
-	
-	std::string subexpr;
+
 	char text[128];
 	tm tmstruct;
-	Image tempImg;
 
-	static const char* dayNames[] = 
-	{ 
-		"Sunday", "Monday", "Tuesday", "Wednesday", 
+	static const char* dayNames[] =
+	{
+		"Sunday", "Monday", "Tuesday", "Wednesday",
 		"Thursday", "Friday", "Saturday"
 	};
 
-	static const char* monthNames[] = 
-	{ 
-		"January", "February", "March", 
-		"April", "May", "June", "July", 
-		"August", "September", "October", "November", 
+	static const char* monthNames[] =
+	{
+		"January", "February", "March",
+		"April", "May", "June", "July",
+		"August", "September", "October", "November",
 		"December"
 	};
 
@@ -1054,66 +1218,64 @@ void Handlers::rastToday(Latex& latex, std::string& expression, Image& image, Su
 	localtime_s(&tmstruct, &time);
 
 	sprintf(text, "%s, %s %d, %d", dayNames[tmstruct.tm_wday], monthNames[tmstruct.tm_mon], tmstruct.tm_mday, tmstruct.tm_year + 1900);
-	subexpr = text;
-
-	tempImg = latex.toImage(subexpr);
 
-	image.concat(tempImg);
+	box.append(latex.parse(std::string_view(text)));
 }
 
-void Handlers::rastPicture(Latex& latex, std::string& expression, Image& image, SubFunctionType type)
+void Handlers::rastPicture(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType type)
 {
 	PROFILE_SCOPE("Handlers::rastPicture");
 
 	int width, height;
-	size_t i;
 	std::string subexpr, temp;
+	std::string_view content;
 
-	subexpr = Latex::getSubExpression(expression, 0, '(', ')', false);
+	subexpr = tokens.getSubExpression('(', ')');
 	if (subexpr.find_first_not_of("-0123456789,") != std::string::npos) return;
 	width = std::stoi(subexpr.substr(0, subexpr.find(",")));
 	height = std::stoi(subexpr.substr(subexpr.find(",") + 1));
 
-	Image tempImg = Image(width, height, 4);
-	subexpr = Latex::getSubExpression(expression, 0, '{', '}', false);
+	Box pictureBox(BOX_PICTURE);
+	pictureBox.m_Args = {width, height};
+
+	Tokenizer picture(tokens.getSubExpression('{', '}'));
 
-	while (subexpr.length() != 0)
+	while (!picture.atEnd())
 	{
-		for (i = 0; i < subexpr.length(); ++i)
+		if (picture.peekChar() != '(')
 		{
-			if (subexpr[i] != '(') 
-			{
-				i++;
-				continue;
-			};
+			picture.skip();
+			continue;
+		};
 
-			temp = Latex::getSubExpression(subexpr, 0, '(', ')', false);
+		temp = picture.getSubExpression('(', ')');
 
-			if (temp.find_first_not_of("-0123456789,") != std::string::npos) return;
-			
-			width = std::stoi(temp.substr(0, temp.find(",")));
-			height = std::stoi(temp.substr(temp.find(",") + 1));
+		if (temp.find_first_not_of("-0123456789,") != std::string::npos) return;
 
-			temp = Latex::getSubExpression(subexpr, 0, '{', '}', false);
-			tempImg.overlay(latex.toImage(temp), width, height);
+		width = std::stoi(temp.substr(0, temp.find(",")));
+		height = std::stoi(temp.substr(temp.find(",") + 1));
 
-			break;
-		}
-		if (i > 0)
-			subexpr.erase(0, i + 1);
+		content = picture.getSubExpression('{', '}');
+
+		// children of the picture keep their position
+		Box child = latex.parse(content);
+		child.m_X = width;
+		child.m_Y = height;
+
+		pictureBox.append(std::move(child));
 	}
 
-	image.concat(tempImg);
+	box.append(std::move(pictureBox));
 }
 
-void Handlers::rastAccent(Latex& latex, std::string& expression, Image& image, SubFunctionType type)
+void Handlers::rastAccent(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType type)
 {
 	PROFILE_SCOPE("Handlers::rastAccent");
 
 	return;
 }
 
-void Handlers::rastMathFunc(Latex& latex, std::string& expression, Image& image, SubFunctionType funcType)
+void Handlers::rastMathFunc(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType funcType)
 {
 	PROFILE_SCOPE("Handlers::rastMathFunc");
 
@@ -1124,182 +1286,82 @@ void Handlers::rastMathFunc(Latex& latex, std::string& expression, Image& image,
 		"arg", "sin", "sinh", "cos",
 		"cosh", "tan", "tanh", "cot",
 		"coth", "csc", "deg", "det",
-		"dim", "exp", "gcd", "hom", "inf", 
-		"ker", "lg", "lim", "liminf", 
-		"limsup", "ln", "log", "max", 
+		"dim", "exp", "gcd", "hom", "inf",
+		"ker", "lg", "lim", "liminf",
+		"limsup", "ln", "log", "max",
 		"min"
 	};
 
-	expression.insert(0, mathFuncNames[funcType - 399]);
+	Box name = latex.parse(std::string_view(mathFuncNames[funcType - 399]));
+
+	if (tokens.peek().type == TOKEN_SCRIPT)
+		Handlers::rastScripts(latex, tokens, name, NONE);
+
+	box.append(std::move(name));
 }
 
-void Handlers::rastGRChar(Latex& latex, std::string& expression, Image& image, SubFunctionType charCode)
+void Handlers::rastGRChar(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType charCode)
 {
 	PROFILE_SCOPE("Handlers::rastGRChar");
 
-	Image tempImage;
-
 	if (charCode != 0)
 	{
-		tempImage.rasterizeCharacter(latex.getSelectedFont(), charCode, latex.getFontColor());
+		Box glyph = Box::glyph(latex.getSelectedFont(), charCode, latex.getFontColor());
 
-		if (expression[0] == '_' || expression[0] == '^')
-			Handlers::rastScripts(latex, expression, tempImage, NONE);
+		if (tokens.peek().type == TOKEN_SCRIPT)
+			Handlers::rastScripts(latex, tokens, glyph, NONE);
 
-		image.concat(tempImage);
+		box.append(std::move(glyph));
 	}
 }
 
-void Handlers::rastBezier(Latex& latex, std::string& expression, Image& image, SubFunctionType bezierType)
+void Handlers::rastBezier(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType bezierType)
 {
 	PROFILE_SCOPE("Handlers::rastBezier");
 
-	auto getPoint = [](int n1, int n2, float perc) -> int
-	{
-		int diff = n2 - n1;
-
-		return n1 + (diff * perc);
-	};
-
 	// can't understand why quadractic has 3 points, and cubic 4 points, like wth
-	Image tempImage;
-	uint8_t* dstPx;
-	Color color = latex.getFontColor();
-
-	switch (bezierType)
-	{
-		case BEZIER_QUADRATIC:
-		{
-			std::string coord1, coord2, coord3;
-			int x1, x2, x3, y1, y2, y3, xa, ya, xb, yb, x, y;
-			float i;
-
-			coord1 = Latex::getSubExpression(expression, 0, '(', ')', false);
-			if (coord1.length() == 0 || coord1.find_first_not_of("-0123456789,") != std::string::npos) return;
-
-			coord2 = Latex::getSubExpression(expression, 0, '(', ')', false);
-			if (coord2.length() == 0 || coord2.find_first_not_of("-0123456789,") != std::string::npos) return;
+	std::string coord;
+	const char* allowed = bezierType == BEZIER_QUADRATIC ? "-0123456789," : "0123456789,";
+	int points = bezierType == BEZIER_QUADRATIC ? 3 : 4;
+	Box bezier(BOX_BEZIER);
 
-			coord3 = Latex::getSubExpression(expression, 0, '(', ')', false);
-			if (coord3.length() == 0 || coord3.find_first_not_of("-0123456789,") != std::string::npos) return;
+	bezier.m_Kind = bezierType;
+	bezier.m_Color = latex.getFontColor();
 
-			x1 = std::stoi(coord1.substr(0, coord1.find(",")));
-			y1 = std::stoi(coord1.substr(coord1.find(",") + 1));
-
-			x2 = std::stoi(coord2.substr(0, coord2.find(",")));
-			y2 = std::stoi(coord2.substr(coord2.find(",") + 1));
-
-			x3 = std::stoi(coord3.substr(0, coord3.find(",")));
-			y3 = std::stoi(coord3.substr(coord3.find(",") + 1));
-
-			tempImage = Image(std::max<int>(x1, std::max<int>(x2, x3)), std::max<int>(y1, std::max<int>(y2, y3)), 4);
-
-			for (i = 0; i < 1; i += 0.01)
-			{
-				xa = getPoint(x1, x2, i);
-				ya = getPoint(y1, y2, i);
-				xb = getPoint(x2, x3, i);
-				yb = getPoint(y2, y3, i);
-
-				x = getPoint(xa, xb, i);
-				y = getPoint(ya, yb, i);
-
-				dstPx = &tempImage.m_Data[(x + y * tempImage.m_Width) * tempImage.m_Channels];
-				
-				for (int j = 0; j < tempImage.m_Channels; ++j)
-					dstPx[j] = color[j];
-			}
-
-			break;
-		}
-		case BEZIER_CUBIC:
-		{
-			std::string coord1, coord2, coord3, coord4;
-			int x1, x2, x3, x4, y1, y2, y3, y4, xa, ya, xb, yb, xc, yc, xm, ym, xn, yn, x, y;
-			float i;
-
-			coord1 = Latex::getSubExpression(expression, 0, '(', ')', false);
-			if (coord1.length() == 0 || coord1.find_first_not_of("0123456789,") != std::string::npos) return;
-
-			coord2 = Latex::getSubExpression(expression, 0, '(', ')', false);
-			if (coord2.length() == 0 || coord2.find_first_not_of("0123456789,") != std::string::npos) return;
-
-			coord3 = Latex::getSubExpression(expression, 0, '(', ')', false);
-			if (coord3.length() == 0 || coord3.find_first_not_of("0123456789,") != std::string::npos) return;
-
-			coord4 = Latex::getSubExpression(expression, 0, '(', ')', false);
-			if (coord4.length() == 0 || coord4.find_first_not_of("0123456789,") != std::string::npos) return;
-
-			x1 = std::stoi(coord1.substr(0, coord1.find(",")));
-			y1 = std::stoi(coord1.substr(coord1.find(",") + 1));
-
-			x2 = std::stoi(coord2.substr(0, coord2.find(",")));
-			y2 = std::stoi(coord2.substr(coord2.find(",") + 1));
-
-			x3 = std::stoi(coord3.substr(0, coord3.find(",")));
-			y3 = std::stoi(coord3.substr(coord3.find(",") + 1));
-
-			x4 = std::stoi(coord4.substr(0, coord4.find(",")));
-			y4 = std::stoi(coord4.substr(coord4.find(",") + 1));
-
-			tempImage = Image(std::max<int>(x1, std::max<int>(x2, std::max<int>(x3, x4))), std::max<int>(y1, std::max<int>(y2, std::max<int>(y3, y4))), 4);
-
-			for (i = 0; i < 1; i += 0.01)
-			{
-				xa = getPoint(x1, x2, i);
-				ya = getPoint(y1, y2, i);
-				xb = getPoint(x2, x3, i);
-				yb = getPoint(y2, y3, i);
-				xc = getPoint(x3, x4, i);
-				yc = getPoint(y3, y4, i);
-
-				xm = getPoint(xa, xb, i);
-				ym = getPoint(ya, yb, i);
-				xn = getPoint(xb, xc, i);
-				yn = getPoint(yb, yc, i);
-
-				x = getPoint(xm, xn, i);
-				y = getPoint(ym, yn, i);
-
-				dstPx = &tempImage.m_Data[(x + y * tempImage.m_Width) * tempImage.m_Channels];
-
-				for (int j = 0; j < tempImage.m_Channels; ++j)
-					dstPx[j] = color[j];
-			}
+	for (int i = 0; i < points; ++i)
+	{
+		coord = tokens.getSubExpression('(', ')');
+		if (coord.length() == 0 || coord.find_first_not_of(allowed) != std::string::npos) return;
 
-			break;
-		}
-		default:
-			break;
+		bezier.m_Args.push_back(std::stoi(coord.substr(0, coord.find(","))));
+		bezier.m_Args.push_back(std::stoi(coord.substr(coord.find(",") + 1)));
 	}
 
-	image.concat(tempImage);
+	box.append(std::move(bezier));
 }
 
-void Handlers::rastMagnify(Latex& latex, std::string& expression, Image& image, SubFunctionType type)
+void Handlers::rastMagnify(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType type)
 {
 	PROFILE_SCOPE("Handlers::rastMagnify");
 
-	Image tempImage;
-	std::string magnifier, subexpression;
-	int magnifier_num;
+	std::string magnifier;
+	std::string_view subexpression;
 
-	magnifier = Latex::getSubExpression(expression, 0, '{', '}', false);
+	magnifier = tokens.getSubExpression('{', '}');
 	if (magnifier.length() == 0 || magnifier.find_first_not_of("0123456789") != std::string::npos) return;
 
-	subexpression = Latex::getSubExpression(expression, 0, '{', '}', false);
+	subexpression = tokens.getSubExpression('{', '}');
 	if (subexpression.length() == 0) return;
 
-	magnifier_num = std::stoi(magnifier);
-
-	tempImage = latex.toImage(subexpression);
+	Box magnify(BOX_TRANSFORM);
+	magnify.m_Kind = TRANSFORM_MAGNIFY;
+	magnify.m_Args = {std::stoi(magnifier)};
+	magnify.append(latex.parse(subexpression));
 
-	tempImage.scaleUp(magnifier_num);
-	
-	image.concat(tempImage);
+	box.append(std::move(magnify));
 }
 
-void Handlers::rastFBox(Latex& latex, std::string& expression, Image& image, SubFunctionType type)
+void Handlers::rastFBox(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType type)
 {
 	PROFILE_SCOPE("Handlers::rastFBox");
 
@@ -1312,25 +1374,23 @@ void Handlers::rastFBox(Latex& latex, std::string& expression, Image& image, Sub
 	// rasterize subexpression
 }
 
-void Handlers::rastArrow(Latex& latex, std::string& expression, Image& image, SubFunctionType type)
+void Handlers::rastArrow(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType type)
 {
 	PROFILE_SCOPE("Handlers::rastArrow");
 
 	return;
 }
 
-void Handlers::rastLine(Latex& latex, std::string& expression, Image& image, SubFunctionType type)
+void Handlers::rastLine(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType type)
 {
 	PROFILE_SCOPE("Handlers::rastLine");
 
-	Image tempImage;
 	int x1, x0, y1, y0;
-	Color color = latex.getFontColor();
 
-	std::string pos1 = Latex::getSubExpression(expression, 0, '(', ')', false);
+	std::string pos1(tokens.getSubExpression('(', ')'));
 	if (pos1.length() == 0 || pos1.find_first_not_of(",0123456789") != std::string::npos) return;
 
-	std::string pos2 = Latex::getSubExpression(expression, 0, '(', ')', false);
+	std::string pos2(tokens.getSubExpression('(', ')'));
 	if (pos2.length() == 0 || pos2.find_first_not_of(",0123456789") != std::string::npos) return;
 
 	x0 = std::stoi(pos1.substr(0,pos1.find(",")));
@@ -1339,39 +1399,29 @@ void Handlers::rastLine(Latex& latex, std::string& expression, Image& image, Sub
 	x1 = std::stoi(pos2.substr(0,pos2.find(",")));
 	y1 = std::stoi(pos2.substr(pos2.find(",") + 1));
 
-	tempImage = Image(std::max<int>(x0, x1) + 1, std::max<int>(y0, y1) + 1, 4);
-
-	tempImage.drawLine(x0, y0, x1, y1, color);
+	Box line(BOX_LINE);
+	line.m_Color = latex.getFontColor();
+	line.m_Args = {x0, y0, x1, y1};
 
-	image.concat(tempImage);
+	box.append(std::move(line));
 }
 
-void Handlers::rastReflect(Latex& latex, std::string& expression, Image& image, SubFunctionType type)
+void Handlers::rastReflect(Latex& latex, Tokenizer& tokens, Box& box, SubFunctionType type)
 {
 	PROFILE_SCOPE("Handlers::rastReflect");
 
-	Image tempImage;
-	std::string axis, subexpr;
+	std::string_view axis, subexpr;
 
-	axis = Latex::getSubExpression(expression, 0, '[', ']', false);
+	axis = tokens.getSubExpression('[', ']');
 	if (axis.length() == 0 && axis.length() > 1) return;
 
-	subexpr = Latex::getSubExpression(expression, 0, '{', '}', false);
+	subexpr = tokens.getSubExpression('{', '}');
 	if (subexpr.length() == 0) return;
 
-	tempImage = latex.toImage(subexpr);
-
-	switch (axis[0])
-	{
-		case 'x':
-			tempImage.flip(AXIS::X);
-			break;
-		case 'y':
-			tempImage.flip(AXIS::Y);
-			break;
-		default:
-			break;
-	}
+	Box reflect(BOX_TRANSFORM);
+	reflect.m_Kind = TRANSFORM_REFLECT;
+	reflect.m_Args = {axis.length() > 0 && axis[0] == 'x' ? AXIS::X : axis.length() > 0 && axis[0] == 'y' ? AXIS::Y : -1};
+	reflect.append(latex.parse(subexpr));
 
-	image.concat(tempImage);
-}
\ No newline at end of file
+	box.append(std::move(reflect));
+}
@@ -1,6 +1,10 @@
 #pragma once
 
 #include "Image.hpp"
+#include "Tokenizer.hpp"
+#include "Box.hpp"
+#include "RenderCache.hpp"
+#include "ThreadPool.hpp"
 
 #include <stdexcept>
 #include <cstring>
@@ -12,6 +16,9 @@
 #include <chrono>
 #endif
 
+/* Size of sub- and superscripts relative to the base */
+#define SCRIPT_SCALE 0.6f
+
 struct Scripts;
 
 enum ScriptType { SUBSCRIPT = 1, SUPSCRIPT, BOTH };
@@ -25,29 +32,55 @@ class Latex {
 		*/
 		Latex();
 
-		Latex(const Latex&) = delete;
-
-		Latex(Latex&) = delete;
-
-		Latex(Latex&&) = delete;
+		/*
+			@brief Copies fonts, color and selected font. Copies share font faces and render cache.
+			@brief Every render works on its own copy, so one configured instance can be used from several threads
+		*/
+		Latex(const Latex&) = default;
 
 		~Latex();
 
-		static Latex& Get();
-
 		/*
 			@brief Renders image and returns it.
 			@param expression Math expression
 			@returns Rasterized image or NULL if size of image is 0
 		*/
-		Image toImage(std::string& expression);
+		Image toImage(std::string& expression) const;
+
+		/*
+			@brief Renders and encodes image, or takes it from render cache if the same expression
+			@brief was already rendered with the same fonts, size and color
+			@param expression Math expression
+			@param type Image format
+			@returns Encoded image, empty if there's nothing to rasterize
+		*/
+		RenderCache::Bytes render(std::string& expression, ImageType type = ImageType::PNG) const;
+
+		/*
+			@brief Get render cache, i.e. to set its memory cap or read hit/miss counters
+		*/
+		RenderCache& getCache() const;
+
+		/*
+			@brief Lays out expression without rasterizing it, i.e. to reserve space for the image beforehand.
+			@param expression Math expression
+			@returns Width, height, baseline, channels and size in bytes of the image toImage() would render
+		*/
+		Details measure(std::string& expression) const;
+
+		/*
+			@brief Parses already prepared expression (or subexpression) into box tree. Nothing is rasterized until box is rendered.
+			@param expression Prepared math expression
+			@returns List box with laid out parts of expression
+		*/
+		Box parse(std::string_view expression);
 
 		/*
 			@brief Preprocesses math expression. 
 			@brief Removes comments, converts user-defined functions to their equivalents, converts \\left( to \\( and \\right) to \\)
 			@param expression Math expression
 		*/
-		void prepExpression(std::string& expression);
+		void prepExpression(std::string& expression) const;
 
 		/*
 			@brief Set font file
@@ -66,6 +99,19 @@ class Latex {
 		*/
 		void setFonts(const char* normal, const char* italic, const char* bold, const char* boldItalic);
 
+		/*
+			@brief Sets size of all fonts
+			@param size Font size
+		*/
+		void setFontSize(uint16_t size);
+
+		/*
+			@brief Draws glyphs of all fonts from distance fields made once per glyph, instead of rasterizing them at every size.
+			@brief Scripts and stretched delimeters cost a lookup then, but glyph corners come out slightly rounded
+			@param enable true - draw from distance fields, false - rasterize (default)
+		*/
+		void setDistanceFields(bool enable);
+
 		/*
 			@brief Get current font
 			@returns Reference to current font
@@ -93,32 +139,63 @@ class Latex {
 		const Color& getFontColor();
 
 		/*
-			@brief Scans expression for subexpression between delimeters
-			@param expression Math expression
-			@param from Index of left delimeter
-			@param left Delimeter that begin subexpression
-			@param right Delimeter that end subexpression
-			@param returnDelims If true, subexpression returns with left and right delimeters
-			@returns String, containing everything between left and right delimeters, or next char if none found
+			@brief Set pool that independent parts of expression (fraction operands, scripts, array rows) are drawn on.
+			@brief Pool is shared by copies and can be shared by several instances
+			@param pool Thread pool, nullptr - draw on the calling thread
+		*/
+		void setThreadPool(std::shared_ptr<ThreadPool> pool);
+
+		/*
+			@brief Rasterizes printable ASCII, greek and cyrillic letters and common math symbols of every font
+			@brief at the current size and at the script size, so the first render after start doesn't pay for it
+		*/
+		void prewarmGlyphs();
+
+		/*
+			@brief Writes glyph caches of all fonts to snapshot file
+			@param path Snapshot file
+			@returns false if file couldn't be written
 		*/
-		static std::string getSubExpression(std::string& expression, unsigned from, const char left, const char right, bool returnDelims);
+		bool saveGlyphs(const char* path) const;
 
 		/*
-			@brief Searches and gets index of subfunction from the list
+			@brief Loads snapshot written by saveGlyphs(). File is mapped, coverage is used straight from it.
+			@brief Sections of fonts other than the loaded ones are skipped
+			@param path Snapshot file
+			@returns false if file couldn't be mapped, is malformed or some font doesn't match
+		*/
+		bool loadGlyphs(const char* path);
+
+		/*
+			@brief Shares rasterized glyphs of all fonts with other processes (and restarts) through glyph store.
+			@brief Set it after fonts and before rendering
+			@param store Glyph store, nullptr - stop sharing
+		*/
+		void setGlyphStore(std::shared_ptr<GlyphStore> store);
+
+		/*
+			@brief Searches subfunction from the list
 			@param expression Expression string
 			@param at An index of starting point (always starts from backslash)
-			@returns A positive integer, representing index, or negative (-1), if subfunction was not found
+			@returns Pointer to the longest matching subfunction, or nullptr if subfunction was not found
 		*/
-		static const struct SubFunction getSubFunction(const std::string& expression, size_t at);
+		static const struct SubFunction* getSubFunction(std::string_view expression, size_t at);
 
 		/*
-			@brief Searches for subscript and/or superscript in expression
+			@brief Searches for subscript and/or superscript at tokenizer's cursor
 			@returns Scripts struct, containing subscript and supscript strings
 		*/
-		static const struct Scripts texScripts(std::string& expression, ScriptType which);
+		static const struct Scripts texScripts(Tokenizer& tokens, ScriptType which);
 
 		void operator=(const Latex& other) = delete;
 
+	private:
+
+		/*
+			@brief Builds render cache key from prepared expression and everything else that affects the image
+		*/
+		std::string cacheKey(const std::string& expression, ImageType type) const;
+
 	public:
 
 		Font m_NormalFont;
@@ -128,11 +205,15 @@ class Latex {
 
 	protected:
 
-		Font* p_SelectedFont;
+		FontType p_SelectedFont = FontType::Normal;
 
 		/* Standard font color */
 		Color p_Color {255, 255, 255, 255};
 
+		std::shared_ptr<RenderCache> p_Cache = std::make_shared<RenderCache>();
+
+		std::shared_ptr<ThreadPool> p_Pool;
+
 };
 
 /* 
@@ -153,8 +234,8 @@ Color hexToRGBA(const std::string& hex, uint8_t alpha = 255);
 
 struct Scripts
 {
-	std::string subScript;
-	std::string supScript;
+	std::string_view subScript;
+	std::string_view supScript;
 };
 
 enum SubFunctionType
@@ -245,7 +326,7 @@ enum SubFunctionType
 struct SubFunction
 {
 	const char* expression;
-	std::function<void(Latex&, std::string&, Image&, SubFunctionType)> handler;
+	void (*handler)(Latex&, Tokenizer&, Box&, SubFunctionType);
 	SubFunctionType type;
 };
 
@@ -272,14 +353,14 @@ struct Handlers
 			@example "\gradient{FF0000}{00FF00}{hello}" rasterizes text between brackets and colors it with linear gradient
 			Warning: \gradient will override all colors that are present in the subexpression
 		*/
-		static void rastColor(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastColor(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \\ handler
 			@details Rasterizes left-hand expression on top of right-hand expression
 			@example "abc\\def"
 		*/
-		static void rastNewline(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastNewline(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \raisebox handler
@@ -287,7 +368,7 @@ struct Handlers
 			@example "\raisebox{50}{hel}lo" lifts "hel" part up by 50 pixels
 			@example "\raisebox{-10}{wo}rld" drops "wo" part down by 10 pixels
 		*/
-		static void rastRaise(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastRaise(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \it \bold \boldit handler
@@ -295,28 +376,28 @@ struct Handlers
 			@example "\it~hello" - hello with italic weight
 			@example "\bold{hello}" - hello with bold weight
 		*/
-		static void rastSetWeight(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastSetWeight(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief
 			@details
 			@example
 		*/
-		static void rastText(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastText(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief Subscript / superscript handler
 			@details
 			@example
 		*/
-		static void rastScripts(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastScripts(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \begin \end handler
 			@details
 			@example
 		*/
-		static void rastBegin(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastBegin(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \array \matrix \tabular handler
@@ -325,7 +406,7 @@ struct Handlers
 			@example "\matrix{a b c d e f}" - array with square brackets
 			@example "\tabular{a b c\\a b c\\a b c}" - matrix without braces/brackets
 		*/
-		static void rastArray(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastArray(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \rotatebox handler
@@ -333,7 +414,7 @@ struct Handlers
 			@example "\rotate{90}{a}" - rotate "a" by 90 degrees clockwise
 			@example "\rotate{-90}~abc" - rotate everything after subfunction by 90 degrees anticlockwise
 		*/
-		static void rastRotate(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastRotate(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \frac \over \atop \choose handler
@@ -343,70 +424,70 @@ struct Handlers
 			@example "\over{a}{b}" - a on top of b and line between
 			@example "\choose{a}{b}" - a on top of b without line and parenthesis around them
 		*/
-		static void rastFrac(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastFrac(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \not \Not \widenot \sout \strikeout \compose handler
 			@details
 			@example
 		*/
-		static void rastOverlay(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastOverlay(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \sqrt handler
 			@details
 			@example
 		*/
-		static void rastSqrt(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastSqrt(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \evaluate handler
 			@example "\evaluate(5+5)"
 			@example "\eval(10+6)"
 		*/
-		static void rastEval(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastEval(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \today handler
 			@details Rasterizes date in format "{day of the week}, {month} {day of the month}, {year}"
 			@example "\today"
 			@example "\today is now"Handlers::rastAccent  */
-		static void rastToday(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastToday(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \picture handler
 			@details
 			@example "\picture(width, height){(x,y){abc}(x,y){def}}"
 		*/
-		static void rastPicture(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastPicture(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief oh...
 			@details
 			@example
 		*/
-		static void rastAccent(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastAccent(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief Math function handler (i.e \cos, \sin, etc.)
 			@details
 			@example
 		*/
-		static void rastMathFunc(Latex&, std::string&, Image&, SubFunctionType);
+		static void rastMathFunc(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief
 			@details
 			@example
 		*/
-	   static void rastGRChar(Latex&, std::string&, Image&, SubFunctionType);
+	   static void rastGRChar(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \bezier \qbezier handler
 			@details
 			@example
 		*/
-	   static void rastBezier(Latex&, std::string&, Image&, SubFunctionType);
+	   static void rastBezier(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \magnify \magbox handler
@@ -414,28 +495,28 @@ struct Handlers
 			@example "\magnify{2}{hello}" - word hello magnified by 2 times
 			@example "\magbox{2}{hello}" - same as \magnify
 		*/
-	   static void rastMagnify(Latex&, std::string&, Image&, SubFunctionType);
+	   static void rastMagnify(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \fbox \boxed handler
 			@details Wraps subexpression in a "box"
 			@example "\fbox[200,200]{hello}" - creates 200x200 box with border, centers hello in it
 		*/
-	   static void rastFBox(Latex&, std::string&, Image&, SubFunctionType);
+	   static void rastFBox(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \longleftarrow \longrightarrow \etc. handler
 			@details Rasterizes arrow
 			@example "a\longleftarrowb" - "a⟶b"
 		*/
-	   static void rastArrow(Latex&, std::string&, Image&, SubFunctionType);
+	   static void rastArrow(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \line handler
 			@details
 			@example \line(x0,y0)(x1,y1)
 		*/
-	   static void rastLine(Latex&, std::string&, Image&, SubFunctionType);
+	   static void rastLine(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 		/*
 			@brief \reflectbox handler
@@ -443,7 +524,7 @@ struct Handlers
 			@example \reflectbox[x]{M} - reflects by X axis, "M" becomes "W"
 			@example \reflectbox[y]{R} - reflects by Y axis, "R" becomes "Я"
 		*/
-	   static void rastReflect(Latex&, std::string&, Image&, SubFunctionType);
+	   static void rastReflect(Latex&, Tokenizer&, Box&, SubFunctionType);
 
 };
 
@@ -514,7 +595,7 @@ static const Letter greekTable[] =
 	{NULL,           0}
 };
 
-static const SubFunction subfunctions[] = 
+static constexpr SubFunction subfunctions[] = 
 {
 	/* ??? */
 	{"\\frac",      Handlers::rastFrac,    FRAC_NORMAL},
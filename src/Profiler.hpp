@@ -8,6 +8,8 @@
 #include <chrono>
 #include <algorithm>
 #include <fstream>
+#include <thread>
+#include <mutex>
 
 struct ProfileResult
 {
@@ -28,6 +30,7 @@ class Instrumentor
 		InstrumentationSession* m_CurrentSession;
 		std::ofstream m_OutStream;
 		int m_ProfileCount;
+		std::mutex m_Mutex;
 
 	public:
 		Instrumentor() : m_CurrentSession(nullptr), m_ProfileCount(0) { }
@@ -50,6 +53,8 @@ class Instrumentor
 
 		void WriteProfile(const ProfileResult& result)
 		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+
 			if (m_ProfileCount++ > 0)
 				m_OutStream << ",\n\t\t";
 
@@ -122,7 +127,8 @@ class Timer
 			
 			#endif
 
-			Instrumentor::Get().WriteProfile({ m_Name, start, end });
+			uint32_t threadID = std::hash<std::thread::id>{}(std::this_thread::get_id());
+			Instrumentor::Get().WriteProfile({ m_Name, start, end, threadID });
 
 			m_IsStopped = true;
 
@@ -0,0 +1,78 @@
+#include "RenderCache.hpp"
+#include "Profiler.hpp"
+
+RenderCache::RenderCache(size_t capacity): m_Capacity(capacity) { };
+
+RenderCache::Bytes RenderCache::find(const std::string& key)
+{
+	PROFILE_SCOPE("RenderCache::find");
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	auto it = m_Index.find(key);
+
+	if (it == m_Index.end())
+	{
+		m_Misses++;
+		return nullptr;
+	}
+
+	m_Hits++;
+	m_Entries.splice(m_Entries.begin(), m_Entries, it->second);
+
+	return it->second->bytes;
+};
+
+void RenderCache::insert(const std::string& key, Bytes bytes)
+{
+	PROFILE_SCOPE("RenderCache::insert");
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	size_t size = key.size() + bytes->size();
+
+	if (size > m_Capacity || m_Index.count(key) != 0) return;
+
+	shrink(m_Capacity - size);
+
+	m_Entries.push_front({key, std::move(bytes)});
+	m_Index.emplace(key, m_Entries.begin());
+	m_Size += size;
+};
+
+void RenderCache::setCapacity(size_t capacity)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	m_Capacity = capacity;
+	shrink(capacity);
+};
+
+void RenderCache::clear()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	m_Entries.clear();
+	m_Index.clear();
+	m_Size = 0;
+};
+
+CacheStats RenderCache::getStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	return { m_Hits, m_Misses, m_Evictions, m_Entries.size(), m_Size, m_Capacity };
+};
+
+void RenderCache::shrink(size_t capacity)
+{
+	while (m_Size > capacity && !m_Entries.empty())
+	{
+		Entry& last = m_Entries.back();
+
+		m_Size -= last.key.size() + last.bytes->size();
+		m_Index.erase(last.key);
+		m_Entries.pop_back();
+		m_Evictions++;
+	}
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <unordered_map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <list>
+#include <cstdint>
+
+struct CacheStats
+{
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	size_t entries;
+	/* Encoded bytes and keys currently held */
+	size_t bytes;
+	size_t capacity;
+};
+
+/*
+	Least recently used cache of encoded images.
+	Values are shared, so bytes handed out stay valid after entry is evicted.
+*/
+class RenderCache {
+
+	public:
+
+		using Bytes = std::shared_ptr<const std::vector<uint8_t>>;
+
+		/*
+			@brief Constructs cache
+			@param capacity Memory cap in bytes, 0 disables caching
+		*/
+		RenderCache(size_t capacity = 64 * 1024 * 1024);
+
+		/*
+			@brief Looks up encoded image and marks it as recently used
+			@param key Cache key
+			@returns Encoded image or nullptr on miss
+		*/
+		Bytes find(const std::string& key);
+
+		/*
+			@brief Stores encoded image, evicting least recently used ones until it fits.
+			@brief Images bigger than capacity are not stored
+			@param key Cache key
+			@param bytes Encoded image
+		*/
+		void insert(const std::string& key, Bytes bytes);
+
+		/*
+			@brief Sets memory cap, evicting entries that don't fit anymore
+			@param capacity Memory cap in bytes, 0 disables caching
+		*/
+		void setCapacity(size_t capacity);
+
+		/*
+			@brief Removes all entries, counters are kept
+		*/
+		void clear();
+
+		CacheStats getStats();
+
+	private:
+
+		/*
+			@brief Evicts least recently used entries until cache takes no more than capacity
+		*/
+		void shrink(size_t capacity);
+
+	private:
+
+		struct Entry
+		{
+			std::string key;
+			Bytes bytes;
+		};
+
+		/* Most recently used entry first */
+		std::list<Entry> m_Entries;
+
+		std::unordered_map<std::string, std::list<Entry>::iterator> m_Index;
+
+		std::mutex m_Mutex;
+
+		size_t m_Capacity;
+
+		size_t m_Size = 0;
+
+		size_t m_Hits = 0, m_Misses = 0, m_Evictions = 0;
+
+};
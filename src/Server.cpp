@@ -0,0 +1,383 @@
+#include "Server.hpp"
+#include "ThreadPool.hpp"
+
+#if !defined(_WIN32)
+	#include <sys/socket.h>
+	#include <sys/un.h>
+	#include <unistd.h>
+	#include <poll.h>
+	#include <csignal>
+	#include <cerrno>
+#endif
+
+#ifndef MSG_NOSIGNAL
+	#define MSG_NOSIGNAL 0
+#endif
+
+/* How often blocked calls wake up to check if server is stopping, in milliseconds */
+#define SERVER_POLL_INTERVAL 100
+
+Server::Server(const Latex& latex, size_t workers, int timeout): m_Latex(latex), m_Timeout(timeout)
+{
+	m_Workers = workers == 0 ? std::max(1u, std::thread::hardware_concurrency()) : workers;
+};
+
+void Server::stop()
+{
+	m_Stop = true;
+};
+
+RenderCache::Bytes Server::render(const RenderRequest& request, std::string& error) const
+{
+	PROFILE_SCOPE("Server::render");
+
+	RenderCache::Bytes bytes;
+
+	if (request.type < ImageType::PNG || request.type > ImageType::TGA)
+	{
+		error = "unknown image type";
+		return nullptr;
+	}
+
+	try
+	{
+		// size and color are per request, fonts and cache are shared with every other request
+		Latex context(m_Latex);
+		std::string expression = request.expression;
+
+		if (request.size != 0)
+			context.setFontSize(request.size);
+
+		context.setFontColor(request.color);
+
+		bytes = context.render(expression, request.type);
+	}
+	catch (const std::exception& err)
+	{
+		error = err.what();
+		return nullptr;
+	}
+
+	if (bytes->empty())
+	{
+		error = "there's nothing to rasterize";
+		return nullptr;
+	}
+
+	return bytes;
+};
+
+#if defined(_WIN32)
+
+void Server::serve(const char* socketPath)
+{
+	throw std::runtime_error("Server is not supported on this platform.");
+};
+
+void Server::handle(int connection) { };
+
+std::vector<uint8_t> Server::request(const char* socketPath, const RenderRequest& request)
+{
+	throw std::runtime_error("Server is not supported on this platform.");
+};
+
+#else
+
+static void put32(uint8_t* dst, uint32_t value)
+{
+	dst[0] = (uint8_t)(value >> 24);
+	dst[1] = (uint8_t)(value >> 16);
+	dst[2] = (uint8_t)(value >> 8);
+	dst[3] = (uint8_t)value;
+};
+
+static uint32_t get32(const uint8_t* src)
+{
+	return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3];
+};
+
+/*
+	@brief Waits until socket is ready, no longer than until deadline
+	@param stop If set, waiting is abandoned once it becomes true
+	@returns false on timeout, error or stop
+*/
+static bool waitFor(int fd, short events, std::chrono::steady_clock::time_point deadline, const std::atomic<bool>* stop)
+{
+	pollfd poller = {fd, events, 0};
+	long long remaining;
+	int ready;
+
+	while (true)
+	{
+		if (stop != nullptr && *stop) return false;
+
+		remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+
+		if (remaining <= 0) return false;
+
+		ready = poll(&poller, 1, (int)std::min<long long>(remaining, SERVER_POLL_INTERVAL));
+
+		if (ready > 0) return true;
+		if (ready < 0 && errno != EINTR) return false;
+	}
+};
+
+/*
+	@brief Reads exactly size bytes
+	@param stop If set, reading is abandoned when it becomes true before the first byte arrives
+*/
+static bool readFull(int fd, uint8_t* data, size_t size, int timeout, const std::atomic<bool>* stop = nullptr)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+	size_t done = 0;
+	ssize_t count;
+
+	while (done < size)
+	{
+		if (!waitFor(fd, POLLIN, deadline, done == 0 ? stop : nullptr))
+			return false;
+
+		count = recv(fd, data + done, size - done, 0);
+
+		if (count == 0) return false;
+		if (count < 0 && errno != EINTR && errno != EAGAIN) return false;
+		if (count > 0) done += count;
+	}
+
+	return true;
+};
+
+static bool writeFull(int fd, const uint8_t* data, size_t size, int timeout)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+	size_t done = 0;
+	ssize_t count;
+
+	while (done < size)
+	{
+		if (!waitFor(fd, POLLOUT, deadline, nullptr))
+			return false;
+
+		count = send(fd, data + done, size - done, MSG_NOSIGNAL);
+
+		if (count < 0 && errno != EINTR && errno != EAGAIN) return false;
+		if (count > 0) done += count;
+	}
+
+	return true;
+};
+
+/*
+	@brief Reads length-prefixed frame
+	@returns false on timeout, disconnect or frame bigger than SERVER_MAX_FRAME
+*/
+static bool readFrame(int fd, std::vector<uint8_t>& body, int timeout, const std::atomic<bool>* stop = nullptr)
+{
+	uint8_t header[4];
+	uint32_t length;
+
+	if (!readFull(fd, header, 4, timeout, stop)) return false;
+
+	length = get32(header);
+
+	if (length > SERVER_MAX_FRAME) return false;
+
+	body.resize(length);
+
+	return readFull(fd, body.data(), length, timeout);
+};
+
+/*
+	@brief Writes length-prefixed frame, body is preceded by a byte of status
+*/
+static bool writeFrame(int fd, uint8_t status, const uint8_t* data, size_t size, int timeout)
+{
+	uint8_t header[5];
+
+	put32(header, (uint32_t)(size + 1));
+	header[4] = status;
+
+	return writeFull(fd, header, 5, timeout) && writeFull(fd, data, size, timeout);
+};
+
+static bool writeError(int fd, const std::string& message, int timeout)
+{
+	return writeFrame(fd, 1, (const uint8_t*)message.data(), message.size(), timeout);
+};
+
+static sockaddr_un socketAddress(const char* socketPath)
+{
+	sockaddr_un address = {};
+
+	if (strlen(socketPath) >= sizeof(address.sun_path))
+		throw std::runtime_error(std::string("Socket path is too long: ") + socketPath);
+
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath);
+
+	return address;
+};
+
+void Server::serve(const char* socketPath)
+{
+	PROFILE_SCOPE("Server::serve");
+
+	sockaddr_un address = socketAddress(socketPath);
+	int listener, connection;
+	pollfd poller;
+
+	#ifdef SIGPIPE
+		signal(SIGPIPE, SIG_IGN);
+	#endif
+
+	if ((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		throw std::runtime_error("Could not create socket.");
+
+	unlink(socketPath);
+
+	if (bind(listener, (sockaddr*)&address, sizeof(address)) < 0 || listen(listener, 64) < 0)
+	{
+		close(listener);
+		throw std::runtime_error(std::string("Could not listen on ") + socketPath);
+	}
+
+	{
+		ThreadPool pool(m_Workers);
+		TaskGroup group(&pool);
+
+		while (!m_Stop)
+		{
+			poller = {listener, POLLIN, 0};
+
+			if (poll(&poller, 1, SERVER_POLL_INTERVAL) <= 0) continue;
+
+			if ((connection = accept(listener, NULL, NULL)) < 0) continue;
+
+			// connections beyond what workers can pick up soon are turned away instead of piling up
+			if (m_Connections >= m_Workers * 4)
+			{
+				writeError(connection, "server is busy", m_Timeout);
+				close(connection);
+				continue;
+			}
+
+			m_Connections++;
+
+			group.run([this, connection]()
+			{
+				// connection is closed and released even if handling it throws
+				struct Release
+				{
+					Server& server;
+					int connection;
+
+					~Release()
+					{
+						close(connection);
+						server.m_Connections--;
+					}
+				} release {*this, connection};
+
+				handle(connection);
+			});
+		}
+
+		// no new connections, requests in flight are finished
+		close(listener);
+		unlink(socketPath);
+
+		group.wait();
+	}
+
+	#ifdef DEBUG
+		printf("[Server::serve] stopped\n");
+	#endif
+};
+
+void Server::handle(int connection)
+{
+	PROFILE_SCOPE("Server::handle");
+
+	std::vector<uint8_t> body;
+	RenderRequest request;
+	RenderCache::Bytes bytes;
+	std::string error;
+
+	// idle connections are closed after timeout, so they don't hold workers
+	while (!m_Stop && readFrame(connection, body, m_Timeout, &m_Stop))
+	{
+		if (body.size() < 7)
+		{
+			writeError(connection, "malformed request", m_Timeout);
+			return;
+		}
+
+		// type byte is checked before the cast, values outside of ImageType aren't valid enum values
+		if (body[6] > ImageType::TGA)
+		{
+			if (!writeError(connection, "unknown image type", m_Timeout))
+				return;
+			continue;
+		}
+
+		request.size = (uint16_t)((body[0] << 8) | body[1]);
+		request.color = {body[2], body[3], body[4], body[5]};
+		request.type = (ImageType)body[6];
+		request.expression.assign(body.begin() + 7, body.end());
+
+		if ((bytes = render(request, error)) != nullptr)
+		{
+			if (!writeFrame(connection, 0, bytes->data(), bytes->size(), m_Timeout))
+				return;
+		}
+		else if (!writeError(connection, error, m_Timeout))
+			return;
+	}
+};
+
+std::vector<uint8_t> Server::request(const char* socketPath, const RenderRequest& request)
+{
+	PROFILE_SCOPE("Server::request");
+
+	const int timeout = 60000;
+	sockaddr_un address = socketAddress(socketPath);
+	std::vector<uint8_t> frame(11 + request.expression.size());
+	std::vector<uint8_t> body;
+	int connection;
+	bool ok;
+
+	put32(&frame[0], (uint32_t)(frame.size() - 4));
+	frame[4] = (uint8_t)(request.size >> 8);
+	frame[5] = (uint8_t)request.size;
+	frame[6] = request.color.r;
+	frame[7] = request.color.g;
+	frame[8] = request.color.b;
+	frame[9] = request.color.a;
+	frame[10] = (uint8_t)request.type;
+	memcpy(&frame[11], request.expression.data(), request.expression.size());
+
+	if ((connection = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		throw std::runtime_error("Could not create socket.");
+
+	if (connect(connection, (sockaddr*)&address, sizeof(address)) < 0)
+	{
+		close(connection);
+		throw std::runtime_error(std::string("Could not connect to ") + socketPath);
+	}
+
+	ok = writeFull(connection, frame.data(), frame.size(), timeout) && readFrame(connection, body, timeout);
+
+	close(connection);
+
+	if (!ok || body.empty())
+		throw std::runtime_error("Server closed connection.");
+
+	if (body[0] != 0)
+		throw std::runtime_error(std::string(body.begin() + 1, body.end()));
+
+	body.erase(body.begin());
+
+	return body;
+};
+
+#endif
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Latex.hpp"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+/*
+	Framed protocol over a Unix domain socket, any number of requests per connection.
+	All integers are big-endian.
+
+	Request:  uint32 length of the rest | uint16 font size (0 - server default) | uint32 color 0xRRGGBBAA
+	          | uint8 ImageType | expression
+	Response: uint32 length of the rest | uint8 status (0 - ok, 1 - error) | encoded image or error message
+*/
+
+/* Biggest request or response body accepted */
+#define SERVER_MAX_FRAME (16 * 1024 * 1024)
+
+struct RenderRequest
+{
+	std::string expression;
+	/* Font size, 0 - server default */
+	uint16_t size = 0;
+	Color color {255, 255, 255, 255};
+	ImageType type = ImageType::PNG;
+};
+
+class Server {
+
+	public:
+
+		/*
+			@brief Constructs server, fonts and render cache of latex stay warm between requests
+			@param latex Configured Latex instance, it is copied
+			@param workers Number of connections handled at the same time, 0 - one per hardware thread
+			@param timeout Milliseconds a client may take to send a request (and to read the response)
+		*/
+		Server(const Latex& latex, size_t workers = 0, int timeout = 5000);
+
+		Server(const Server&) = delete;
+
+		/*
+			@brief Listens on socket until stop() is called, then finishes requests in flight and removes socket file
+			@param socketPath Path of the socket file, existing file is replaced
+		*/
+		void serve(const char* socketPath);
+
+		/*
+			@brief Asks serve() to return. Safe to call from signal handler
+		*/
+		void stop();
+
+		/*
+			@brief Sends request to the server and waits for response
+			@param socketPath Path of the server socket
+			@param request Render request
+			@returns Encoded image
+		*/
+		static std::vector<uint8_t> request(const char* socketPath, const RenderRequest& request);
+
+		void operator=(const Server&) = delete;
+
+	private:
+
+		/*
+			@brief Reads requests from connection and writes responses until client disconnects,
+			@brief times out, sends malformed frame or server stops
+		*/
+		void handle(int connection);
+
+		/*
+			@brief Renders request
+			@param error Set to error message on failure
+			@returns Encoded image, or nullptr on failure
+		*/
+		RenderCache::Bytes render(const RenderRequest& request, std::string& error) const;
+
+	private:
+
+		Latex m_Latex;
+
+		size_t m_Workers;
+
+		int m_Timeout;
+
+		std::atomic<bool> m_Stop {false};
+
+		std::atomic<size_t> m_Connections {0};
+
+};
@@ -0,0 +1,93 @@
+#include "Session.hpp"
+
+/* Subtrees smaller than this (in pixels) are cheaper to draw again than to keep */
+#define SESSION_MIN_AREA 64
+
+Session::Session(const Latex& latex): m_Latex(latex) { };
+
+Image Session::update(std::string expression)
+{
+	PROFILE_SCOPE("Session::update");
+
+	Bitmaps bitmaps;
+	Box tree;
+
+	m_Stats = {0, 0};
+
+	if (expression.length() == 0)
+		throw std::runtime_error("There's nothing to rasterize.");
+
+	m_Latex.prepExpression(expression);
+
+	// parse and layout only read glyph metrics, so they are redone in full
+	Latex context(m_Latex);
+	tree = context.parse(expression);
+	tree.layout();
+
+	if (tree.isEmpty())
+	{
+		m_Bitmaps.clear();
+		return Image();
+	}
+
+	tree.hashTree();
+
+	for (Box& child : tree.m_Children)
+		prepare(child, bitmaps);
+
+	// bitmaps that are not part of this render won't be needed for the next one either
+	m_Bitmaps = std::move(bitmaps);
+
+	Image canvas(std::max(1, tree.m_Width), std::max(1, tree.m_Height), 4);
+	canvas.m_Baseline = tree.m_Baseline;
+	canvas.m_AdvanceHeight = tree.m_AdvanceHeight;
+
+	tree.draw(canvas, 0, 0);
+
+	return canvas;
+};
+
+void Session::prepare(Box& box, Bitmaps& bitmaps)
+{
+	// glyphs are kept too, so text between groups isn't rasterized on every update
+	if ((box.m_Type != BOX_GLYPH && box.m_Children.empty()) || box.isEmpty())
+		return;
+
+	if (box.m_Width * box.m_Height < SESSION_MIN_AREA)
+	{
+		for (Box& child : box.m_Children)
+			prepare(child, bitmaps);
+		return;
+	}
+
+	auto found = m_Bitmaps.find(box.m_Hash);
+
+	if (found != m_Bitmaps.end() || (found = bitmaps.find(box.m_Hash)) != bitmaps.end())
+	{
+		box.m_Bitmap = found->second;
+		bitmaps[box.m_Hash] = found->second;
+		m_Stats.reused++;
+		return;
+	}
+
+	// changed subtree, unchanged parts of it are still reused
+	for (Box& child : box.m_Children)
+		prepare(child, bitmaps);
+
+	std::shared_ptr<Image> bitmap = std::make_shared<Image>(std::max(1, box.m_Width + box.m_Overhang), std::max(1, box.m_Height), 4);
+	box.draw(*bitmap, box.m_Overhang, 0);
+
+	box.m_Bitmap = bitmap;
+	bitmaps[box.m_Hash] = bitmap;
+	m_Stats.drawn++;
+};
+
+SessionStats Session::getStats() const
+{
+	return m_Stats;
+};
+
+void Session::clear()
+{
+	m_Bitmaps.clear();
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Latex.hpp"
+
+#include <unordered_map>
+
+struct SessionStats
+{
+	/* Subtrees taken from the previous render */
+	size_t reused;
+	/* Subtrees rasterized by the last update */
+	size_t drawn;
+};
+
+/*
+	Live preview session: renders one expression after another (i.e. on every keystroke),
+	keeping bitmaps of subtrees (fraction operands, scripts, groups) from the previous render.
+	Only subtrees that changed and their ancestors are rasterized again.
+*/
+class Session {
+
+	public:
+
+		/*
+			@brief Constructs session
+			@param latex Configured Latex instance, it is copied
+		*/
+		Session(const Latex& latex);
+
+		/*
+			@brief Renders expression, reusing unchanged parts of the previous one
+			@param expression Math expression
+			@returns Rasterized image, empty if there's nothing to rasterize
+		*/
+		Image update(std::string expression);
+
+		/*
+			@brief Get reuse counters of the last update
+		*/
+		SessionStats getStats() const;
+
+		/*
+			@brief Forgets previous render
+		*/
+		void clear();
+
+	private:
+
+		using Bitmaps = std::unordered_map<size_t, std::shared_ptr<const Image>>;
+
+		/*
+			@brief Gives every composite subtree a bitmap, either from the previous render or newly rasterized one
+			@param bitmaps Bitmaps of the current render
+		*/
+		void prepare(Box& box, Bitmaps& bitmaps);
+
+	private:
+
+		Latex m_Latex;
+
+		/* Bitmaps of the previous render by subtree hash */
+		Bitmaps m_Bitmaps;
+
+		SessionStats m_Stats = {0, 0};
+
+};
@@ -0,0 +1,196 @@
+#include "ThreadPool.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+
+/* Pool and queue of the worker running on this thread, nullptr for threads outside of pools */
+static thread_local const ThreadPool* s_WorkerPool = nullptr;
+static thread_local size_t s_WorkerIndex = 0;
+
+ThreadPool::ThreadPool(size_t threads)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (size_t i = 0; i < threads; ++i)
+		m_Queues.push_back(std::make_unique<Queue>());
+
+	for (size_t i = 0; i < threads; ++i)
+		m_Threads.emplace_back(&ThreadPool::work, this, i);
+};
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stop = true;
+	}
+
+	m_Condition.notify_all();
+
+	for (std::thread& thread : m_Threads)
+		thread.join();
+};
+
+void ThreadPool::submit(std::function<void()> task)
+{
+	// workers keep their own tasks, other threads spread them around
+	size_t index = s_WorkerPool == this ? s_WorkerIndex : m_Next++ % m_Queues.size();
+
+	// counted before it is queued, thread that takes it right away mustn't see the count go below zero
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Pending++;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Queues[index]->mutex);
+		m_Queues[index]->tasks.push_back(std::move(task));
+	}
+
+	m_Condition.notify_one();
+};
+
+size_t ThreadPool::size() const
+{
+	return m_Threads.size();
+};
+
+bool ThreadPool::take(size_t index, std::function<void()>& task)
+{
+	if (m_Pending == 0) return false;
+
+	for (size_t i = 0; i < m_Queues.size(); ++i)
+	{
+		Queue& queue = *m_Queues[(index + i) % m_Queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		if (queue.tasks.empty()) continue;
+
+		if (i == 0) // own queue, newest task
+		{
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		else // steal oldest task, it is usually the biggest one
+		{
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+
+		m_Pending--;
+		return true;
+	}
+
+	return false;
+};
+
+void ThreadPool::work(size_t index)
+{
+	std::function<void()> task;
+
+	s_WorkerPool = this;
+	s_WorkerIndex = index;
+
+	while (true)
+	{
+		if (take(index, task))
+		{
+			task();
+			task = nullptr;
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Condition.wait(lock, [this]() { return m_Stop || m_Pending > 0; });
+
+		if (m_Stop && m_Pending == 0)
+			return;
+	}
+};
+
+TaskGroup::TaskGroup(ThreadPool* pool): p_Pool(pool), m_State(std::make_shared<State>()) { };
+
+TaskGroup::~TaskGroup()
+{
+	try { wait(); } catch (...) { }
+};
+
+void TaskGroup::run(std::function<void()> task)
+{
+	if (p_Pool == nullptr)
+	{
+		task();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_State->mutex);
+		m_State->tasks.push_back(std::move(task));
+		m_State->running++;
+	}
+
+	// waiting thread may pick it up itself, tasks running on other threads add subtasks too
+	m_State->done.notify_all();
+
+	// pool task runs whichever task of the group is next, nothing if waiting thread has run them all already
+	p_Pool->submit([state = m_State]() { runNext(*state); });
+};
+
+bool TaskGroup::runNext(State& state)
+{
+	std::function<void()> task;
+
+	{
+		std::lock_guard<std::mutex> lock(state.mutex);
+
+		if (state.tasks.empty()) return false;
+
+		task = std::move(state.tasks.front());
+		state.tasks.pop_front();
+	}
+
+	try
+	{
+		task();
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(state.mutex);
+		if (!state.error) state.error = std::current_exception();
+	}
+
+	std::lock_guard<std::mutex> lock(state.mutex);
+	if (--state.running == 0)
+		state.done.notify_all();
+
+	return true;
+};
+
+void TaskGroup::wait()
+{
+	PROFILE_SCOPE("TaskGroup::wait");
+
+	while (true)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_State->mutex);
+			if (m_State->running == 0) break;
+		}
+
+		if (runNext(*m_State)) continue;
+
+		// remaining tasks are running on other threads, woken when they are done or add tasks to the group
+		std::unique_lock<std::mutex> lock(m_State->mutex);
+		m_State->done.wait(lock, [this]() { return m_State->running == 0 || !m_State->tasks.empty(); });
+	}
+
+	std::lock_guard<std::mutex> lock(m_State->mutex);
+
+	if (m_State->error)
+	{
+		std::exception_ptr error = m_State->error;
+		m_State->error = nullptr;
+		std::rethrow_exception(error);
+	}
+};
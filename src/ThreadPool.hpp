@@ -0,0 +1,140 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <deque>
+#include <mutex>
+
+/*
+	Work-stealing thread pool.
+
+	Every worker has its own queue: tasks submitted from a worker go to the back of its queue
+	and are taken from the back (newest first), idle workers steal from the front of other queues.
+	Threads waiting for a task group run queued tasks of that group instead of blocking, so groups can be nested.
+*/
+class ThreadPool {
+
+	public:
+
+		/*
+			@brief Starts worker threads
+			@param threads Number of workers, 0 - one per hardware thread
+		*/
+		ThreadPool(size_t threads = 0);
+
+		ThreadPool(const ThreadPool&) = delete;
+
+		/*
+			@brief Finishes queued tasks and joins workers
+		*/
+		~ThreadPool();
+
+		/*
+			@brief Queues task
+		*/
+		void submit(std::function<void()> task);
+
+		/*
+			@brief Get number of workers
+		*/
+		size_t size() const;
+
+		void operator=(const ThreadPool&) = delete;
+
+	private:
+
+		struct Queue
+		{
+			std::mutex mutex;
+			std::deque<std::function<void()>> tasks;
+		};
+
+		/*
+			@brief Takes task from own queue, or steals one from other queues
+			@param index Queue to start from
+		*/
+		bool take(size_t index, std::function<void()>& task);
+
+		void work(size_t index);
+
+	private:
+
+		std::vector<std::unique_ptr<Queue>> m_Queues;
+
+		std::vector<std::thread> m_Threads;
+
+		std::mutex m_Mutex;
+
+		std::condition_variable m_Condition;
+
+		std::atomic<size_t> m_Pending {0};
+
+		std::atomic<size_t> m_Next {0};
+
+		bool m_Stop = false;
+
+};
+
+/*
+	Set of tasks that are waited for together
+*/
+class TaskGroup {
+
+	public:
+
+		/*
+			@param pool Pool to run tasks on, nullptr - run tasks on the calling thread right away
+		*/
+		TaskGroup(ThreadPool* pool);
+
+		/*
+			@brief Waits for tasks that are still running
+		*/
+		~TaskGroup();
+
+		/*
+			@brief Queues task of the group
+		*/
+		void run(std::function<void()> task);
+
+		/*
+			@brief Waits until all tasks of the group are done, running its queued tasks meanwhile.
+			@brief Rethrows first exception thrown by a task
+		*/
+		void wait();
+
+	private:
+
+		/*
+			Tasks of the group, shared with pool tasks that may outlive the group
+		*/
+		struct State
+		{
+			std::mutex mutex;
+			/* Notified when all tasks are done or a task is queued */
+			std::condition_variable done;
+			/* Tasks no thread has started yet */
+			std::deque<std::function<void()>> tasks;
+			/* Queued and running tasks */
+			size_t running = 0;
+			std::exception_ptr error;
+		};
+
+		/*
+			@brief Runs the oldest task of the group no thread has started yet
+			@returns false if there was none
+		*/
+		static bool runNext(State& state);
+
+	private:
+
+		ThreadPool* p_Pool;
+
+		std::shared_ptr<State> m_State;
+
+};
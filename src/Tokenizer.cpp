@@ -0,0 +1,137 @@
+#include "Tokenizer.hpp"
+#include "Latex.hpp"
+
+Tokenizer::Tokenizer(std::string_view expression): m_Expression(expression), m_Cursor(0) { };
+
+Token Tokenizer::next()
+{
+	size_t length;
+	Token token = tokenAt(m_Cursor, length);
+
+	m_Cursor += length;
+
+	return token;
+};
+
+Token Tokenizer::peek() const
+{
+	size_t length;
+	return tokenAt(m_Cursor, length);
+};
+
+char Tokenizer::peekChar() const
+{
+	return m_Cursor < m_Expression.length() ? m_Expression[m_Cursor] : '\0';
+};
+
+void Tokenizer::skip(size_t count)
+{
+	m_Cursor = std::min(m_Cursor + count, m_Expression.length());
+};
+
+bool Tokenizer::atEnd() const
+{
+	return m_Cursor >= m_Expression.length();
+};
+
+std::string_view Tokenizer::getSubExpression(char left, char right)
+{
+	PROFILE_SCOPE("Tokenizer::getSubExpression");
+
+	size_t last;
+	std::string_view result;
+
+	if (atEnd()) return result;
+
+	if (m_Expression[m_Cursor] != left) // if expression not starts from left delimeter
+	{
+		result = m_Expression.substr(m_Cursor, 1);
+		m_Cursor++;
+		return result; //just return first char
+	}
+
+	last = findClosing(m_Cursor, left, right);
+	result = m_Expression.substr(m_Cursor + 1, last - m_Cursor - 1);
+	m_Cursor = std::min(last + 1, m_Expression.length());
+
+	return result;
+};
+
+std::string_view Tokenizer::rest()
+{
+	std::string_view result = m_Expression.substr(std::min(m_Cursor, m_Expression.length()));
+	m_Cursor = m_Expression.length();
+	return result;
+};
+
+size_t Tokenizer::position() const
+{
+	return m_Cursor;
+};
+
+std::string_view Tokenizer::expression() const
+{
+	return m_Expression;
+};
+
+Token Tokenizer::tokenAt(size_t at, size_t& length) const
+{
+	const SubFunction* subFunction;
+	size_t last;
+
+	length = 0;
+
+	if (at >= m_Expression.length())
+		return {TOKEN_END, {}, nullptr};
+
+	switch (m_Expression[at])
+	{
+		case '_':
+		case '^':
+			length = 1;
+			return {TOKEN_SCRIPT, m_Expression.substr(at, 1), nullptr};
+		case '{':
+			last = findClosing(at, '{', '}');
+			length = std::min(last + 1, m_Expression.length()) - at;
+			return {TOKEN_GROUP, m_Expression.substr(at + 1, last - at - 1), nullptr};
+		case '\\':
+			if ((subFunction = Latex::getSubFunction(m_Expression, at)) != nullptr)
+			{
+				length = strlen(subFunction->expression);
+				return {TOKEN_COMMAND, m_Expression.substr(at, length), subFunction};
+			}
+
+			//unknown subfunction, skip its name
+			length = 1;
+			while (at + length < m_Expression.length() && isalpha(m_Expression[at + length]))
+				length++;
+			if (length == 1 && at + length < m_Expression.length())
+				length++;
+
+			return {TOKEN_COMMAND, m_Expression.substr(at, length), nullptr};
+		default:
+			length = 1;
+			return {TOKEN_LITERAL, m_Expression.substr(at, 1), nullptr};
+	}
+};
+
+size_t Tokenizer::findClosing(size_t at, char left, char right) const
+{
+	size_t depth = 0;
+
+	for (size_t i = at; i < m_Expression.length(); ++i)
+	{
+		if (m_Expression[i] == '\\') //escaped delimeters don't count
+		{
+			i++;
+			continue;
+		}
+
+		if (m_Expression[i] == left)
+			depth++;
+		else if (m_Expression[i] == right && --depth == 0)
+			return i;
+	}
+
+	return m_Expression.length();
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <string_view>
+#include <cstddef>
+
+struct SubFunction;
+
+enum TokenType { TOKEN_END, TOKEN_COMMAND, TOKEN_GROUP, TOKEN_SCRIPT, TOKEN_LITERAL };
+
+struct Token
+{
+	TokenType type;
+	/* Command name (with backslash), group contents (without braces), script marker or literal char */
+	std::string_view text;
+	/* Matched subfunction for TOKEN_COMMAND, nullptr for unknown commands and other token types */
+	const SubFunction* subFunction;
+};
+
+class Tokenizer {
+
+	public:
+
+		/*
+			@brief Constructs tokenizer over an expression. Expression is not copied and must outlive tokenizer
+			@param expression Math expression
+		*/
+		Tokenizer(std::string_view expression);
+
+		/*
+			@brief Reads next token and moves cursor past it
+			@returns Token, or token with TOKEN_END type if there's nothing left
+		*/
+		Token next();
+
+		/*
+			@brief Reads next token without moving cursor
+		*/
+		Token peek() const;
+
+		/*
+			@brief Returns char under cursor or '\0' if there's nothing left
+		*/
+		char peekChar() const;
+
+		/*
+			@brief Moves cursor by given amount of chars
+		*/
+		void skip(size_t count = 1);
+
+		/*
+			@brief Check if all expression is consumed
+		*/
+		bool atEnd() const;
+
+		/*
+			@brief Scans for subexpression between delimeters starting from cursor
+			@param left Delimeter that begin subexpression
+			@param right Delimeter that end subexpression
+			@returns Everything between left and right delimeters, or next char if cursor isn't on left delimeter
+		*/
+		std::string_view getSubExpression(char left, char right);
+
+		/*
+			@brief Consumes everything after cursor
+			@returns Rest of the expression
+		*/
+		std::string_view rest();
+
+		/*
+			@brief Get cursor position
+		*/
+		size_t position() const;
+
+		/*
+			@brief Get whole expression tokenizer is working on
+		*/
+		std::string_view expression() const;
+
+	private:
+
+		/*
+			@brief Reads token at position without moving cursor
+			@param at Position of the token
+			@param length Length of the token in expression, including braces
+		*/
+		Token tokenAt(size_t at, size_t& length) const;
+
+		/*
+			@brief Finds index of right delimeter that closes left delimeter at position
+			@returns Index of right delimeter or length of expression if it is not closed
+		*/
+		size_t findClosing(size_t at, char left, char right) const;
+
+	private:
+
+		std::string_view m_Expression;
+
+		size_t m_Cursor;
+
+};
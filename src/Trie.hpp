@@ -0,0 +1,171 @@
+#pragma once
+
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+/*
+	Prefix tree over a NULL-terminated table of structs with `expression` field
+	(i.e. subfunctions[]), built at compile time.
+
+	Children of every node are stored next to each other and sorted by label,
+	so lookup walks the expression once and stops at the first char that leads nowhere.
+*/
+
+struct TrieNode
+{
+	/* Char on the edge from the parent */
+	char label;
+	/* Number of children */
+	uint8_t childCount;
+	/* Index of the first child */
+	uint16_t firstChild;
+	/* Index of table entry which expression ends on this node, -1 if none */
+	int16_t entry;
+};
+
+template <size_t Nodes>
+struct Trie
+{
+	TrieNode nodes[Nodes];
+
+	/*
+		@brief Finds longest table expression that starts at position
+		@param expression Expression to search in
+		@param at Position of the first char
+		@returns Index of table entry, or -1 if nothing matches
+	*/
+	constexpr int find(std::string_view expression, size_t at) const
+	{
+		int match = -1;
+		size_t node = 0, child, last;
+
+		for (size_t i = at; i < expression.length(); ++i)
+		{
+			child = nodes[node].firstChild;
+			last = child + nodes[node].childCount;
+
+			while (child < last && (unsigned char)nodes[child].label < (unsigned char)expression[i])
+				child++;
+
+			if (child == last || nodes[child].label != expression[i])
+				break;
+
+			node = child;
+
+			if (nodes[node].entry >= 0)
+				match = nodes[node].entry;
+		}
+
+		return match;
+	};
+};
+
+namespace TrieBuilder
+{
+	constexpr size_t length(const char* str)
+	{
+		size_t i = 0;
+		while (str[i] != '\0') i++;
+		return i;
+	};
+
+	constexpr int compare(const char* a, const char* b)
+	{
+		while (*a != '\0' && *a == *b) { a++; b++; }
+		return (unsigned char)*a - (unsigned char)*b;
+	};
+
+	/* Indexes of table entries sorted by expression, equal expressions keep table order */
+	template <typename T, size_t N>
+	constexpr void sort(const T (&table)[N], size_t (&order)[N], size_t& count)
+	{
+		size_t key, j;
+
+		for (count = 0; count < N && table[count].expression != NULL; ++count)
+		{
+			key = count;
+
+			for (j = count; j > 0 && compare(table[order[j - 1]].expression, table[key].expression) > 0; --j)
+				order[j] = order[j - 1];
+
+			order[j] = key;
+		}
+	};
+
+	/*
+		@brief Counts trie nodes needed for table, that is 1 (root) + number of distinct prefixes
+	*/
+	template <typename T, size_t N>
+	constexpr size_t countNodes(const T (&table)[N])
+	{
+		size_t order[N] = {}, count, nodes = 1, common;
+		const char *prev, *curr;
+
+		sort(table, order, count);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			curr = table[order[i]].expression;
+			common = 0;
+
+			if (i > 0)
+			{
+				prev = table[order[i - 1]].expression;
+				while (prev[common] != '\0' && prev[common] == curr[common])
+					common++;
+			}
+
+			nodes += length(curr) - common;
+		}
+
+		return nodes;
+	};
+
+	/*
+		@brief Builds trie breadth first, so children of each node take contiguous range
+	*/
+	template <size_t Nodes, typename T, size_t N>
+	constexpr Trie<Nodes> build(const T (&table)[N])
+	{
+		struct Range { size_t lo, hi, depth; };
+
+		Trie<Nodes> trie = {};
+		Range ranges[Nodes] = {};
+		size_t order[N] = {}, count, used = 1, lo, hi, depth, start;
+		char label;
+
+		sort(table, order, count);
+
+		trie.nodes[0] = {'\0', 0, 0, -1};
+		ranges[0] = {0, count, 0};
+
+		for (size_t node = 0; node < used; ++node)
+		{
+			lo = ranges[node].lo;
+			hi = ranges[node].hi;
+			depth = ranges[node].depth;
+
+			// expressions that end here, first one in the table wins
+			for (; lo < hi && table[order[lo]].expression[depth] == '\0'; ++lo)
+				if (trie.nodes[node].entry < 0)
+					trie.nodes[node].entry = (int16_t)order[lo];
+
+			trie.nodes[node].firstChild = (uint16_t)used;
+
+			while (lo < hi)
+			{
+				label = table[order[lo]].expression[depth];
+
+				for (start = lo; lo < hi && table[order[lo]].expression[depth] == label; ++lo);
+
+				trie.nodes[used] = {label, 0, 0, -1};
+				ranges[used] = {start, lo, depth + 1};
+				trie.nodes[node].childCount++;
+				used++;
+			}
+		}
+
+		return trie;
+	};
+};
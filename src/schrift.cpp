@@ -1,6 +1,15 @@
 /* See LICENSE file for copyright and license details. */
 #include "schrift.h"
 
+#include <algorithm>
+#include <atomic>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+	#include <immintrin.h>
+	/* post_process() has SSE2 and AVX2 kernels, AVX2 one is picked at runtime if CPU supports it */
+	#define SFT_SIMD 1
+#endif
+
 #define SCHRIFT_VERSION "0.8.0~0.10.2"
 
 #define FILE_MAGIC_ONE             0x00010000
@@ -29,16 +38,30 @@
 
 /* macros */
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define SIGN(x) ((x) >= 0 ? 1 : -1)
-/* Allocate values on the stack if they are small enough, else spill to heap. */
+/* Allocate values on the stack if they are small enough, else spill to scratch arena of rasterize(). */
 #define STACK_ALLOC(var, type, thresh, count) \
 	type var##_stack_[thresh]; \
-	var = (count) <= (thresh) ? var##_stack_ : (type*)calloc(sizeof(type), count);
+	var = (count) <= (thresh) ? var##_stack_ : (type*)arena_calloc(&scratch, count, sizeof(type));
 #define STACK_FREE(var) \
-	if (var != var##_stack_) free(var);
+	(void) var;
+
+/* Scratch allocations are aligned to this */
+#define ARENA_ALIGN 16
+/* Arena keeps at most this much memory between glyphs, bigger glyphs spill to heap every time */
+#define ARENA_LIMIT ((size_t)8 << 20)
+/* Rasterized curves stay within RENDER_FLATNESS pixels of their lines up to RENDER_FLATNESS_SIZE pixels per em.
+ * Above that the bound shrinks with the fourth root of the size, down to RENDER_FLATNESS_MIN */
+#define RENDER_FLATNESS 0.24
+#define RENDER_FLATNESS_SIZE 32.0
+#define RENDER_FLATNESS_MIN 0.155
 
 enum { SrcMapping, SrcUser };
 
+/* SFT_UMetrics states, from the stage reading failed at */
+enum { MetricsNoHmtx, MetricsNoOutline, MetricsEmpty, MetricsBadBox, MetricsOk };
+
 /* structs */
 struct Point 
 { 
@@ -55,11 +78,6 @@ struct Curve
 	uint_least16_t beg, end, ctrl; 
 };
 
-struct Cell
-{ 
-	double area, cover; 
-};
-
 struct Outline
 {
 	Point *points;
@@ -73,15 +91,36 @@ struct Outline
 	uint_least16_t capLines;
 };
 
+/* Point where a line of the outline crosses a row of distance field */
+struct Crossing
+{
+	double x;
+	int dir;
+};
+
+/* Accumulation buffer, separate planes so rows are integrated with SIMD. Row y starts at y * width */
 struct Buffer
 {
-	Cell** rows;
+	float *area, *cover;
 	int width, height;
 };
 
+/* Bump allocator for scratch memory of rasterize(), one per thread. It's reset before every glyph
+ * and keeps its memory, so once it has grown to fit the glyphs being rendered, they are rendered
+ * without touching the heap. */
+struct Arena
+{
+	uint8_t *memory;
+	size_t size, used;
+	/* Allocations that didn't fit into memory, chained through their first bytes. Memory grows to fit them on reset */
+	void *spill;
+	size_t spillBytes;
+
+	~Arena();
+};
+
 /* function declarations */
 /* generic utility functions */
-void *reallocarray(void *optr, size_t nmemb, size_t size);
 static inline int fast_floor(double x);
 static inline int fast_ceil(double x);
 /* file loading */
@@ -92,10 +131,12 @@ static int  init_font(SFT_Font *font);
 static Point midpoint(Point a, Point b);
 static void transform_points(int numPts, Point *points, double trf[6]);
 static void clip_points(int numPts, Point *points, int width, int height);
+/* scratch memory */
+static void *arena_alloc(Arena *arena, size_t size);
+static void *arena_calloc(Arena *arena, size_t count, size_t size);
+static void arena_reset(Arena *arena);
 /* 'buffer' data structure management */
 static int  init_buffer(Buffer *buf, int width, int height);
-static void free_buffer(Buffer *buf);
-static void flip_buffer(Buffer *buf);
 /* 'outline' data structure management */
 static int  init_outline(Outline *outl);
 static void free_outline(Outline *outl);
@@ -114,13 +155,25 @@ static inline uint16_t getu16(SFT_Font *font, unsigned long offset);
 static inline int16_t  geti16(SFT_Font *font, unsigned long offset);
 static inline uint32_t getu32(SFT_Font *font, unsigned long offset);
 static int gettable(SFT_Font *font, const char tag[4], uint_fast32_t *offset);
+static uint_least32_t table_offset(SFT_Font *font, const char tag[4]);
 /* codePoint -> glyph */
 static int cmap_fmt4(SFT_Font *font, uint_fast32_t table, unsigned long charCode, SFT_Glyph *glyph);
 static int cmap_fmt6(SFT_Font *font, uint_fast32_t table, unsigned long charCode, SFT_Glyph *glyph);
+static int cmap_table(SFT_Font *font, uint_fast32_t *table, int *format);
 static int glyph_id(SFT_Font *font, unsigned long charCode, SFT_Glyph *glyph);
+static SFT_Glyph cmap_groups(SFT_Font *font, unsigned long charCode);
+static int decode_fmt4(SFT_Font *font, uint_fast32_t table, uint_least16_t *glyphs);
+static int decode_fmt12(SFT_Font *font, uint_fast32_t table, uint_least16_t *glyphs);
+static void init_cmap(SFT_Font *font);
 /* glyph -> hmtx */
 static int hor_metrics(SFT_Font *font, SFT_Glyph glyph, int *advanceWidth, int *leftSideBearing);
-static int glyph_bbox(const SFT *sft, uint_fast32_t outline, int box[4]);
+static void read_umetrics(SFT_Font *font, SFT_Glyph glyph, SFT_UMetrics *umetrics);
+static void glyph_umetrics(SFT_Font *font, SFT_Glyph glyph, SFT_UMetrics *umetrics);
+static void init_metrics(SFT_Font *font);
+/* glyph pair -> kerning */
+static uint_fast32_t kern_hash(uint_fast32_t pair);
+static const SFT_KernPair *kern_pair(SFT_Font *font, SFT_Glyph leftGlyph, SFT_Glyph rightGlyph);
+static void init_kerning(SFT_Font *font);
 /* glyph -> Outline */
 static int outline_offset(SFT_Font *font, SFT_Glyph glyph, uint_fast32_t *offset);
 /* decoding outlines */
@@ -130,18 +183,35 @@ static int  decode_contour(uint8_t *flags, unsigned int basePoint, unsigned int
 static int  simple_outline(SFT_Font *font, unsigned long offset, int numContours, Outline *outl);
 static int  compound_outline(SFT_Font *font, unsigned long offset, int recDepth, Outline *outl);
 static int  decode_outline(SFT_Font *font, unsigned long offset, int recDepth, Outline *outl);
+static int  copy_outline(const Outline *src, Outline *dst);
+static int  load_outline(SFT_Font *font, SFT_Glyph glyph, unsigned long offset, Outline *outl);
+static void init_outlines(SFT_Font *font);
 /* tesselation */
-static int is_flat(Outline *outl, Curve curve, double flatness);
-static int tesselate_curve(Curve curve, Outline *outl);
-static int tesselate_curves(Outline *outl);
+static int split_curve(Curve curve, Outline *outl, unsigned int n);
+static inline int tesselate_curve(Curve curve, Outline *outl, double flatness);
+static int tesselate_curves(Outline *outl, double flatness);
+static double render_flatness(const SFT *sft);
 /* silhouette rasterization */
 static void draw_dot(Buffer buf, int px, int py, double xAvg, double yDiff);
 static void draw_line(Buffer buf, Point origin, Point goal);
 static void draw_lines(Outline *outl, Buffer buf);
 /* post-processing */
-static void post_process(Buffer buf, uint8_t *image);
+typedef void (*RowKernel)(const float *area, const float *cover, uint8_t *out, int width);
+static void accumulate_from(const float *area, const float *cover, uint8_t *out, int x, int width, float accum);
+static RowKernel row_kernel(void);
+static void post_process(Buffer buf, uint8_t *image, int stride, int flip);
 /* glyph rendering */
-static int render_image(const SFT *sft, unsigned long offset, double transform[6], SFT_Char *chr);
+static int place_glyph(const SFT *sft, SFT_Glyph glyph, SFT_Char *chr, double transform[6], uint_fast32_t *outline);
+static int rasterize(const SFT *sft, SFT_Glyph glyph, unsigned long offset, double transform[6], int width, int height, Buffer *buf);
+static int render_image(const SFT *sft, SFT_Glyph glyph, unsigned long offset, double transform[6], const SFT_Char *chr,
+                        uint8_t *image, int stride);
+static int render_into(const SFT *sft, SFT_Glyph glyph, unsigned long offset, double transform[6], const SFT_Char *chr,
+                       SFT_Canvas *canvas, int left, int top, const uint8_t color[4]);
+/* distance fields */
+static int  render_field(const SFT *sft, SFT_Glyph glyph, unsigned long offset, double transform[6], SFT_Field *field);
+static void field_distances(Outline *outl, float *dist, int width, int height, double spread);
+static int  field_signs(Outline *outl, float *dist, int width, int height);
+static void field_encode(const float *dist, uint8_t *image, int width, int height, double spread);
 
 /* function implementations */
 
@@ -191,22 +261,40 @@ sft_loadfile(char const *filename)
 void
 sft_freefont(SFT_Font *font)
 {
+	SFT_Glyph glyph;
 	if (!font) return;
 	/* Only unmap if we mapped it ourselves. */
 	if (font->source == SrcMapping)
 		unmap_file(font);
+	free(font->metrics);
+	free(font->cmapPages);
+	free(font->cmapGroups);
+	free(font->kernPairs);
+	if (font->outlines != NULL) {
+		for (glyph = 0; glyph < font->numGlyphs; ++glyph) {
+			if (font->outlines[glyph] != NULL)
+				free_outline(font->outlines[glyph]);
+			free(font->outlines[glyph]);
+		}
+		free(font->outlines);
+	}
 	free(font);
 }
 
+int
+sft_lookup(const SFT *sft, unsigned long charCode, SFT_Glyph *glyph)
+{
+	return glyph_id(sft->font, charCode, glyph);
+}
+
 int
 sft_lmetrics(const SFT* sft, SFT_LMetrics* lmetrics)
 {
 	double factor;
 	uint_fast32_t hhea;
 	memset(lmetrics, 0, sizeof *lmetrics);
-	if (gettable(sft->font, "hhea", &hhea) < 0)
-		return -1;
-	if (!is_safe_offset(sft->font, hhea, 36))
+	/* init_font() made sure the table is there and long enough. */
+	if (!(hhea = sft->font->hhea))
 		return -1;
 	factor = sft->yScale / sft->font->unitsPerEm;
 	lmetrics->ascender  = geti16(sft->font, hhea + 4) * factor;
@@ -218,24 +306,32 @@ sft_lmetrics(const SFT* sft, SFT_LMetrics* lmetrics)
 int
 sft_gmetrics(const SFT *sft, SFT_Glyph glyph, SFT_GMetrics *gmetrics)
 {
-	int adv, lsb;
 	double xScale = sft->xScale / sft->font->unitsPerEm;
-	uint_fast32_t outline;
+	double yScale = sft->yScale / sft->font->unitsPerEm;
+	SFT_UMetrics umetrics;
 	int bbox[4];
 
 	memset(gmetrics, 0, sizeof *gmetrics);
 
-	if (hor_metrics(sft->font, glyph, &adv, &lsb) < 0)
+	/* Layout only needs metrics, they come from the table without touching the outline. */
+	glyph_umetrics(sft->font, glyph, &umetrics);
+
+	if (umetrics.state == MetricsNoHmtx)
 		return -1;
-	gmetrics->advanceWidth    = adv * xScale;
-	gmetrics->leftSideBearing = lsb * xScale + sft->xOffset;
+	gmetrics->advanceWidth    = umetrics.advanceWidth * xScale;
+	gmetrics->leftSideBearing = umetrics.leftSideBearing * xScale + sft->xOffset;
 
-	if (outline_offset(sft->font, glyph, &outline) < 0)
+	if (umetrics.state == MetricsNoOutline)
 		return -1;
-	if (!outline)
+	if (umetrics.state == MetricsEmpty)
 		return 0;
-	if (glyph_bbox(sft, outline, bbox) < 0)
+	if (umetrics.state == MetricsBadBox)
 		return -1;
+	/* Transform the bounding box into SFT coordinate space. */
+	bbox[0] = (int) floor(umetrics.box[0] * xScale + sft->xOffset);
+	bbox[1] = (int) floor(umetrics.box[1] * yScale + sft->yOffset);
+	bbox[2] = (int) ceil (umetrics.box[2] * xScale + sft->xOffset);
+	bbox[3] = (int) ceil (umetrics.box[3] * yScale + sft->yOffset);
 	gmetrics->minWidth  = bbox[2] - bbox[0] + 1;
 	gmetrics->minHeight = bbox[3] - bbox[1] + 1;
 	gmetrics->yOffset   = sft->flags & SFT_DOWNWARD_Y ? -bbox[3] : bbox[1];
@@ -247,6 +343,7 @@ int
 sft_kerning(const SFT* sft, SFT_Glyph leftGlyph, SFT_Glyph rightGlyph, SFT_Kerning* kerning)
 {
 	void *match;
+	const SFT_KernPair *pair;
 	uint_fast32_t offset;
 	unsigned int numTables, numPairs, length, format, flags;
 	int value;
@@ -255,7 +352,16 @@ sft_kerning(const SFT* sft, SFT_Glyph leftGlyph, SFT_Glyph rightGlyph, SFT_Kerni
 	kerning->xShift = 0.0;
 	kerning->yShift = 0.0;
 
-	if (gettable(sft->font, "kern", &offset) < 0)
+	/* Pairs hashed at load, a probe or two instead of walking the subtables. */
+	if (sft->font->kernPairs != NULL) {
+		if ((pair = kern_pair(sft->font, leftGlyph, rightGlyph)) != NULL) {
+			kerning->xShift = pair->xShift / (double) sft->font->unitsPerEm * sft->xScale;
+			kerning->yShift = pair->yShift / (double) sft->font->unitsPerEm * sft->yScale;
+		}
+		return 0;
+	}
+
+	if (!(offset = sft->font->kern))
 		return 0;
 
 	/* Read kern table header. */
@@ -312,13 +418,38 @@ sft_kerning(const SFT* sft, SFT_Glyph leftGlyph, SFT_Glyph rightGlyph, SFT_Kerni
 int
 sft_char(const SFT *sft, unsigned long charCode, SFT_Char *chr)
 {
+	double transform[6];
+	SFT_Glyph glyph;
+	uint_fast32_t outline;
+	int state;
+
+	memset(chr, 0, sizeof(*chr));
+	if (glyph_id(sft->font, charCode, &glyph) < 0)
+		return -1;
+	if (glyph == 0 && (sft->flags & SFT_CATCH_MISSING))
+		return 1;
+
+	if ((state = place_glyph(sft, glyph, chr, transform, &outline)) <= 0)
+		return state;
+
+	if ((chr->image = (uint8_t*)calloc(chr->width * chr->height, 1)) == NULL)
+		return -1;
+	if (render_image(sft, glyph, outline, transform, chr, chr->image, chr->width) < 0) {
+		free(chr->image);
+		chr->image = NULL;
+		return -1;
+	}
+
+	return glyph == 0;
+}
 
+int
+sft_char_metrics(const SFT *sft, unsigned long charCode, SFT_Char *chr)
+{
 	double transform[6];
-	double xScale, yScale, xOff, yOff;
 	SFT_Glyph glyph;
 	uint_fast32_t outline;
-	int advance, leftSideBearing;
-	int x1, y1, x2, y2;
+	int state;
 
 	memset(chr, 0, sizeof(*chr));
 	if (glyph_id(sft->font, charCode, &glyph) < 0)
@@ -326,37 +457,187 @@ sft_char(const SFT *sft, unsigned long charCode, SFT_Char *chr)
 	if (glyph == 0 && (sft->flags & SFT_CATCH_MISSING))
 		return 1;
 
-	
+	if ((state = place_glyph(sft, glyph, chr, transform, &outline)) <= 0)
+		return state;
+
+	return glyph == 0;
+}
+
+int
+sft_char_into(const SFT *sft, unsigned long charCode, SFT_Char *chr, SFT_Canvas *canvas)
+{
+	double transform[6];
+	SFT_Glyph glyph;
+	uint_fast32_t outline;
+	int state;
+
+	memset(chr, 0, sizeof(*chr));
+	if (canvas->channels != 1)
+		return -1;
+	if (glyph_id(sft->font, charCode, &glyph) < 0)
+		return -1;
+	if (glyph == 0 && (sft->flags & SFT_CATCH_MISSING))
+		return 1;
+
+	if ((state = place_glyph(sft, glyph, chr, transform, &outline)) <= 0)
+		return state;
+
+	if (chr->width > canvas->width || chr->height > canvas->height)
+		return -1;
+	if (render_image(sft, glyph, outline, transform, chr, canvas->pixels, canvas->stride) < 0)
+		return -1;
+	chr->image = canvas->pixels;
+
+	return glyph == 0;
+}
+
+int
+sft_render_into(const SFT *sft, SFT_Glyph glyph, SFT_Canvas *canvas, int x, int y, const uint8_t color[4])
+{
+	double transform[6];
+	uint_fast32_t outline;
+	SFT_Char chr;
+	int state, top;
+
+	if (canvas->channels < 1 || canvas->channels > 4)
+		return -1;
+
+	if ((state = place_glyph(sft, glyph, &chr, transform, &outline)) <= 0)
+		return state;
+
+	/* Top row of the glyph, chr.y is the bottom one for upward Y. */
+	top = sft->flags & SFT_DOWNWARD_Y ? chr.y : -(chr.y + chr.height);
+
+	/* Nothing of the glyph lands on canvas. */
+	if (x + chr.x >= canvas->width || x + chr.x + chr.width <= 0 || y + top >= canvas->height || y + top + chr.height <= 0)
+		return 0;
+
+	return render_into(sft, glyph, outline, transform, &chr, canvas, x + chr.x, y + top, color);
+}
+
+void
+sft_blend_span(uint8_t *dst, const uint8_t *coverage, int count, int channels, const uint8_t color[4])
+{
+	float srcAlpha, dstAlpha, outAlpha, value;
+	int i, c;
+	for (i = 0; i < count; ++i, dst += channels) {
+		if (coverage[i] == 0)
+			continue;
+		srcAlpha = (coverage[i] / 255.f) * (color[3] / 255.f);
+		dstAlpha = channels < 4 ? 1 : dst[3] / 255.f;
+		if (srcAlpha > .99 && dstAlpha > .99) {
+			memcpy(dst, color, channels);
+			continue;
+		}
+		outAlpha = srcAlpha + dstAlpha * (1 - srcAlpha);
+		if (outAlpha < .01) {
+			memset(dst, 0, channels);
+			continue;
+		}
+		for (c = 0; c < channels; ++c) {
+			value = (color[c] / 255.f * srcAlpha + dst[c] / 255.f * dstAlpha * (1 - srcAlpha)) / outAlpha * 255.f;
+			dst[c] = (uint8_t) MIN(value, 255.0f);
+		}
+		if (channels > 3) {
+			value = outAlpha * 255.f;
+			dst[3] = (uint8_t) MIN(value, 255.0f);
+		}
+	}
+}
+
+int
+sft_field(const SFT *sft, unsigned long charCode, double spread, SFT_Field *field)
+{
+	double transform[6];
+	double xScale, yScale;
+	SFT_Glyph glyph;
+	SFT_UMetrics umetrics;
+	int pad, x1, y1;
+
+	memset(field, 0, sizeof(*field));
+	field->spread = spread;
+	if (glyph_id(sft->font, charCode, &glyph) < 0)
+		return -1;
+	if (glyph == 0 && (sft->flags & SFT_CATCH_MISSING))
+		return 1;
+
+	xScale = sft->xScale / sft->font->unitsPerEm;
+	yScale = sft->yScale / sft->font->unitsPerEm;
+	glyph_umetrics(sft->font, glyph, &umetrics);
+	if (umetrics.state == MetricsNoHmtx || umetrics.state == MetricsNoOutline || umetrics.state == MetricsBadBox)
+		return -1;
+	/* A glyph may have a completely empty outline. */
+	if (umetrics.state == MetricsEmpty)
+		return 0;
+
+	/* Outline box in field pixels, with room for the distance to fall off around it. */
+	pad = (int) ceil(spread) + 1;
+	x1 = (int) floor(umetrics.box[0] * xScale);
+	y1 = (int) floor(umetrics.box[1] * yScale);
+	field->width = (int) ceil(umetrics.box[2] * xScale) - x1 + 2 * pad;
+	field->height = (int) ceil(umetrics.box[3] * yScale) - y1 + 2 * pad;
+	field->padding = pad;
+
+	/* Unlike sft_char(), points keep their position relative to the pen, x1 and leftSideBearing
+	 * are lined up by moving the origin instead. Offsets of sft are left to whoever draws the field. */
+	transform[0] = xScale;
+	transform[1] = 0.0;
+	transform[2] = 0.0;
+	transform[3] = yScale;
+	transform[4] = pad - x1;
+	transform[5] = pad - y1;
+	field->originX = (umetrics.box[0] - umetrics.leftSideBearing) * xScale + pad - x1;
+	field->originY = field->height - pad + y1;
+
+	if (render_field(sft, glyph, umetrics.outline, transform, field) < 0)
+		return -1;
+
+	return glyph == 0;
+}
+
+/* Fills in bounding box and advance of the glyph, and the transformation from its outline to its image.
+ * Returns 1 if there is an outline to render, 0 if the glyph is empty and -1 on error. */
+static int
+place_glyph(const SFT *sft, SFT_Glyph glyph, SFT_Char *chr, double transform[6], uint_fast32_t *outline)
+{
+	double xScale, yScale, xOff, yOff;
+	SFT_UMetrics umetrics;
+	int advance, leftSideBearing;
+	int x1, y1, x2, y2;
+
+	memset(chr, 0, sizeof(*chr));
+
 	/* Set up the initial transformation from
 	 * glyph coordinate space to SFT coordinate space. */
 	xScale = sft->xScale / sft->font->unitsPerEm;
 	yScale = sft->yScale / sft->font->unitsPerEm;
 	xOff = sft->xOffset;
 	yOff = sft->yOffset;
-	if (hor_metrics(sft->font, glyph, &advance, &leftSideBearing) < 0)
+	glyph_umetrics(sft->font, glyph, &umetrics);
+	if (umetrics.state == MetricsNoHmtx)
 		return -1;
+	advance = umetrics.advanceWidth;
+	leftSideBearing = umetrics.leftSideBearing;
 
-	
 	/* We can compute the advance width early because the scaling factors
 	 * won't be changed. This is neccessary for glyphs with completely
 	 * empty outlines. */
 	chr->advance = (int) round(advance * xScale);
 
-	if (outline_offset(sft->font, glyph, &outline) < 0)
+	if (umetrics.state == MetricsNoOutline)
 		return -1;
 	/* A glyph may have a completely empty outline. */
-	if (!outline)
+	if (umetrics.state == MetricsEmpty)
 		return 0;
 
-	/* Read the bounding box from the font file verbatim. */
-	if (sft->font->size < (unsigned long) outline + 10)
-		return -1;
-	x1 = geti16(sft->font, outline + 2);
-	y1 = geti16(sft->font, outline + 4);
-	x2 = geti16(sft->font, outline + 6);
-	y2 = geti16(sft->font, outline + 8);
-	if (x2 <= x1 || y2 <= y1)
+	/* Bounding box as found in the font file. */
+	if (umetrics.state == MetricsBadBox)
 		return -1;
+	*outline = umetrics.outline;
+	x1 = umetrics.box[0];
+	y1 = umetrics.box[1];
+	x2 = umetrics.box[2];
+	y2 = umetrics.box[3];
 
 	/* Shift the transformation along the X axis such that
 	 * x1 and leftSideBearing line up. Derivation:
@@ -377,10 +658,9 @@ sft_char(const SFT *sft, unsigned long charCode, SFT_Char *chr)
 	chr->width = x2 - x1;
 	chr->height = y2 - y1;
 
-	/* Render the Outline. */
 	/* Set up the transformation matrix such that
-		* the transformed bounding boxes min corner lines
-		* up with the (0, 0) point. */
+	 * the transformed bounding boxes min corner lines
+	 * up with the (0, 0) point. */
 	transform[0] = xScale;
 	transform[1] = 0.0;
 	transform[2] = 0.0;
@@ -388,28 +668,73 @@ sft_char(const SFT *sft, unsigned long charCode, SFT_Char *chr)
 	transform[4] = xOff - x1;
 	transform[5] = yOff - y1;
 
-	if (render_image(sft, outline, transform, chr) < 0)
-		return -1;
+	return 1;
+}
 
-	return glyph == 0;
+static thread_local Arena scratch;
+
+Arena::~Arena()
+{
+	void *next;
+	/* Blocks of the last glyph that didn't fit, arena isn't reset after it. */
+	while (spill) {
+		next = *(void **) spill;
+		free(spill);
+		spill = next;
+	}
+	free(memory);
 }
 
-/* This is sqrt(SIZE_MAX+1), as s1*s2 <= SIZE_MAX
- * if both s1 < MUL_NO_OVERFLOW and s2 < MUL_NO_OVERFLOW */
-#define MUL_NO_OVERFLOW	((size_t)1 << (sizeof(size_t) * 4))
+static void *
+arena_alloc(Arena *arena, size_t size)
+{
+	void **block;
+	if (size > SIZE_MAX - 2 * ARENA_ALIGN)
+		return NULL;
+	size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+	if (arena->size - arena->used >= size) {
+		arena->used += size;
+		return arena->memory + arena->used - size;
+	}
+	/* Doesn't fit, taken from heap until the next reset. */
+	if ((block = (void **) malloc(ARENA_ALIGN + size)) == NULL)
+		return NULL;
+	*block = arena->spill;
+	arena->spill = block;
+	arena->spillBytes += size;
+	return (uint8_t *) block + ARENA_ALIGN;
+}
 
-/* OpenBSD's reallocarray() standard libary function.
- * A wrapper for realloc() that takes two size args like calloc().
- * Useful because it eliminates common integer overflow bugs. */
-void *
-reallocarray(void *optr, size_t nmemb, size_t size)
+static void *
+arena_calloc(Arena *arena, size_t count, size_t size)
 {
-	if ((nmemb >= MUL_NO_OVERFLOW || size >= MUL_NO_OVERFLOW) &&
-	    nmemb > 0 && SIZE_MAX / nmemb < size) {
-		errno = ENOMEM;
+	void *mem;
+	if (size && count > SIZE_MAX / size)
 		return NULL;
+	if ((mem = arena_alloc(arena, count * size)) != NULL)
+		memset(mem, 0, count * size);
+	return mem;
+}
+
+/* Frees everything allocated since the last reset. If something spilled, memory grows to fit it next time. */
+static void
+arena_reset(Arena *arena)
+{
+	void *next;
+	size_t size = arena->used + arena->spillBytes;
+	while (arena->spill) {
+		next = *(void **) arena->spill;
+		free(arena->spill);
+		arena->spill = next;
 	}
-	return realloc(optr, size * nmemb);
+	if (arena->spillBytes && size <= ARENA_LIMIT) {
+		size = MIN(ARENA_LIMIT, size > 2 * arena->size ? size : 2 * arena->size);
+		free(arena->memory);
+		arena->memory = (uint8_t *) malloc(size);
+		arena->size = arena->memory ? size : 0;
+	}
+	arena->spillBytes = 0;
+	arena->used = 0;
 }
 
 /* TODO maybe we should use long here instead of int. */
@@ -517,7 +842,8 @@ unmap_file(SFT_Font *font)
 static int
 init_font(SFT_Font *font)
 {
-	uint_fast32_t scalerType, head, hhea;
+	uint_fast32_t scalerType, head, hhea, cmap;
+	int format;
 
 	/* Check for a compatible scalerType (magic number). */
 	scalerType = getu32(font, 0);
@@ -531,15 +857,49 @@ init_font(SFT_Font *font)
 	font->unitsPerEm = getu16(font, head + 18);
 	font->locaFormat = geti16(font, head + 50);
 
-	if (gettable(font, "hhea", &hhea) < 0)
+	if (!(hhea = table_offset(font, "hhea")))
 		return -1;
 	if (font->size < (unsigned long) hhea + 36)
 		return -1;
 	font->numLongHmtx = getu16(font, hhea + 34);
 
+	/* Tables read per glyph are looked up once, so rendering never searches the table directory. */
+	font->hhea = hhea;
+	font->hmtx = table_offset(font, "hmtx");
+	font->loca = table_offset(font, "loca");
+	font->glyf = table_offset(font, "glyf");
+	font->kern = table_offset(font, "kern");
+	if (cmap_table(font, &cmap, &format) == 0) {
+		font->cmapTable = cmap;
+		font->cmapFormat = format;
+	}
+
+	init_metrics(font);
+	init_cmap(font);
+	init_kerning(font);
+	init_outlines(font);
+
 	return 0;
 }
 
+/* Fills metrics table of the font, font stays usable without it. */
+static void
+init_metrics(SFT_Font *font)
+{
+	uint_fast32_t maxp;
+	SFT_Glyph glyph;
+
+	if (gettable(font, "maxp", &maxp) < 0 || !is_safe_offset(font, maxp, 6))
+		return;
+	font->numGlyphs = getu16(font, maxp + 4);
+
+	if ((font->metrics = (SFT_UMetrics*)calloc(font->numGlyphs, sizeof(SFT_UMetrics))) == NULL)
+		return;
+
+	for (glyph = 0; glyph < font->numGlyphs; ++glyph)
+		read_umetrics(font, glyph, &font->metrics[glyph]);
+}
+
 static Point
 midpoint(Point a, Point b)
 {
@@ -591,61 +951,34 @@ clip_points(int numPts, Point *points, int width, int height)
 static int
 init_buffer(Buffer *buf, int width, int height)
 {
-	Cell *ptr;
-	size_t rowsSize, cellsSize;
-	int i;
+	size_t cells = (size_t) width * height;
 
-	buf->rows = NULL;
 	buf->width = width;
 	buf->height = height;
 
-	rowsSize = (size_t) height * sizeof(buf->rows[0]);
-	cellsSize = (size_t) width * height * sizeof(Cell);
-	if ((buf->rows = (Cell**) calloc(rowsSize + cellsSize, 1)) == NULL)
+	if ((buf->area = (float*) arena_calloc(&scratch, cells, sizeof(float))) == NULL)
+		return -1;
+	if ((buf->cover = (float*) arena_calloc(&scratch, cells, sizeof(float))) == NULL)
 		return -1;
-
-	ptr = (Cell*) (buf->rows + height);
-	for (i = 0; i < height; ++i) {
-		buf->rows[i] = ptr;
-		ptr += width;
-	}
 
 	return 0;
 }
 
-static void
-free_buffer(Buffer *buf)
-{
-	free(buf->rows);
-}
-
-static void
-flip_buffer(Buffer *buf)
-{
-	Cell *row;
-	int front = 0, back = buf->height - 1;
-	while (front < back) {
-		row = buf->rows[front];
-		buf->rows[front] = buf->rows[back];
-		buf->rows[back] = row;
-		++front, --back;
-	}
-}
-
 static int
 init_outline(Outline *outl)
 {
+	/* Outlines being rendered live in scratch arena, only cached ones are on the heap. */
 	outl->numPoints = 0;
 	outl->capPoints = 64;
-	if ((outl->points = (Point*)malloc(outl->capPoints * sizeof(outl->points[0]))) == NULL)
+	if ((outl->points = (Point*)arena_alloc(&scratch, outl->capPoints * sizeof(outl->points[0]))) == NULL)
 		return -1;
 	outl->numCurves = 0;
 	outl->capCurves = 64;
-	if ((outl->curves = (Curve*)malloc(outl->capCurves * sizeof(outl->curves[0]))) == NULL)
+	if ((outl->curves = (Curve*)arena_alloc(&scratch, outl->capCurves * sizeof(outl->curves[0]))) == NULL)
 		return -1;
 	outl->numLines = 0;
 	outl->capLines = 64;
-	if ((outl->lines = (Line*)malloc(outl->capLines * sizeof(outl->lines[0]))) == NULL)
+	if ((outl->lines = (Line*)arena_alloc(&scratch, outl->capLines * sizeof(outl->lines[0]))) == NULL)
 		return -1;
 	return 0;
 }
@@ -664,11 +997,12 @@ grow_points(Outline *outl)
 	void *mem;
 	int cap = outl->capPoints * 2;
 	/* This precondition is relatively important. Otherwise, if cap
-	 * were 0, reallocarray() may return NULL as an allocated pointer, which
-	 * we would misinterpret as an out-of-memory situation. */
+	 * were 0, the outline would never grow. */
 	assert(cap > 0);
-	if ((mem = reallocarray(outl->points, cap, sizeof(outl->points[0]))) == NULL)
+	if ((mem = arena_alloc(&scratch, (size_t) cap * sizeof(outl->points[0]))) == NULL)
 		return -1;
+	/* Old array stays in the arena until the glyph is done. */
+	memcpy(mem, outl->points, outl->capPoints * sizeof(outl->points[0]));
 	outl->capPoints = cap;
 	outl->points = (Point*)mem;
 	return 0;
@@ -680,8 +1014,10 @@ grow_curves(Outline *outl)
 	void *mem;
 	int cap = outl->capCurves * 2;
 	assert(cap > 0);
-	if ((mem = reallocarray(outl->curves, cap, sizeof(outl->curves[0]))) == NULL)
+	if ((mem = arena_alloc(&scratch, (size_t) cap * sizeof(outl->curves[0]))) == NULL)
 		return -1;
+	/* Old array stays in the arena until the glyph is done. */
+	memcpy(mem, outl->curves, outl->capCurves * sizeof(outl->curves[0]));
 	outl->capCurves = cap;
 	outl->curves = (Curve*)mem;
 	return 0;
@@ -693,8 +1029,10 @@ grow_lines(Outline *outl)
 	void *mem;
 	int cap = outl->capLines * 2;
 	assert(cap > 0);
-	if ((mem = reallocarray(outl->lines, cap, sizeof(outl->lines[0]))) == NULL)
+	if ((mem = arena_alloc(&scratch, (size_t) cap * sizeof(outl->lines[0]))) == NULL)
 		return -1;
+	/* Old array stays in the arena until the glyph is done. */
+	memcpy(mem, outl->lines, outl->capLines * sizeof(outl->lines[0]));
 	outl->capLines = cap;
 	outl->lines = (Line*)mem;
 	return 0;
@@ -796,6 +1134,16 @@ gettable(SFT_Font *font, const char tag[4], uint_fast32_t *offset)
 	return 0;
 }
 
+/* Offset of the table, 0 if font has none or it starts outside of the file. */
+static uint_least32_t
+table_offset(SFT_Font *font, const char tag[4])
+{
+	uint_fast32_t offset;
+	if (gettable(font, tag, &offset) < 0 || offset >= font->size)
+		return 0;
+	return offset;
+}
+
 static int
 cmap_fmt4(SFT_Font *font, uint_fast32_t table, unsigned long charCode, SFT_Glyph *glyph)
 {
@@ -910,14 +1258,13 @@ cmap_fmt12_13(SFT_Font *font, uint_fast32_t table, unsigned long charCode, SFT_G
 }
 
 /* Maps Unicode code points to glyph indices. */
+/* Finds the cmap subtable glyph_id() reads: 'full repertoire' map if there is one, else BMP map. */
 static int
-glyph_id(SFT_Font *font, unsigned long charCode, SFT_Glyph* glyph)
+cmap_table(SFT_Font *font, uint_fast32_t *table, int *format)
 {
-	uint_fast32_t cmap, entry, table;
+	uint_fast32_t cmap, entry;
 	unsigned int idx, numEntries;
-	int type, format;
-	
-	*glyph = 0;
+	int type;
 
 	if (gettable(font, "cmap", &cmap) < 0)
 		return -1;
@@ -935,17 +1282,11 @@ glyph_id(SFT_Font *font, unsigned long charCode, SFT_Glyph* glyph)
 		type = getu16(font, entry) * 0100 + getu16(font, entry + 2);
 		/* Complete unicode map */
 		if (type == 0004 || type == 0312) {
-			table = cmap + getu32(font, entry + 4);
-			if (!is_safe_offset(font, table, 8))
+			*table = cmap + getu32(font, entry + 4);
+			if (!is_safe_offset(font, *table, 8))
 				return -1;
-			/* Dispatch based on cmap format. */
-			format = getu16(font, table);
-			switch (format) {
-			case 12:
-				return cmap_fmt12_13(font, table, charCode, glyph, 12);
-			default:
-				return -1;
-			}
+			*format = getu16(font, *table);
+			return *format == 12 ? 0 : -1;
 		}
 	}
 
@@ -955,22 +1296,207 @@ glyph_id(SFT_Font *font, unsigned long charCode, SFT_Glyph* glyph)
 		type = getu16(font, entry) * 0100 + getu16(font, entry + 2);
 		/* Unicode BMP */
 		if (type == 0003 || type == 0301) {
-			table = cmap + getu32(font, entry + 4);
-			if (!is_safe_offset(font, table, 6))
+			*table = cmap + getu32(font, entry + 4);
+			if (!is_safe_offset(font, *table, 6))
 				return -1;
-			/* Dispatch based on cmap format. */
-			switch (getu16(font, table)) {
-			case 4:
-				return cmap_fmt4(font, table + 6, charCode, glyph);
-			case 6:
-				return cmap_fmt6(font, table + 6, charCode, glyph);
-			default:
+			*format = getu16(font, *table);
+			return *format == 4 || *format == 6 ? 0 : -1;
+		}
+	}
+
+	return -1;
+}
+
+static int
+glyph_id(SFT_Font *font, unsigned long charCode, SFT_Glyph* glyph)
+{
+	uint_fast32_t table = font->cmapTable;
+	
+	*glyph = 0;
+
+	/* Decoded cmap, a couple of array loads. */
+	if (font->cmap[0] != NULL) {
+		if (charCode <= 0xFFFF)
+			*glyph = font->cmap[charCode >> 8][charCode & 0xFF];
+		else
+			*glyph = cmap_groups(font, charCode);
+		return 0;
+	}
+
+	/* Dispatch based on cmap format. */
+	switch (font->cmapFormat) {
+	case 12:
+		return cmap_fmt12_13(font, table, charCode, glyph, 12);
+	case 4:
+		return cmap_fmt4(font, table + 6, charCode, glyph);
+	case 6:
+		return cmap_fmt6(font, table + 6, charCode, glyph);
+	default:
+		return -1;
+	}
+}
+
+/* Looks code point up in format 12 groups of decoded cmap. */
+static SFT_Glyph
+cmap_groups(SFT_Font *font, unsigned long charCode)
+{
+	const SFT_CmapGroup *group;
+	size_t low = 0, high = font->numCmapGroups, mid;
+
+	/* Last group that starts at or before the code point, groups don't overlap. */
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (font->cmapGroups[mid].firstCode <= charCode)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low == 0)
+		return 0;
+	group = &font->cmapGroups[low - 1];
+	return charCode <= group->lastCode ? (SFT_Glyph) (charCode - group->firstCode + group->firstGlyph) : 0;
+}
+
+/* Glyph ids of all BMP code points of format 4 subtable, as cmap_fmt4() would find them. */
+static int
+decode_fmt4(SFT_Font *font, uint_fast32_t table, uint_least16_t *glyphs)
+{
+	uint_fast32_t endCodes, startCodes, idDeltas, idRangeOffsets, idOffset;
+	uint_fast32_t segCountX2, seg, code, next, endCode;
+	uint_fast16_t startCode, idDelta, idRangeOffset, id;
+
+	if (!is_safe_offset(font, table, 8))
+		return -1;
+	segCountX2 = getu16(font, table);
+	if ((segCountX2 & 1) || !segCountX2)
+		return -1;
+	endCodes       = table + 8;
+	startCodes     = endCodes + segCountX2 + 2;
+	idDeltas       = startCodes + segCountX2;
+	idRangeOffsets = idDeltas + segCountX2;
+	if (!is_safe_offset(font, idRangeOffsets, segCountX2))
+		return -1;
+
+	/* Code point belongs to the first segment that ends at or after it (the last one if none does),
+	 * which is what cmap_fmt4() binary search finds as long as segments are sorted. */
+	for (code = 0, seg = 0; seg < segCountX2; seg += 2) {
+		endCode = getu16(font, endCodes + seg);
+		if (seg > 0 && endCode < getu16(font, endCodes + seg - 2))
+			return -1;
+		if (seg + 2 == segCountX2)
+			endCode = 0xFFFF;
+		startCode = getu16(font, startCodes + seg);
+		idDelta = getu16(font, idDeltas + seg);
+		idRangeOffset = getu16(font, idRangeOffsets + seg);
+		for (next = endCode + 1; code < next; ++code) {
+			if (code < startCode) {
+				glyphs[code] = 0;
+			} else if (!idRangeOffset) {
+				/* Intentional integer under- and overflow. */
+				glyphs[code] = (code + idDelta) & 0xFFFF;
+			} else {
+				idOffset = idRangeOffsets + seg + idRangeOffset + 2U * (unsigned int) (code - startCode);
+				if (!is_safe_offset(font, idOffset, 2))
+					return -1;
+				id = getu16(font, idOffset);
+				glyphs[code] = id ? (id + idDelta) & 0xFFFF : 0;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Format 12 groups, copied and sorted by first code point. Glyph ids of BMP code points go to glyphs. */
+static int
+decode_fmt12(SFT_Font *font, uint_fast32_t table, uint_least16_t *glyphs)
+{
+	SFT_CmapGroup *groups;
+	uint_fast32_t len, numGroups, i, code, next = 0, glyph;
+
+	if (!is_safe_offset(font, table, 16))
+		return -1;
+	len = getu32(font, table + 4);
+	if (len < 16 || !is_safe_offset(font, table, len))
+		return -1;
+	numGroups = getu32(font, table + 12);
+	if (!is_safe_offset(font, table + 16, numGroups * 12))
+		return -1;
+	if ((groups = (SFT_CmapGroup*)calloc(numGroups + 1, sizeof(SFT_CmapGroup))) == NULL)
+		return -1;
+
+	for (i = 0; i < numGroups; ++i) {
+		groups[i].firstCode = getu32(font, table + 16 + i * 12);
+		groups[i].lastCode = getu32(font, table + 16 + i * 12 + 4);
+		groups[i].firstGlyph = getu32(font, table + 16 + i * 12 + 8);
+	}
+
+	/* Stable sort keeps the order of groups that start at the same code point,
+	 * numGroups comes from the font, so it has to stay O(n log n). */
+	std::stable_sort(groups, groups + numGroups, [](const SFT_CmapGroup& a, const SFT_CmapGroup& b) {
+		return a.firstCode < b.firstCode;
+	});
+
+	/* Earlier groups win: codes below next are taken by one of them already,
+	 * so every BMP code point is written once. */
+	for (i = 0; i < numGroups && next <= 0xFFFF; ++i) {
+		for (code = MAX(groups[i].firstCode, next); code <= groups[i].lastCode && code <= 0xFFFF; ++code) {
+			glyph = code - groups[i].firstCode + groups[i].firstGlyph;
+			if (glyph > 0xFFFF) {
+				free(groups);
 				return -1;
 			}
+			glyphs[code] = (uint_least16_t) glyph;
 		}
+		next = MAX(next, (uint_fast32_t) MIN(groups[i].lastCode, 0xFFFF) + 1);
 	}
 
-	return -1;
+	font->cmapGroups = groups;
+	font->numCmapGroups = numGroups;
+	return 0;
+}
+
+/* Decodes cmap into flat table of pages, glyph_id() reads the font file if it can't be decoded. */
+static void
+init_cmap(SFT_Font *font)
+{
+	static const uint_least16_t emptyPage[256] = { 0 };
+	uint_least16_t *glyphs, *page;
+	uint_fast32_t table = font->cmapTable, hi, lo, numPages = 0;
+	int format = font->cmapFormat;
+
+	if (format != 4 && format != 12)
+		return;
+	if ((glyphs = (uint_least16_t*)calloc(0x10000, sizeof(uint_least16_t))) == NULL)
+		return;
+
+	if ((format == 4 ? decode_fmt4(font, table + 6, glyphs) : decode_fmt12(font, table, glyphs)) < 0) {
+		free(glyphs);
+		return;
+	}
+
+	/* Only pages that map something are kept, the rest share the empty one. */
+	for (hi = 0; hi < 256; ++hi) {
+		for (lo = 0; lo < 256 && !glyphs[hi * 256 + lo]; ++lo);
+		numPages += lo < 256;
+	}
+	if ((font->cmapPages = (uint_least16_t*)malloc((numPages + 1) * 256 * sizeof(uint_least16_t))) == NULL) {
+		free(glyphs);
+		free(font->cmapGroups);
+		font->cmapGroups = NULL;
+		font->numCmapGroups = 0;
+		return;
+	}
+	for (hi = 0, page = font->cmapPages; hi < 256; ++hi) {
+		for (lo = 0; lo < 256 && !glyphs[hi * 256 + lo]; ++lo);
+		if (lo == 256) {
+			font->cmap[hi] = emptyPage;
+			continue;
+		}
+		memcpy(page, &glyphs[hi * 256], 256 * sizeof(uint_least16_t));
+		font->cmap[hi] = page;
+		page += 256;
+	}
+	free(glyphs);
 }
 
 static int
@@ -978,7 +1504,7 @@ hor_metrics(SFT_Font *font, SFT_Glyph glyph, int *advanceWidth, int *leftSideBea
 {
 	uint32_t offset, boundary;
 	uint_fast32_t hmtx;
-	if (gettable(font, "hmtx", &hmtx) < 0)
+	if (!(hmtx = font->hmtx))
 		return -1;
 	if (glyph < font->numLongHmtx) {
 		/* glyph is inside long metrics segment. */
@@ -1007,39 +1533,160 @@ hor_metrics(SFT_Font *font, SFT_Glyph glyph, int *advanceWidth, int *leftSideBea
 	}
 }
 
-static int
-glyph_bbox(const SFT *sft, uint_fast32_t outline, int box[4])
+/* Reads metrics of the glyph from hmtx, loca and glyf tables. */
+static void
+read_umetrics(SFT_Font *font, SFT_Glyph glyph, SFT_UMetrics *umetrics)
 {
-	double xScale, yScale;
-	/* Read the bounding box from the font file verbatim. */
-	if (!is_safe_offset(sft->font, outline, 10))
-		return -1;
-	box[0] = geti16(sft->font, outline + 2);
-	box[1] = geti16(sft->font, outline + 4);
-	box[2] = geti16(sft->font, outline + 6);
-	box[3] = geti16(sft->font, outline + 8);
-	if (box[2] <= box[0] || box[3] <= box[1])
-		return -1;
-	/* Transform the bounding box into SFT coordinate space. */
-	xScale = sft->xScale / sft->font->unitsPerEm;
-	yScale = sft->yScale / sft->font->unitsPerEm;
-	box[0] = (int) floor(box[0] * xScale + sft->xOffset);
-	box[1] = (int) floor(box[1] * yScale + sft->yOffset);
-	box[2] = (int) ceil (box[2] * xScale + sft->xOffset);
-	box[3] = (int) ceil (box[3] * yScale + sft->yOffset);
-	return 0;
+	int advanceWidth, leftSideBearing;
+	uint_fast32_t outline;
+
+	memset(umetrics, 0, sizeof *umetrics);
+
+	umetrics->state = MetricsNoHmtx;
+	if (hor_metrics(font, glyph, &advanceWidth, &leftSideBearing) < 0)
+		return;
+	umetrics->advanceWidth = advanceWidth;
+	umetrics->leftSideBearing = leftSideBearing;
+
+	umetrics->state = MetricsNoOutline;
+	if (outline_offset(font, glyph, &outline) < 0)
+		return;
+
+	umetrics->state = MetricsEmpty;
+	if (!outline)
+		return;
+	umetrics->outline = outline;
+
+	umetrics->state = MetricsBadBox;
+	if (!is_safe_offset(font, outline, 10))
+		return;
+	umetrics->box[0] = geti16(font, outline + 2);
+	umetrics->box[1] = geti16(font, outline + 4);
+	umetrics->box[2] = geti16(font, outline + 6);
+	umetrics->box[3] = geti16(font, outline + 8);
+	if (umetrics->box[2] <= umetrics->box[0] || umetrics->box[3] <= umetrics->box[1])
+		return;
+
+	umetrics->state = MetricsOk;
+}
+
+/* Metrics of the glyph, from the table if the font has one. */
+static void
+glyph_umetrics(SFT_Font *font, SFT_Glyph glyph, SFT_UMetrics *umetrics)
+{
+	if (font->metrics != NULL && glyph < font->numGlyphs)
+		*umetrics = font->metrics[glyph];
+	else
+		read_umetrics(font, glyph, umetrics);
+}
+
+static uint_fast32_t
+kern_hash(uint_fast32_t pair)
+{
+	pair = (pair * 0x9E3779B1u) & 0xFFFFFFFF;
+	return pair ^ (pair >> 15);
+}
+
+/* Finds the pair in kerning index, NULL if glyphs aren't kerned. */
+static const SFT_KernPair *
+kern_pair(SFT_Font *font, SFT_Glyph leftGlyph, SFT_Glyph rightGlyph)
+{
+	const SFT_KernPair *slot;
+	uint_fast32_t pair, idx;
+
+	if (leftGlyph >= 0xFFFF || rightGlyph >= 0xFFFF)
+		return NULL;
+	pair = leftGlyph << 16 | rightGlyph;
+	for (idx = kern_hash(pair) & font->kernMask; ; idx = (idx + 1) & font->kernMask) {
+		slot = &font->kernPairs[idx];
+		if (slot->pair == pair)
+			return slot;
+		if (slot->pair == 0xFFFFFFFF)
+			return NULL;
+	}
+}
+
+/* Hashes the pairs of horizontal format 0 kern subtables, sft_kerning() walks the table if they can't be decoded. */
+static void
+init_kerning(SFT_Font *font)
+{
+	SFT_KernPair *slot;
+	uint_fast32_t offset, pairs, pair, idx, total = 0, capacity = 1;
+	unsigned int numTables, numPairs, length, format, flags, pass, i;
+	int value;
+
+	if (!font->kern || !is_safe_offset(font, font->kern, 4) || getu16(font, font->kern) != 0)
+		return;
+
+	/* First pass checks the subtables and counts pairs, second one hashes them. */
+	for (pass = 0; pass < 2; ++pass) {
+		offset = font->kern + 4;
+		for (numTables = getu16(font, font->kern + 2); numTables > 0; --numTables) {
+			if (!is_safe_offset(font, offset, 6))
+				goto failure;
+			length = getu16(font, offset + 2);
+			format = getu8 (font, offset + 4);
+			flags  = getu8 (font, offset + 5);
+			offset += 6;
+
+			if (format == 0 && (flags & HORIZONTAL_KERNING) && !(flags & MINIMUM_KERNING)) {
+				if (!is_safe_offset(font, offset, 8))
+					goto failure;
+				numPairs = getu16(font, offset);
+				pairs = offset + 8;
+				if (!is_safe_offset(font, pairs, (uint_fast32_t) numPairs * 6))
+					goto failure;
+
+				for (i = 0; pass == 1 && i < numPairs; ++i) {
+					pair = getu32(font, pairs + i * 6);
+					value = geti16(font, pairs + i * 6 + 4);
+					if ((pair >> 16) >= 0xFFFF || (pair & 0xFFFF) >= 0xFFFF)
+						continue;
+					/* Same pair in several subtables adds up, like in sft_kerning(). */
+					for (idx = kern_hash(pair) & font->kernMask; ; idx = (idx + 1) & font->kernMask) {
+						slot = &font->kernPairs[idx];
+						if (slot->pair == pair || slot->pair == 0xFFFFFFFF)
+							break;
+					}
+					slot->pair = pair;
+					if (flags & CROSS_STREAM_KERNING)
+						slot->yShift += value;
+					else
+						slot->xShift += value;
+				}
+				total += numPairs;
+			}
+
+			offset += length;
+		}
+
+		if (pass == 0) {
+			/* At most half full, so probes stay short. */
+			while (capacity < 2 * total)
+				capacity *= 2;
+			if ((font->kernPairs = (SFT_KernPair*)malloc(capacity * sizeof(SFT_KernPair))) == NULL)
+				return;
+			for (idx = 0; idx < capacity; ++idx)
+				font->kernPairs[idx] = { 0xFFFFFFFF, 0, 0 };
+			font->kernMask = capacity - 1;
+		}
+	}
+	return;
+
+failure:
+	free(font->kernPairs);
+	font->kernPairs = NULL;
+	font->kernMask = 0;
 }
 
 /* Returns the offset into the font that the glyph's outline is stored at. */
 static int
 outline_offset(SFT_Font *font, SFT_Glyph glyph, uint_fast32_t *offset)
 {
-	uint_fast32_t loca, glyf;
+	uint_fast32_t loca = font->loca, glyf = font->glyf;
 	uint_fast32_t base, thiss, next;
 
-	if (gettable(font, "loca", &loca) < 0)
-		return -1;
-	if (gettable(font, "glyf", &glyf) < 0)
+	if (!loca || !glyf)
 		return -1;
 
 	if (font->locaFormat == 0) {
@@ -1364,82 +2011,176 @@ decode_outline(SFT_Font *font, unsigned long offset, int recDepth, Outline *outl
 	}
 }
 
-/* A heuristic to tell whether a given curve can be approximated closely enough by a line. */
+/* Copies points, curves and lines, growing destination as needed. Zeroed destination gets arrays of exact size. */
 static int
-is_flat(Outline *outl, Curve curve, double flatness)
+copy_outline(const Outline *src, Outline *dst)
 {
-	Point beg = outl->points[curve.beg];
-	Point end = outl->points[curve.end];
-	Point ctrl = outl->points[curve.ctrl];
-	Point mid = midpoint(beg, end);
-	double x = ctrl.x - mid.x;
-	double y = ctrl.y - mid.y;
-	return x * x + y * y <= flatness * flatness;
+	if (!dst->capPoints) {
+		dst->points = (Point*)malloc((src->numPoints + 1) * sizeof(dst->points[0]));
+		dst->curves = (Curve*)malloc((src->numCurves + 1) * sizeof(dst->curves[0]));
+		dst->lines  = (Line*) malloc((src->numLines  + 1) * sizeof(dst->lines[0]));
+		if (dst->points == NULL || dst->curves == NULL || dst->lines == NULL)
+			return -1;
+		dst->capPoints = src->numPoints;
+		dst->capCurves = src->numCurves;
+		dst->capLines  = src->numLines;
+	}
+	while (dst->capPoints < src->numPoints)
+		if (grow_points(dst) < 0)
+			return -1;
+	while (dst->capCurves < src->numCurves)
+		if (grow_curves(dst) < 0)
+			return -1;
+	while (dst->capLines < src->numLines)
+		if (grow_lines(dst) < 0)
+			return -1;
+	memcpy(dst->points, src->points, src->numPoints * sizeof(src->points[0]));
+	memcpy(dst->curves, src->curves, src->numCurves * sizeof(src->curves[0]));
+	memcpy(dst->lines,  src->lines,  src->numLines  * sizeof(src->lines[0]));
+	dst->numPoints = src->numPoints;
+	dst->numCurves = src->numCurves;
+	dst->numLines  = src->numLines;
+	return 0;
 }
 
+/* Decodes outline of the glyph, or copies it from the font's cache. Glyphs decoded first time are cached,
+ * so rendering at another scale only transforms and tesselates it. Threads may race to cache the same glyph,
+ * the first one wins. */
 static int
-tesselate_curve(Curve curve, Outline *outl)
-{
-	/* From my tests I can conclude that this stack barely reaches a top height
-	 * of 4 elements even for the largest font sizes I'm willing to support. And
-	 * as space requirements should only grow logarithmically, I think 10 is
-	 * more than enough. */
-#define STACK_SIZE 10
-	Curve stack[STACK_SIZE];
-	unsigned int top = 0;
-	for (;;) {
-		if (is_flat(outl, curve, 0.5) || top >= STACK_SIZE) {
-			if (outl->numLines >= outl->capLines && grow_lines(outl) < 0)
-				return -1;
-			outl->lines[outl->numLines++] = { curve.beg, curve.end };
-			if (top == 0) break;
-			curve = stack[--top];
-		} else {
-			unsigned int ctrl0 = outl->numPoints;
-			if (outl->numPoints >= outl->capPoints && grow_points(outl) < 0)
-				return -1;
-			outl->points[ctrl0] = midpoint(outl->points[curve.beg], outl->points[curve.ctrl]);
-			++outl->numPoints;
+load_outline(SFT_Font *font, SFT_Glyph glyph, unsigned long offset, Outline *outl)
+{
+	Outline *cached, *expected = NULL;
 
-			unsigned int ctrl1 = outl->numPoints;
-			if (outl->numPoints >= outl->capPoints && grow_points(outl) < 0)
-				return -1;
-			outl->points[ctrl1] = midpoint(outl->points[curve.ctrl], outl->points[curve.end]);
-			++outl->numPoints;
+	if (font->outlines == NULL || glyph >= font->numGlyphs)
+		return decode_outline(font, offset, 0, outl);
 
-			unsigned int pivot = outl->numPoints;
-			if (outl->numPoints >= outl->capPoints && grow_points(outl) < 0)
-				return -1;
-			outl->points[pivot] = midpoint(outl->points[ctrl0], outl->points[ctrl1]);
-			++outl->numPoints;
+	std::atomic_ref<Outline *> slot(font->outlines[glyph]);
 
-			stack[top++] = { curve.beg, static_cast<uint_least16_t>(pivot), static_cast<uint_least16_t>(ctrl0) };
-			curve = { static_cast<uint_least16_t>(pivot), curve.end, static_cast<uint_least16_t>(ctrl1) };
-		}
+	if ((cached = slot.load(std::memory_order_acquire)) != NULL)
+		return copy_outline(cached, outl);
+
+	if (decode_outline(font, offset, 0, outl) < 0)
+		return -1;
+
+	/* Caching is best effort, the outline is decoded either way. */
+	if ((cached = (Outline*)calloc(1, sizeof(Outline))) == NULL)
+		return 0;
+	if (copy_outline(outl, cached) < 0 || !slot.compare_exchange_strong(expected, cached, std::memory_order_release)) {
+		free_outline(cached);
+		free(cached);
+	}
+	return 0;
+}
+
+/* Outline cache starts empty, fonts without maxp table don't cache. */
+static void
+init_outlines(SFT_Font *font)
+{
+	if (font->numGlyphs)
+		font->outlines = (Outline**)calloc(font->numGlyphs, sizeof(Outline*));
+}
+
+/* Adds n lines of equal t along curve, points are stepped to by forward differencing. */
+static int
+split_curve(Curve curve, Outline *outl, unsigned int n)
+{
+	Point beg = outl->points[curve.beg];
+	Point ctrl = outl->points[curve.ctrl];
+	Point end = outl->points[curve.end];
+	Point point = beg, step, accel;
+	double dx = beg.x - 2.0 * ctrl.x + end.x;
+	double dy = beg.y - 2.0 * ctrl.y + end.y;
+	double h = 1.0 / n;
+	unsigned int i, prev, next;
+
+	/* Room for all of them up front, so the loop below doesn't check. */
+	while (outl->capPoints < outl->numPoints + n - 1)
+		if (grow_points(outl) < 0)
+			return -1;
+	while (outl->capLines < outl->numLines + n)
+		if (grow_lines(outl) < 0)
+			return -1;
+
+	/* First forward difference of B at t = 0, and the (constant) second one. */
+	step.x = 2.0 * h * (ctrl.x - beg.x) + h * h * dx;
+	step.y = 2.0 * h * (ctrl.y - beg.y) + h * h * dy;
+	accel.x = 2.0 * h * h * dx;
+	accel.y = 2.0 * h * h * dy;
+
+	prev = curve.beg;
+	for (i = 1; i < n; ++i) {
+		point.x += step.x;
+		point.y += step.y;
+		step.x += accel.x;
+		step.y += accel.y;
+		next = outl->numPoints++;
+		outl->points[next] = point;
+		outl->lines[outl->numLines++] = { static_cast<uint_least16_t>(prev), static_cast<uint_least16_t>(next) };
+		prev = next;
 	}
+
+	/* Last line ends exactly where the curve does. */
+	outl->lines[outl->numLines++] = { static_cast<uint_least16_t>(prev), curve.end };
 	return 0;
-#undef STACK_SIZE
+}
+
+/* Splits curve into as few lines as stay within flatness (in pixels) of it.
+ * Derivation: with d = beg - 2 ctrl + end the curve is B(t) = beg + 2t (ctrl - beg) + t^2 d and B'' = 2d, so n lines
+ * of equal t stray from it by at most |B''| / (8 n^2) = |d| / (4 n^2), which gives the count without subdividing. */
+static inline int
+tesselate_curve(Curve curve, Outline *outl, double flatness)
+{
+	/* Caps the points a single curve adds, only reached by absurd scales. */
+#define MAX_SEGMENTS 256
+	Point beg = outl->points[curve.beg];
+	Point ctrl = outl->points[curve.ctrl];
+	Point end = outl->points[curve.end];
+	double dx = beg.x - 2.0 * ctrl.x + end.x;
+	double dy = beg.y - 2.0 * ctrl.y + end.y;
+	double d = dx * dx + dy * dy, limit = 16.0 * flatness * flatness;
+	unsigned int n;
+
+	/* One line, most curves of small glyphs. */
+	if (d <= limit && outl->numLines < outl->capLines) {
+		outl->lines[outl->numLines++] = { curve.beg, curve.end };
+		return 0;
+	}
+
+	/* Smallest n with |d| <= 4 flatness n^2, squared. Few curves need more than a handful of lines,
+	 * so counting up is cheaper than the square roots. */
+	for (n = 1; n < MAX_SEGMENTS && d > limit * n * n * n * n; ++n);
+
+	return split_curve(curve, outl, n);
+#undef MAX_SEGMENTS
 }
 
 static int
-tesselate_curves(Outline *outl)
+tesselate_curves(Outline *outl, double flatness)
 {
 	unsigned int i;
 	for (i = 0; i < outl->numCurves; ++i) {
-		if (tesselate_curve(outl->curves[i], outl) < 0)
+		if (tesselate_curve(outl->curves[i], outl, flatness) < 0)
 			return -1;
 	}
 	return 0;
 }
 
+/* Flatness rasterize() tessellates with. Midpoint subdivision rounded line counts up to powers of two, so its error
+ * was often well below its bound, and more so on the long curves of big glyphs. The bound tightens with size to keep
+ * coverage at least as close to the curves as it was (bench/tessellation compares both). */
+static double
+render_flatness(const SFT *sft)
+{
+	double size = fmax(fabs(sft->xScale), fabs(sft->yScale));
+	return fmax(RENDER_FLATNESS_MIN, RENDER_FLATNESS * pow(fmin(1.0, RENDER_FLATNESS_SIZE / size), 0.25));
+}
+
 static void
 draw_dot(Buffer buf, int px, int py, double xAvg, double yDiff)
 {
-	Cell* ptr = &buf.rows[py][px];
-	Cell cell = *ptr;
-	cell.cover += yDiff;
-	cell.area += (1.0 - xAvg) * yDiff;
-	*ptr = cell;
+	size_t idx = (size_t) py * buf.width + px;
+	buf.cover[idx] += (float) yDiff;
+	buf.area[idx] += (float) ((1.0 - xAvg) * yDiff);
 }
 
 /* Draws a line into the buffer. Uses a custom 2D raycasting algorithm to do so. */
@@ -1529,55 +2270,324 @@ draw_lines(Outline *outl, Buffer buf)
 	}
 }
 
-/* Integrate the values in the Buffer to arrive at the final grayscale image. */
+/* Integrates a row of the Buffer from pixel x on, accum being the cover of all pixels left of it. */
 static void
-post_process(Buffer buf, uint8_t *image)
+accumulate_from(const float *area, const float *cover, uint8_t *out, int x, int width, float accum)
 {
-	Cell *in, cell;
-	uint8_t *out;
-	double accum, value;
-	int x, y;
-	out = image;
+	float value;
+	for (; x < width; ++x) {
+		value = fabsf(accum + area[x]);
+		value = MIN(value, 1.0f);
+		out[x] = (uint8_t) (value * 255.0f + 0.5f);
+		accum += cover[x];
+	}
+}
+
+#ifdef SFT_SIMD
+
+/* Pixels left of the vector add up to carry, pixels in it are added with an exclusive prefix sum of cover
+ * (cover shifted by one pixel, then added to itself shifted by one and two pixels). */
+static void
+accumulate_row_sse2(const float *area, const float *cover, uint8_t *out, int width)
+{
+	const __m128 sign = _mm_set1_ps(-0.0f), one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(255.0f), half = _mm_set1_ps(0.5f);
+	__m128 carry = _mm_setzero_ps(), c, e, v;
+	__m128i i;
+	int32_t packed;
+	int x;
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		c = _mm_loadu_ps(cover + x);
+		e = _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(c), 4));
+		e = _mm_add_ps(e, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(e), 4)));
+		e = _mm_add_ps(e, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(e), 8)));
+		e = _mm_add_ps(e, carry);
+
+		v = _mm_add_ps(e, _mm_loadu_ps(area + x));
+		v = _mm_min_ps(_mm_andnot_ps(sign, v), one);
+		v = _mm_add_ps(_mm_mul_ps(v, scale), half);
+		i = _mm_cvttps_epi32(v);
+		i = _mm_packus_epi16(_mm_packs_epi32(i, i), i);
+		packed = _mm_cvtsi128_si32(i);
+		memcpy(out + x, &packed, 4);
+
+		e = _mm_add_ps(e, c);
+		carry = _mm_shuffle_ps(e, e, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+
+	accumulate_from(area, cover, out, x, width, _mm_cvtss_f32(carry));
+}
+
+/* Same as SSE2 kernel, 8 pixels at a time. Prefix sum runs in both 128-bit halves, then the total of the low half
+ * is added to the high one. */
+__attribute__((target("avx2"))) static void
+accumulate_row_avx2(const float *area, const float *cover, uint8_t *out, int width)
+{
+	const __m256 sign = _mm256_set1_ps(-0.0f), one = _mm256_set1_ps(1.0f);
+	const __m256 scale = _mm256_set1_ps(255.0f), half = _mm256_set1_ps(0.5f);
+	const __m256i shift = _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6), last = _mm256_set1_epi32(7);
+	__m256 carry = _mm256_setzero_ps(), c, e, v;
+	__m256i i;
+	__m128i bytes;
+	int x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		c = _mm256_loadu_ps(cover + x);
+		e = _mm256_blend_ps(_mm256_permutevar8x32_ps(c, shift), _mm256_setzero_ps(), 1);
+		e = _mm256_add_ps(e, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(e), 4)));
+		e = _mm256_add_ps(e, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(e), 8)));
+		v = _mm256_shuffle_ps(e, e, _MM_SHUFFLE(3, 3, 3, 3));
+		e = _mm256_add_ps(e, _mm256_permute2f128_ps(v, v, 0x08));
+		e = _mm256_add_ps(e, carry);
+
+		v = _mm256_add_ps(e, _mm256_loadu_ps(area + x));
+		v = _mm256_min_ps(_mm256_andnot_ps(sign, v), one);
+		v = _mm256_add_ps(_mm256_mul_ps(v, scale), half);
+		i = _mm256_cvttps_epi32(v);
+		i = _mm256_packus_epi16(_mm256_packs_epi32(i, i), i);
+		bytes = _mm_unpacklo_epi32(_mm256_castsi256_si128(i), _mm256_extracti128_si256(i, 1));
+		_mm_storel_epi64((__m128i *) (out + x), bytes);
+
+		carry = _mm256_permutevar8x32_ps(_mm256_add_ps(e, c), last);
+	}
+
+	accumulate_from(area, cover, out, x, width, _mm256_cvtss_f32(carry));
+}
+
+static RowKernel
+pick_kernel(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return accumulate_row_avx2;
+	return accumulate_row_sse2;
+}
+
+#else
+
+/* Coverage of a pixel is its area plus the cover of all pixels left of it. */
+static void
+accumulate_row(const float *area, const float *cover, uint8_t *out, int width)
+{
+	accumulate_from(area, cover, out, 0, width, 0.0f);
+}
+
+#endif
+
+/* Picks the fastest kernel the CPU supports, once. */
+static RowKernel
+row_kernel(void)
+{
+#ifdef SFT_SIMD
+	static const RowKernel kernel = pick_kernel();
+	return kernel;
+#else
+	return accumulate_row;
+#endif
+}
+
+/* Integrate the values in the Buffer to arrive at the final grayscale image, rows of which are stride bytes apart. */
+static void
+post_process(Buffer buf, uint8_t *image, int stride, int flip)
+{
+	RowKernel kernel = row_kernel();
+	size_t row;
+	int y;
 	for (y = 0; y < buf.height; ++y) {
-		accum = 0.0;
-		in = buf.rows[y];
-		for (x = 0; x < buf.width; ++x) {
-			cell = *in++;
-			value = fabs(accum + cell.area);
-			value = MIN(value, 1.0);
-			value = value * 255.0 + 0.5;
-			*out++ = (uint8_t) value;
-			accum += cell.cover;
-		}
+		row = (size_t) y * buf.width;
+		kernel(buf.area + row, buf.cover + row, image + (size_t) (flip ? buf.height - 1 - y : y) * stride, buf.width);
 	}
 }
 
+/* Draws the outline into a Buffer of width x height cells, both living in scratch arena until the next glyph. */
 static int
-render_image(const SFT *sft, unsigned long offset, double transform[6], SFT_Char *chr)
+rasterize(const SFT *sft, SFT_Glyph glyph, unsigned long offset, double transform[6], int width, int height, Buffer *buf)
 {
 	Outline outl;
-	Buffer buf;
 	int err = 0;
 
 	memset(&outl, 0, sizeof(outl));
-	memset(&buf, 0, sizeof(buf));
-	
+	memset(buf, 0, sizeof(*buf));
+
+	/* Outline and buffer of the previous glyph are no longer needed. */
+	arena_reset(&scratch);
+
 	err = err || init_outline(&outl) < 0;
-	err = err || decode_outline(sft->font, offset, 0, &outl) < 0;
+	err = err || load_outline(sft->font, glyph, offset, &outl) < 0;
 	if (!err) transform_points(outl.numPoints, outl.points, transform);
-	if (!err) clip_points(outl.numPoints, outl.points, chr->width, chr->height);
-	err = err || tesselate_curves(&outl) < 0;
-
-	err = err || init_buffer(&buf, chr->width, chr->height) < 0;
-	if (!err) draw_lines(&outl, buf);
-	free_outline(&outl);
-	if (!err && sft->flags & SFT_DOWNWARD_Y)
-		flip_buffer(&buf);
-	
-	err = err || (chr->image = (uint8_t*)calloc(chr->width * chr->height, 1)) == NULL;
-	if (!err) post_process(buf, (uint8_t*)chr->image);
+	if (!err) clip_points(outl.numPoints, outl.points, width, height);
+	err = err || tesselate_curves(&outl, render_flatness(sft)) < 0;
 
-	free_buffer(&buf);
+	err = err || init_buffer(buf, width, height) < 0;
+	if (!err) draw_lines(&outl, *buf);
 
 	return err ? -1 : 0;
 }
+
+/* Writes coverage of the glyph into image owned by the caller, nothing is allocated once scratch arena has grown. */
+static int
+render_image(const SFT *sft, SFT_Glyph glyph, unsigned long offset, double transform[6], const SFT_Char *chr,
+             uint8_t *image, int stride)
+{
+	Buffer buf;
+
+	if (rasterize(sft, glyph, offset, transform, chr->width, chr->height, &buf) < 0)
+		return -1;
+
+	/* Rows are written bottom up for downward Y. */
+	post_process(buf, image, stride, sft->flags & SFT_DOWNWARD_Y);
+
+	return 0;
+}
+
+/* Integrates the rows of the glyph that land on canvas one at a time and blends each straight away,
+ * so coverage never leaves the cache. (left, top) is the top left corner of the glyph on canvas. */
+static int
+render_into(const SFT *sft, SFT_Glyph glyph, unsigned long offset, double transform[6], const SFT_Char *chr,
+            SFT_Canvas *canvas, int left, int top, const uint8_t color[4])
+{
+	RowKernel kernel = row_kernel();
+	Buffer buf;
+	uint8_t *coverage;
+	size_t row;
+	int y, beg, end, first, last;
+
+	if (rasterize(sft, glyph, offset, transform, chr->width, chr->height, &buf) < 0)
+		return -1;
+	if ((coverage = (uint8_t*)arena_alloc(&scratch, buf.width)) == NULL)
+		return -1;
+
+	/* Visible columns and rows of the glyph. */
+	beg = left < 0 ? -left : 0;
+	end = MIN(buf.width, canvas->width - left);
+	first = top < 0 ? -top : 0;
+	last = MIN(buf.height, canvas->height - top);
+
+	for (y = first; y < last; ++y) {
+		/* Buffer rows go up, canvas rows go down. */
+		row = (size_t) (buf.height - 1 - y) * buf.width;
+		kernel(buf.area + row, buf.cover + row, coverage, buf.width);
+		sft_blend_span(canvas->pixels + (size_t) (top + y) * canvas->stride + (size_t) (left + beg) * canvas->channels,
+		               coverage + beg, end - beg, canvas->channels, color);
+	}
+
+	return 0;
+}
+
+/* Fills in image of the field, width and height being set already. */
+static int
+render_field(const SFT *sft, SFT_Glyph glyph, unsigned long offset, double transform[6], SFT_Field *field)
+{
+	Outline outl;
+	float *dist;
+	int err = 0;
+
+	memset(&outl, 0, sizeof(outl));
+
+	/* Outline and distances of the previous glyph are no longer needed. */
+	arena_reset(&scratch);
+
+	err = err || init_outline(&outl) < 0;
+	err = err || load_outline(sft->font, glyph, offset, &outl) < 0;
+	if (!err) transform_points(outl.numPoints, outl.points, transform);
+	/* Flattening error shows up magnified when the field is drawn big. */
+	err = err || tesselate_curves(&outl, 0.05) < 0;
+	err = err || (dist = (float*) arena_alloc(&scratch, (size_t) field->width * field->height * sizeof(float))) == NULL;
+	if (!err) field_distances(&outl, dist, field->width, field->height, field->spread);
+	err = err || field_signs(&outl, dist, field->width, field->height) < 0;
+	err = err || (field->image = (uint8_t*) malloc((size_t) field->width * field->height)) == NULL;
+	if (!err) field_encode(dist, field->image, field->width, field->height, field->spread);
+
+	return err ? -1 : 0;
+}
+
+/* Squared distance from each pixel center to the nearest line, up to spread. Lines only touch pixels
+ * they are closer than spread to. */
+static void
+field_distances(Outline *outl, float *dist, int width, int height, double spread)
+{
+	double dx, dy, len, t, px, py, ex, ey, d;
+	int i, x, y, x0, x1, y0, y1;
+	for (i = 0; i < width * height; ++i)
+		dist[i] = (float) (spread * spread);
+	for (i = 0; i < outl->numLines; ++i) {
+		Point a = outl->points[outl->lines[i].beg];
+		Point b = outl->points[outl->lines[i].end];
+		dx = b.x - a.x;
+		dy = b.y - a.y;
+		len = dx * dx + dy * dy;
+		x0 = (int) floor(fmin(a.x, b.x) - spread);
+		x1 = (int) ceil(fmax(a.x, b.x) + spread);
+		y0 = (int) floor(fmin(a.y, b.y) - spread);
+		y1 = (int) ceil(fmax(a.y, b.y) + spread);
+		x0 = x0 < 0 ? 0 : x0;
+		y0 = y0 < 0 ? 0 : y0;
+		x1 = MIN(x1, width);
+		y1 = MIN(y1, height);
+		for (y = y0; y < y1; ++y) {
+			py = y + 0.5 - a.y;
+			for (x = x0; x < x1; ++x) {
+				px = x + 0.5 - a.x;
+				t = len > 0.0 ? (px * dx + py * dy) / len : 0.0;
+				t = t < 0.0 ? 0.0 : (t > 1.0 ? 1.0 : t);
+				ex = px - t * dx;
+				ey = py - t * dy;
+				d = ex * ex + ey * ey;
+				if (d < dist[y * width + x])
+					dist[y * width + x] = (float) d;
+			}
+		}
+	}
+}
+
+/* Turns squared distances into signed ones, negative outside. Pixel centers are inside when the lines
+ * crossing their row left of them don't wind to zero. */
+static int
+field_signs(Outline *outl, float *dist, int width, int height)
+{
+	Crossing *crossings, c;
+	double yc;
+	int i, j, n, x, y, winding;
+	if ((crossings = (Crossing*) arena_alloc(&scratch, (outl->numLines + 1) * sizeof(Crossing))) == NULL)
+		return -1;
+	for (y = 0; y < height; ++y) {
+		yc = y + 0.5;
+		n = 0;
+		for (i = 0; i < outl->numLines; ++i) {
+			Point a = outl->points[outl->lines[i].beg];
+			Point b = outl->points[outl->lines[i].end];
+			if ((a.y <= yc) == (b.y <= yc))
+				continue;
+			c.x = a.x + (yc - a.y) * (b.x - a.x) / (b.y - a.y);
+			c.dir = b.y > a.y ? 1 : -1;
+			/* Rows cross a few lines, insertion sort is enough. */
+			for (j = n++; j > 0 && crossings[j - 1].x > c.x; --j)
+				crossings[j] = crossings[j - 1];
+			crossings[j] = c;
+		}
+		winding = 0;
+		for (i = 0, x = 0; x < width; ++x) {
+			for (; i < n && crossings[i].x < x + 0.5; ++i)
+				winding += crossings[i].dir;
+			dist[y * width + x] = winding ? sqrtf(dist[y * width + x]) : -sqrtf(dist[y * width + x]);
+		}
+	}
+	return 0;
+}
+
+/* Maps signed distance of [-spread, spread] to [1, 255], rows of the image going top down. */
+static void
+field_encode(const float *dist, uint8_t *image, int width, int height, double spread)
+{
+	float value, scale = (float) (127.0 / spread);
+	int x, y;
+	for (y = 0; y < height; ++y) {
+		const float *row = dist + (size_t) (height - 1 - y) * width;
+		for (x = 0; x < width; ++x) {
+			value = 128.0f + row[x] * scale;
+			value = value < 0.0f ? 0.0f : (value > 255.0f ? 255.0f : value);
+			image[(size_t) y * width + x] = (uint8_t) (value + 0.5f);
+		}
+	}
+}
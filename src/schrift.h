@@ -53,6 +53,11 @@ typedef struct SFT_LMetrics SFT_LMetrics;
 typedef struct SFT_GMetrics SFT_GMetrics;
 typedef struct SFT_Kerning  SFT_Kerning;
 typedef struct SFT_Char     SFT_Char;
+typedef struct SFT_Canvas   SFT_Canvas;
+typedef struct SFT_Field    SFT_Field;
+typedef struct SFT_UMetrics SFT_UMetrics;
+typedef struct SFT_KernPair SFT_KernPair;
+typedef struct SFT_CmapGroup SFT_CmapGroup;
 
 struct SFT
 {
@@ -75,6 +80,58 @@ struct SFT_Font {
 	uint_least16_t unitsPerEm;
 	int_least16_t locaFormat;
 	uint_least16_t numLongHmtx;
+	uint_least16_t numGlyphs;
+	/* Offsets of tables, resolved when font is loaded. 0 if font has no such table */
+	uint_least32_t hhea, hmtx, loca, glyf, kern;
+	/* Offset and format of the cmap subtable glyph_id() reads, cmapFormat is 0 if there's no usable one */
+	uint_least32_t cmapTable;
+	int cmapFormat;
+	/* Metrics of every glyph, read when font is loaded. NULL if font has no maxp table */
+	SFT_UMetrics *metrics;
+	/* Glyph ids of BMP code points, cmap[code >> 8][code & 0xFF]. cmap[0] is NULL if cmap couldn't be decoded */
+	const uint_least16_t *cmap[256];
+	uint_least16_t *cmapPages;
+	/* Format 12 groups sorted by first code point */
+	SFT_CmapGroup *cmapGroups;
+	uint_least32_t numCmapGroups;
+	/* Kerning pairs of kern table in open addressing hash, kernMask + 1 slots. NULL if kern table couldn't be decoded */
+	SFT_KernPair *kernPairs;
+	uint_least32_t kernMask;
+	/* Decoded outlines in font units by glyph id, filled as glyphs are rendered. NULL if outlines aren't cached */
+	struct Outline **outlines;
+};
+
+/*
+	Metrics of a glyph in font units, as found in hmtx, loca and glyf tables
+*/
+struct SFT_UMetrics
+{
+	uint_least16_t advanceWidth;
+	int_least16_t leftSideBearing;
+	/* Bounding box of the outline: xMin, yMin, xMax, yMax */
+	int_least16_t box[4];
+	/* Offset of the outline in font, 0 if glyph has no outline */
+	uint_least32_t outline;
+	/* How far the metrics could be read, MetricsOk if completely */
+	uint_least8_t state;
+};
+
+/*
+	Kerning of a glyph pair in font units, sum of all horizontal kern subtables
+*/
+struct SFT_KernPair
+{
+	/* leftGlyph << 16 | rightGlyph, 0xFFFFFFFF - empty slot (glyph ids are below 0xFFFF) */
+	uint_least32_t pair;
+	int_least16_t xShift;
+	int_least16_t yShift;
+};
+
+struct SFT_CmapGroup
+{
+	uint_least32_t firstCode;
+	uint_least32_t lastCode;
+	uint_least32_t firstGlyph;
 };
 
 struct SFT_LMetrics
@@ -111,6 +168,33 @@ struct SFT_Char
 	int height;
 };
 
+struct SFT_Canvas
+{
+	/* Top left pixel, rows run top down */
+	uint8_t* pixels;
+	int width;
+	int height;
+	/* Bytes between starts of rows */
+	int stride;
+	/* Bytes per pixel, 1 to 4, color is written in RGBA order */
+	int channels;
+};
+
+struct SFT_Field
+{
+	/* Signed distance to the outline, 128 on it and greater inside. width*height bytes, rows run top down */
+	uint8_t* image;
+	int width;
+	int height;
+	/* Pixels on each side of the outline box, so the distance can fall off outside of it */
+	int padding;
+	/* Pen position (glyph origin on the baseline) in pixels from the top left corner */
+	double originX;
+	double originY;
+	/* Distance in pixels that is encoded as 127 */
+	double spread;
+};
+
 struct SFT_Kerning
 {
 	/* An amount that should be added to the pen's X position in-between the two glyphs */
@@ -126,6 +210,10 @@ SFT_Font *sft_loadmem(const void *mem, unsigned long size);
 SFT_Font *sft_loadfile(const char *filename);
 void sft_freefont(SFT_Font *font);
 
+/*
+	@brief Maps unicode character code to glyph id of the font, 0 if font is missing the glyph
+*/
+int sft_lookup(const SFT *sft, unsigned long charCode, SFT_Glyph *glyph);
 /*
 	@brief Calculates the typographic metrics neccessary for laying out multiple lines of text
 */
@@ -142,6 +230,36 @@ int sft_kerning(const SFT *sft, SFT_Glyph leftGlyph, SFT_Glyph rightGlyph, SFT_K
 	@brief Render a glyph
 */
 int sft_char(const SFT *sft, unsigned long charCode, SFT_Char *chr);
+/*
+	@brief Fill in advance and bounding box of a glyph like sft_char() does, without rendering it
+	@returns Same as sft_char(), image is NULL
+*/
+int sft_char_metrics(const SFT *sft, unsigned long charCode, SFT_Char *chr);
+/*
+	@brief Render a glyph like sft_char() does, but into memory of the caller, so nothing is allocated.
+	@brief Image points to the top left pixel of canvas, it has to be as big as the box sft_char_metrics() gives
+	@param canvas One channel coverage, stride apart rows
+	@returns Same as sft_char(), -1 if glyph doesn't fit
+*/
+int sft_char_into(const SFT *sft, unsigned long charCode, SFT_Char *chr, SFT_Canvas *canvas);
+/*
+	@brief Render a glyph straight onto canvas, blending color over it with glyph coverage as alpha.
+	@brief Glyph is drawn upright whatever the Y direction of sft, parts outside of canvas are clipped
+	@param x,y Pen position on canvas (glyph origin on the baseline)
+	@returns 0 on success, -1 on error
+*/
+int sft_render_into(const SFT *sft, SFT_Glyph glyph, SFT_Canvas *canvas, int x, int y, const uint8_t color[4]);
+/*
+	@brief Blend color over count pixels of one row, coverage being the alpha of the color
+	@param dst First pixel of the row, channels bytes each in RGBA order
+*/
+void sft_blend_span(uint8_t *dst, const uint8_t *coverage, int count, int channels, const uint8_t color[4]);
+/*
+	@brief Make signed distance field of a glyph at the scale of sft, offsets of sft are ignored.
+	@brief One field can be drawn at any size, image has to be freed
+	@param spread Distance in pixels the field covers on both sides of the outline
+*/
+int sft_field(const SFT *sft, unsigned long charCode, double spread, SFT_Field *field);
 
 #ifdef __cplusplus
 }